@@ -45,12 +45,23 @@
 
 #define DSHOW_MAX_PLANES 8
 
+#define DSHOW_RECORD_INDEX_MAGIC    0x58495344 /* "DSIX" */
+#define DSHOW_RECORD_INDEX_VERSION  1
+
+/** RecordIndexEntry flags */
+#define DSHOW_RECORD_INDEX_KEYFRAME 0x1
+#define DSHOW_RECORD_INDEX_AUDIO    0x2
+
 namespace DShow {
 	/* internal forward */
 	struct HDevice;
 	struct HVideoEncoder;
 	struct VideoConfig;
 	struct AudioConfig;
+	struct ControlSnapshot;
+	struct LumaStats;
+	struct SignalStatus;
+	struct QualityChange;
 
 	typedef std::function<
 		void (const VideoConfig &config,
@@ -64,6 +75,39 @@ namespace DShow {
 			long long startTime, long long stopTime)
 		> AudioProc;
 
+	typedef std::function<
+		void (const ControlSnapshot &snapshot)
+		> ControlProc;
+
+	typedef std::function<
+		void (const VideoConfig &config, const LumaStats &stats,
+			long long startTime, long long stopTime)
+		> LumaStatsProc;
+
+	enum class SignalEvent;
+
+	typedef std::function<
+		void (const VideoConfig &config, SignalEvent event,
+			const SignalStatus &status)
+		> SignalEventProc;
+
+	typedef std::function<
+		void (const QualityChange &change)
+		> QualityChangeProc;
+
+	/*
+	 * Function pointer forms of VideoProc/AudioProc.  Nothing is
+	 * allocated or copied along with them when a config is copied, and
+	 * each sample costs a single direct call.
+	 */
+	typedef void (*VideoSampleProc)(void *param, const VideoConfig &config,
+			unsigned char *data, size_t size,
+			long long startTime, long long stopTime);
+
+	typedef void (*AudioSampleProc)(void *param, const AudioConfig &config,
+			unsigned char *data, size_t size,
+			long long startTime, long long stopTime);
+
 	enum class InitGraph {
 		False,
 		True
@@ -90,12 +134,18 @@ namespace DShow {
 		NV12,
 		YV12,
 		Y800,
+		P010, /* NV12 layout, 10-bit samples in 16-bit words */
+		P210, /* 4:2:2 variant of P010 */
+		I422,
+		I444,
+		NV16, /* 4:2:2 variant of NV12 */
 
 		/* packed YUV formats */
 		YVYU = 300,
 		YUY2,
 		UYVY,
 		HDYC,
+		V210, /* 10-bit 4:2:2, six pixels per 16 bytes */
 
 		/* encoded formats */
 		MJPEG = 400,
@@ -128,6 +178,21 @@ namespace DShow {
 		Error
 	};
 
+	/** Container written by Device::StartRecording */
+	enum class RecordFormat {
+		FragmentedMP4,
+
+		/** MPEG-TS segments next to a rolling .m3u8 playlist */
+		HLS
+	};
+
+	enum class ThreadPriority {
+		Default,
+		AboveNormal,
+		Highest,
+		TimeCritical
+	};
+
 	struct VideoInfo {
 		int         minCX, minCY;
 		int         maxCX, maxCY;
@@ -144,6 +209,284 @@ namespace DShow {
 		AudioFormat format;
 	};
 
+	/** The format a device is currently delivering video in */
+	struct VideoStreamFormat {
+		int         cx = 0, cy = 0;
+		long long   frameInterval = 0;
+		VideoFormat internalFormat = VideoFormat::Any;
+		VideoFormat format = VideoFormat::Any;
+
+		/** Incremented on every format change */
+		unsigned long long changes = 0;
+	};
+
+	/** The format a device is currently delivering audio in */
+	struct AudioStreamFormat {
+		int         sampleRate = 0;
+		int         channels = 0;
+		AudioFormat format = AudioFormat::Any;
+
+		/** Incremented on every format change */
+		unsigned long long changes = 0;
+	};
+
+	/**
+	 * Luma statistics of a frame.  Mean and clipping cover every pixel
+	 * of the sampled rows, the histogram every Nth pixel of them (N
+	 * being VideoConfig::lumaSubsample).
+	 */
+	struct LumaStats {
+		unsigned int       histogram[256];
+		unsigned long long pixels;
+		float              mean;
+
+		/** Pixels at or below 16 / at or above 235 */
+		float              lowClipPercent;
+		float              highClipPercent;
+	};
+
+	enum class SignalEvent {
+		BlackStart,
+		BlackEnd,
+		FrozenStart,
+		FrozenEnd,
+		LetterboxStart,
+		LetterboxEnd
+	};
+
+	/**
+	 * Signal quality detectors, run on the luma sampled for LumaStats.
+	 * Luma values are 8-bit, durations in 100-nanosecond units of
+	 * stream time.
+	 */
+	struct SignalQCConfig {
+		bool        enabled = false;
+
+		/** Black: mean luma at or below blackMaxMean, and at least
+		 * blackMinPercent of the pixels at or below 16 */
+		float       blackMaxMean = 24.0f;
+		float       blackMinPercent = 98.0f;
+
+		/** Frozen: mean absolute luma difference from the previous
+		 * frame at or below freezeMaxDifference */
+		float       freezeMaxDifference = 0.5f;
+
+		/** Letterbox: top and bottom bars whose rows stay at or
+		 * below letterboxMaxLuma, each at least letterboxMinPercent
+		 * of the frame height */
+		int         letterboxMaxLuma = 32;
+		float       letterboxMinPercent = 5.0f;
+
+		/**
+		 * How long a condition has to hold before its start event,
+		 * in 100ns units (sample time, restarted with the graph)
+		 */
+		long long   blackDuration = 20000000;
+		long long   freezeDuration = 20000000;
+		long long   letterboxDuration = 20000000;
+
+		/** How long a condition has to be gone before its end
+		 * event, in 100ns units */
+		long long   clearDuration = 5000000;
+	};
+
+	struct SignalStatus {
+		/** Conditions that have held for their durations */
+		bool        black = false;
+		bool        frozen = false;
+		bool        letterboxed = false;
+
+		/** Measurements of the last frame */
+		float       mean = 0.0f;
+		float       difference = 0.0f;
+		int         barTop = 0, barBottom = 0;
+		long long   time = 0;
+	};
+
+	/**
+	 * A video mode to try with Device::ProbeVideoModes, and what the
+	 * device actually delivered in it.  Times are in 100-nanosecond
+	 * units.
+	 */
+	struct VideoModeProbe {
+		int         cx = 0, cy = 0;
+		long long   frameInterval = 0;
+		VideoFormat format = VideoFormat::Any;
+
+		/** Whether the mode could be set up and started */
+		bool        started = false;
+		unsigned int frames = 0;
+
+		/** Average delivered frame interval and its deviation */
+		long long   interval = 0;
+		long long   jitter = 0;
+
+		/** Time from starting the device to the first frame */
+		long long   latency = 0;
+
+		/** Delivered within 5% of the nominal frame rate */
+		bool        sustained = false;
+	};
+
+	/** A video mode the downgrade policy can switch to */
+	struct QualityStep {
+		int         cx = 0, cy = 0;
+		long long   frameInterval = 0;
+	};
+
+	struct QualityChange {
+		QualityStep from;
+		QualityStep to;
+		bool        downgrade;
+
+		/** False if the device could not be switched to 'to' */
+		bool        success;
+
+		/**
+		 * True if the graph could not be restarted after the
+		 * switch.  The device no longer delivers frames and no
+		 * further switches are made; stop and restart it.
+		 */
+		bool        stopped;
+
+		/** Load measured over the period that led to the change */
+		float       busyPercent;
+		float       dropPercent;
+	};
+
+	/**
+	 * Steps a running device down to cheaper video modes while the host
+	 * can't keep up, and back up once it can.  Busy is the time spent in
+	 * the video callback relative to the frame interval; drops are gaps
+	 * in the frame timestamps.
+	 */
+	struct DowngradePolicy {
+		bool        enabled = false;
+
+		/**
+		 * Modes to step down through after the configured one, most
+		 * expensive first.  If empty, the device's advertised modes
+		 * in the same format with a lower pixel rate are used.
+		 */
+		std::vector<QualityStep> steps;
+
+		/** Step down once busy or drops stay at or above these for
+		 * downgradeMs */
+		float       busyPercent = 90.0f;
+		float       dropPercent = 5.0f;
+		unsigned int downgradeMs = 3000;
+
+		/** Step up once busy stays at or below headroomPercent with
+		 * no drops for upgradeMs (doubled, up to 8 times, whenever a
+		 * step up has to be undone soon after) */
+		float       headroomPercent = 50.0f;
+		unsigned int upgradeMs = 30000;
+
+		/**
+		 * Called from the governor thread after every switch.  Do
+		 * not call Device::Stop or destroy the device from it: both
+		 * wait for the governor thread, which would then be waiting
+		 * for itself.
+		 */
+		QualityChangeProc callback;
+	};
+
+	/** Pool buffers held by a device */
+	struct BufferUsage {
+		size_t      buffers;
+		size_t      bytes;
+		size_t      peakBytes;
+	};
+
+	/** What a device's pool buffers are used for */
+	enum class MemorySubsystem {
+		Capture,    /* samples filled by the device */
+		Conversion, /* converted video frames */
+		Reassembly, /* encoded frames being put back together */
+		Recording,  /* packets waiting to be written to disk */
+		Simulcast,  /* scaled renditions */
+		Packets,    /* encoder output waiting to be read */
+		Decoding,   /* H.264 frames queued for and output by decode */
+
+		Count
+	};
+
+	struct MemoryUsage {
+		BufferUsage total;
+		BufferUsage subsystems[(int)MemorySubsystem::Count];
+
+		/** Budget set with Device::SetMemoryBudget (0 = none) */
+		size_t      budget;
+
+		/** Number of times data was dropped to stay in the budget */
+		unsigned long long degradations;
+	};
+
+	/** Sample allocator negotiated with the device's output pin */
+	struct AllocatorInfo {
+		long        buffers = 0;
+		long        bufferSize = 0;
+		long        alignment = 0;
+		long        prefix = 0;
+
+		/** Whether the device fills the library's pooled buffers */
+		bool        pooled = false;
+	};
+
+	struct BufferPoolConfig {
+		/**
+		 * Back large buffers with large pages (requires
+		 * SeLockMemoryPrivilege, falls back to normal pages otherwise)
+		 */
+		bool         largePages = false;
+
+		/** Free buffers idle for this long (0 keeps them forever) */
+		unsigned int idleTrimMs = 10000;
+	};
+
+	/**
+	 * Image and camera controls.  These map to IAMVideoProcAmp and
+	 * IAMCameraControl, or to the Elgato filter settings (brightness,
+	 * contrast, hue and saturation, 0-10000) on devices without them.
+	 */
+	enum class VideoControl {
+		Brightness,
+		Contrast,
+		Hue,
+		Saturation,
+		Sharpness,
+		Gamma,
+		WhiteBalance,
+		BacklightCompensation,
+		Gain,
+		Exposure,
+		Focus,
+		Zoom,
+		Pan,
+		Tilt,
+		Iris,
+
+		Count
+	};
+
+	struct ControlState {
+		bool        supported;
+		long        minValue, maxValue, step, defaultValue;
+		long        value;
+		bool        autoSupported;
+		bool        autoMode;
+	};
+
+	struct ControlSnapshot {
+		ControlState controls[(int)VideoControl::Count];
+
+		/** Incremented whenever a value changes */
+		unsigned long long version;
+
+		/** GetTickCount64() of the last read from the driver */
+		unsigned long long readTime;
+	};
+
 	struct DeviceId {
 		std::wstring name;
 		std::wstring path;
@@ -162,11 +505,60 @@ namespace DShow {
 	struct Config : DeviceId {
 		/** Use the device's desired default config */
 		bool        useDefaultConfig = true;
+
+		/**
+		 * CPU affinity mask applied to the threads that deliver this
+		 * stream's samples (0 to leave the affinity untouched)
+		 */
+		unsigned long long affinityMask = 0;
+
+		/** Priority of the threads that deliver this stream's samples */
+		ThreadPriority priority = ThreadPriority::Default;
+
+		/**
+		 * Register the library's own threads for this stream (such
+		 * as the H.264 decode thread) with the MMCSS "Capture" task.
+		 * Delivery threads belong to the upstream filter and are not
+		 * registered.
+		 */
+		bool        useMMCSS = false;
+
+		/**
+		 * Number of sample buffers to request from the device so samples
+		 * can be held for a while without starving the driver (0 lets
+		 * the device decide)
+		 */
+		int         pipelineDepth = 0;
+	};
+
+	/**
+	 * A scaled copy of the captured video.  Renditions are produced from
+	 * the frame the main video callback receives, each scaled from the
+	 * next larger rendition so that work is shared down the ladder.
+	 */
+	struct SimulcastRendition {
+		VideoProc   callback;
+
+		/** Used instead of callback when set */
+		VideoSampleProc sampleCallback = nullptr;
+		void        *sampleParam = nullptr;
+
+		int         cx = 0, cy = 0;
+
+		/** Deliver every Nth captured frame */
+		int         frameDivisor = 1;
+
+		/** I420, or YV12 which is what VideoEncoder takes */
+		VideoFormat format = VideoFormat::I420;
 	};
 
 	struct VideoConfig : Config {
 		VideoProc   callback;
 
+		/** Used instead of callback when set */
+		VideoSampleProc sampleCallback = nullptr;
+		void        *sampleParam = nullptr;
+
 		/** Desired width/height of video.  */
 		int         cx = 0, cy = 0;
 
@@ -178,11 +570,71 @@ namespace DShow {
 
 		/** Desired video format. */
 		VideoFormat format = VideoFormat::Any;
+
+		/**
+		 * Dither rather than round when the library reduces a 10-bit
+		 * internal format to an 8-bit desired format
+		 */
+		bool        dither = false;
+
+		/**
+		 * Scaled outputs to produce alongside the main callback.  The
+		 * desired format must be I420, YV12, NV12 or packed 4:2:2.
+		 */
+		std::vector<SimulcastRendition> renditions;
+
+		/** Called on the control thread when a control value changes */
+		ControlProc controlCallback;
+
+		/** How often controls are re-read (0 only reads on request) */
+		unsigned int controlRefreshMs = 2000;
+
+		/**
+		 * Called with each frame's luma statistics just before the
+		 * frame itself is passed to callback.  Available for 8-bit
+		 * and 16-bit YUV output formats; the statistics come from
+		 * the conversion pass when the library converts the frame.
+		 */
+		LumaStatsProc lumaCallback;
+
+		/** Only every Nth row (and Nth pixel) is counted */
+		int         lumaSubsample = 4;
+
+		/** Black, frozen and letterboxed frame detection */
+		SignalQCConfig  qc;
+
+		/** Called from the capture thread when a QC condition
+		 * starts or ends */
+		SignalEventProc qcCallback;
+
+		/**
+		 * H.264 devices: decode the stream and pass the frames to
+		 * the video callback in decodeFormat, NV12 or I420, instead
+		 * of the H.264 data.  The callback is then called on the
+		 * decode thread, and its config has the decoded size and
+		 * format.  Recording still gets the H.264 data.
+		 */
+		bool        decode = false;
+		VideoFormat decodeFormat = VideoFormat::NV12;
+
+		/**
+		 * Frames that may wait for the decoder.  When the queue is
+		 * full it is dropped and decoding resumes at the next
+		 * keyframe, which bounds the decode latency.
+		 */
+		int         decodeQueueFrames = 2;
+
+		/** Decoder worker threads (0 lets the decoder decide) */
+		int         decodeThreads = 0;
 	};
 
 	struct AudioConfig : Config {
 		AudioProc   callback;
 
+		/** Used instead of callback when set */
+		AudioSampleProc sampleCallback = nullptr;
+		void        *sampleParam = nullptr;
+
 		/**
 		 * Use the audio attached to the video device
 		 *
@@ -206,6 +658,59 @@ namespace DShow {
 		AudioMode   mode = AudioMode::Capture;
 	};
 
+	struct RecordConfig {
+		/** Output file (the playlist for HLS) */
+		std::wstring path;
+
+		RecordFormat format = RecordFormat::FragmentedMP4;
+
+		/** Streams to include */
+		bool         video = true;
+		bool         audio = true;
+
+		/** HLS: target segment length in seconds */
+		int          segmentSeconds = 4;
+
+		/** HLS: segments kept in the playlist, 0 to keep all */
+		int          playlistSegments = 6;
+
+		/** Write a sync point index to "<path>.idx" */
+		bool         index = false;
+	};
+
+	/**
+	 * The index file is a RecordIndexHeader followed by fixed-size
+	 * RecordIndexEntry records (little-endian) in ascending time order.
+	 * Records are appended as the data they point to is written, so
+	 * readers can map the file and binary search it while recording is
+	 * still in progress.
+	 */
+	struct RecordIndexHeader {
+		unsigned int       magic;
+		unsigned int       version;
+		unsigned int       entrySize;
+		unsigned int       reserved;
+	};
+
+	struct RecordIndexEntry {
+		/** Time since the start of the recording, in 100ns units */
+		long long          time;
+
+		/**
+		 * Byte offset in the file (or HLS segment).  MP4 entries
+		 * point at a moof box.  TS entries point at the PAT when
+		 * the mux writes the tables there (segment starts), and at
+		 * the first packet of the PES otherwise.
+		 */
+		unsigned long long offset;
+
+		/** HLS segment number, 0 for single file recordings */
+		unsigned int       segment;
+
+		/** DSHOW_RECORD_INDEX_* flags */
+		unsigned int       flags;
+	};
+
 	class DSHOWCAPTURE_EXPORT Device {
 		HDevice *context;
 
@@ -231,11 +736,97 @@ namespace DShow {
 		Result      Start();
 		void        Stop();
 
+		/**
+		 * Gets the configs.  These block while the config is being
+		 * changed: for the whole of a SetVideoConfig/SetAudioConfig,
+		 * Start, Stop, or quality mode switch (which stops the graph,
+		 * waits for the capture callbacks to return, reconnects and
+		 * runs it again).  Never call them from the callbacks.
+		 *
+		 * Only GetVideoFormat/GetAudioFormat are non-blocking; use
+		 * those for the current size, interval and format.
+		 */
 		bool        GetVideoConfig(VideoConfig &config) const;
 		bool        GetAudioConfig(AudioConfig &config) const;
 		bool        GetVideoDeviceId(DeviceId &id) const;
 		bool        GetAudioDeviceId(DeviceId &id) const;
 
+		/**
+		 * Gets the format currently being delivered.  Safe to call
+		 * from any thread while streaming; never allocates and never
+		 * blocks the streaming thread.
+		 */
+		bool        GetVideoFormat(VideoStreamFormat &format) const;
+		bool        GetAudioFormat(AudioStreamFormat &format) const;
+
+		/**
+		 * Gets the QC state as of the last frame (requires
+		 * VideoConfig::qc.enabled).  Safe to call from any thread.
+		 */
+		bool        GetSignalStatus(SignalStatus &status) const;
+
+		/** Gets the buffer pool usage of this device */
+		bool        GetBufferUsage(BufferUsage &usage) const;
+
+		/**
+		 * Gets the current/peak usage of each subsystem.  Kept for
+		 * the life of the Device, across ResetGraph/ShutdownGraph.
+		 */
+		bool        GetMemoryUsage(MemoryUsage &usage) const;
+
+		/**
+		 * Limits the pool memory held by this device (0 = no limit).
+		 * Over the budget the device sheds data rather than growing:
+		 * spare recording buffers are freed, the recording queue
+		 * drops to the next keyframe and partial encoded frames are
+		 * discarded.
+		 */
+		void        SetMemoryBudget(size_t bytes);
+
+		/**
+		 * Sets the policy used from the next Start on; a device that
+		 * is already started keeps its current policy.  Switching
+		 * modes briefly stops the graph (on a library thread), so the
+		 * video and audio callbacks see a short gap, and the video
+		 * callback's config changes size/interval.
+		 */
+		void        SetDowngradePolicy(const DowngradePolicy &policy);
+
+		/**
+		 * Gets the allocator properties the device settled on.  Only
+		 * valid once the filters are connected.
+		 */
+		bool        GetVideoAllocatorInfo(AllocatorInfo &info) const;
+		bool        GetAudioAllocatorInfo(AllocatorInfo &info) const;
+
+		/**
+		 * Gets the last known control values of the video device.
+		 * Controls are read on a separate thread after SetVideoConfig
+		 * and every controlRefreshMs after that, so this never calls
+		 * into the driver.
+		 */
+		bool        GetControls(ControlSnapshot &snapshot) const;
+
+		/**
+		 * Queues a control change.  Changes made before the control
+		 * thread gets to them are coalesced (the last value wins) and
+		 * applied in one batch, after which the controls are re-read.
+		 */
+		bool        SetControl(VideoControl control, long value,
+				bool autoMode = false);
+
+		/** Requests that the controls are read again */
+		void        RefreshControls();
+
+		/**
+		 * Writes the device's encoded H.264/AAC output to a file in
+		 * addition to passing it to the callbacks.  Only available on
+		 * encoded devices, after SetVideoConfig/SetAudioConfig.  The
+		 * file is written on a separate thread.
+		 */
+		bool        StartRecording(const RecordConfig &config);
+		void        StopRecording();
+
 		/**
 		 * Opens a DirectShow dialog associated with this device
 		 *
@@ -244,6 +835,20 @@ namespace DShow {
 		void        OpenDialog(void *hwnd, DialogType type) const;
 
 		static bool EnumVideoDevices(std::vector<VideoDevice> &devices);
+
+		/**
+		 * Briefly starts the device in each mode and measures what
+		 * it delivers.  With no modes given, every advertised mode is
+		 * tried at its largest size and shortest interval.  The
+		 * device must not be in use.  Results are kept for the rest
+		 * of the process, and SetVideoConfig prefers modes that were
+		 * proven to sustain their rate over ones that were not.
+		 *
+		 * @param  durationMs  How long each mode is run for
+		 */
+		static bool ProbeVideoModes(const DeviceId &device,
+				std::vector<VideoModeProbe> &modes,
+				unsigned int durationMs = 1000);
 		static bool EnumAudioDevices(std::vector<AudioDevice> &devices);
 	};
 
@@ -256,6 +861,37 @@ namespace DShow {
 		int cy;
 	};
 
+	/**
+	 * Closed-loop control of the encoder bitrate, fed by
+	 * VideoEncoder::UpdateNetworkStats.  Bitrates are in kbps, times in
+	 * 100-nanosecond units.
+	 */
+	struct BitrateControlConfig {
+		bool      enabled = false;
+
+		int       minBitrate = 1000;
+		int       maxBitrate = 20000;
+
+		/** Fraction of the measured bandwidth to encode at */
+		double    headroom = 0.85;
+
+		/** Send queue above which the bitrate backs off, and below
+		 * which it is allowed to rise again */
+		long long queueHigh = 5000000;
+		long long queueLow = 1000000;
+
+		/** Largest single change, in percent of the current bitrate */
+		int       maxIncrease = 10;
+		int       maxDecrease = 25;
+
+		/** Changes smaller than this (percent) are ignored */
+		int       hysteresis = 5;
+
+		/** Minimum time between changes */
+		long long increaseInterval = 20000000;
+		long long decreaseInterval = 5000000;
+	};
+
 	struct EncoderPacket {
 		unsigned char  *data;
 		size_t         size;
@@ -278,6 +914,17 @@ namespace DShow {
 		bool SetConfig(VideoEncoderConfig &config);
 		bool GetConfig(VideoEncoderConfig &config) const;
 
+		bool SetBitrateControl(const BitrateControlConfig &config);
+
+		/**
+		 * Reports the available bandwidth (kbps, 0 if unknown) and how
+		 * much encoded data is waiting to be sent (100ns units).  When
+		 * bitrate control is enabled, this may change the encoder
+		 * bitrate.
+		 */
+		void UpdateNetworkStats(int bandwidth, long long queueDuration);
+		int  GetBitrate() const;
+
 		bool Encode(unsigned char *data[DSHOW_MAX_PLANES],
 				size_t linesize[DSHOW_MAX_PLANES],
 				long long timestampStart,
@@ -300,4 +947,32 @@ namespace DShow {
 
 	DSHOWCAPTURE_EXPORT void SetLogCallback(LogCallback callback,
 			void *param);
+
+	/**
+	 * Configures the frame buffer pool shared by all devices.  Applies to
+	 * buffers allocated after the call.
+	 */
+	DSHOWCAPTURE_EXPORT void SetBufferPoolConfig(
+			const BufferPoolConfig &config);
+
+	/** Frees all buffers currently idle in the pool */
+	DSHOWCAPTURE_EXPORT void TrimBufferPool();
+
+	struct AllocationStats {
+		/** Allocations made by warmed-up streaming threads */
+		unsigned long long steadyAllocations;
+		unsigned long long steadyBytes;
+
+		/** Distinct call sites they came from */
+		unsigned int       callSites;
+	};
+
+	/**
+	 * Gets the number of heap allocations made on the library's
+	 * streaming paths after warm-up.  Returns false unless the library
+	 * was built with DSHOW_ALLOC_TRACKING.  Each new call site is also
+	 * logged with its stack.
+	 */
+	DSHOWCAPTURE_EXPORT bool GetAllocationStats(AllocationStats &stats);
+	DSHOWCAPTURE_EXPORT void ResetAllocationStats();
 };
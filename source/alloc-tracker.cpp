@@ -0,0 +1,337 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+#include "alloc-tracker.hpp"
+#include "log.hpp"
+#include "../dshowcapture.hpp"
+
+#include <stdlib.h>
+#include <wchar.h>
+#include <new>
+
+namespace DShow {
+
+#ifdef DSHOW_ALLOC_TRACKING
+
+/* about five seconds of frames at 60fps */
+#define ALLOC_WARMUP_CALLS 300
+#define MAX_CALL_SITES     64
+#define CALL_SITE_FRAMES   8
+
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+struct AllocThreadState {
+	const char *scope;
+	unsigned   calls;
+	bool       inHook;
+};
+
+struct AllocCallSite {
+	ULONG      hash;
+	USHORT     depth;
+	void       *frames[CALL_SITE_FRAMES];
+	const char *scope;
+	size_t     size;
+	bool       reported;
+};
+
+static THREAD_LOCAL AllocThreadState threadState;
+
+/* the tracker runs inside operator new, so it can't use anything that
+ * might allocate: fixed tables and an SRW lock only */
+static SRWLOCK       siteLock = SRWLOCK_INIT;
+static AllocCallSite sites[MAX_CALL_SITES];
+static unsigned      siteCount = 0;
+static unsigned      untrackedSites = 0;
+static volatile LONG pendingReports = 0;
+static volatile LONGLONG steadyAllocations = 0;
+static volatile LONGLONG steadyBytes = 0;
+
+AllocScope::AllocScope(const char *name, bool entry)
+	: prevScope (threadState.scope),
+	  active    (entry || threadState.scope)
+{
+	if (!active)
+		return;
+
+	if (!prevScope && threadState.calls < ALLOC_WARMUP_CALLS)
+		threadState.calls++;
+
+	threadState.scope = name;
+}
+
+static void ReportCallSites();
+
+AllocScope::~AllocScope()
+{
+	if (!active)
+		return;
+
+	threadState.scope = prevScope;
+
+	/* outside all scopes, so logging is not tracked itself */
+	if (!prevScope && pendingReports)
+		ReportCallSites();
+}
+
+AllocPause::AllocPause()
+	: prevScope (threadState.scope)
+{
+	threadState.scope = nullptr;
+}
+
+AllocPause::~AllocPause()
+{
+	threadState.scope = prevScope;
+}
+
+void RewarmAllocationTracking()
+{
+	threadState.calls = 0;
+}
+
+static void AddCallSite(ULONG hash, USHORT depth, void **frames,
+		const char *scope, size_t size)
+{
+	bool known = false;
+
+	AcquireSRWLockExclusive(&siteLock);
+
+	for (unsigned i = 0; i < siteCount; i++) {
+		if (sites[i].hash == hash && sites[i].depth == depth &&
+		    memcmp(sites[i].frames, frames,
+				    depth * sizeof(void*)) == 0) {
+			known = true;
+			break;
+		}
+	}
+
+	if (!known) {
+		if (siteCount < MAX_CALL_SITES) {
+			AllocCallSite &site = sites[siteCount++];
+			site.hash     = hash;
+			site.depth    = depth;
+			site.scope    = scope;
+			site.size     = size;
+			site.reported = false;
+			memcpy(site.frames, frames, depth * sizeof(void*));
+		} else {
+			untrackedSites++;
+		}
+
+		pendingReports = 1;
+	}
+
+	ReleaseSRWLockExclusive(&siteLock);
+}
+
+static void FormatFrame(wchar_t *str, size_t size, void *address)
+{
+	HMODULE module = nullptr;
+	wchar_t path[MAX_PATH] = L"?";
+
+	if (GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS |
+			GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+			(LPCWSTR)address, &module))
+		GetModuleFileNameW(module, path, MAX_PATH);
+
+	const wchar_t *name = wcsrchr(path, L'\\');
+	name = name ? name + 1 : path;
+
+	swprintf_s(str, size, L" %s+0x%llx", name,
+			(unsigned long long)((char*)address - (char*)module));
+}
+
+static void ReportCallSite(const char *scope, size_t size, USHORT depth,
+		void **frames)
+{
+	wchar_t stack[1024] = L"";
+	size_t  len = 0;
+
+	for (USHORT i = 0; i < depth && len + 128 < 1024; i++) {
+		FormatFrame(stack + len, 1024 - len, frames[i]);
+		len += wcslen(stack + len);
+	}
+
+	Warning(L"Allocation of %llu bytes in '%S' after warm-up:%s",
+			(unsigned long long)size, scope, stack);
+}
+
+/* logs the call sites found since the last report.  The lock is not held
+ * while logging, since the log callback may allocate on other threads */
+static void ReportCallSites()
+{
+	for (;;) {
+		AllocCallSite site;
+		unsigned untracked;
+		bool     found = false;
+
+		AcquireSRWLockExclusive(&siteLock);
+
+		for (unsigned i = 0; i < siteCount; i++) {
+			if (!sites[i].reported) {
+				sites[i].reported = true;
+				site  = sites[i];
+				found = true;
+				break;
+			}
+		}
+
+		untracked      = found ? 0 : untrackedSites;
+		untrackedSites = found ? untrackedSites : 0;
+		if (!found)
+			pendingReports = 0;
+
+		ReleaseSRWLockExclusive(&siteLock);
+
+		if (found) {
+			ReportCallSite(site.scope, site.size, site.depth,
+					site.frames);
+			continue;
+		}
+
+		if (untracked)
+			Warning(L"%u more allocation sites after warm-up, "
+			        L"call site table is full", untracked);
+		break;
+	}
+}
+
+void TrackAllocation(size_t size)
+{
+	AllocThreadState &state = threadState;
+
+	if (!state.scope || state.inHook ||
+	    state.calls < ALLOC_WARMUP_CALLS)
+		return;
+
+	state.inHook = true;
+
+	InterlockedIncrement64(&steadyAllocations);
+	InterlockedExchangeAdd64(&steadyBytes, (LONGLONG)size);
+
+	/* skip TrackAllocation and the allocator itself */
+	void   *frames[CALL_SITE_FRAMES];
+	ULONG  hash = 0;
+	USHORT depth = CaptureStackBackTrace(2, CALL_SITE_FRAMES, frames,
+			&hash);
+
+	AddCallSite(hash, depth, frames, state.scope, size);
+
+	state.inHook = false;
+}
+
+#endif
+
+bool GetAllocationStats(AllocationStats &stats)
+{
+#ifdef DSHOW_ALLOC_TRACKING
+	if (pendingReports && !threadState.scope)
+		ReportCallSites();
+
+	AcquireSRWLockShared(&siteLock);
+	stats.steadyAllocations = (unsigned long long)steadyAllocations;
+	stats.steadyBytes       = (unsigned long long)steadyBytes;
+	stats.callSites         = siteCount;
+	ReleaseSRWLockShared(&siteLock);
+	return true;
+#else
+	stats = AllocationStats();
+	return false;
+#endif
+}
+
+void ResetAllocationStats()
+{
+#ifdef DSHOW_ALLOC_TRACKING
+	AcquireSRWLockExclusive(&siteLock);
+	steadyAllocations = 0;
+	steadyBytes       = 0;
+	siteCount         = 0;
+	untrackedSites    = 0;
+	pendingReports    = 0;
+	ReleaseSRWLockExclusive(&siteLock);
+#endif
+}
+
+}; /* namespace DShow */
+
+#ifdef DSHOW_ALLOC_TRACKING
+
+/* replaces the allocator of the whole binary the library is linked into
+ * (it is a static library by default), so allocations are only counted on
+ * threads inside an ALLOC_SCOPE, and calls out to the application are made
+ * under ALLOC_PAUSE */
+void *operator new(size_t size)
+{
+	DShow::TrackAllocation(size);
+
+	void *ptr = malloc(size ? size : 1);
+	if (!ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void *operator new[](size_t size)
+{
+	DShow::TrackAllocation(size);
+
+	void *ptr = malloc(size ? size : 1);
+	if (!ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void *operator new(size_t size, const std::nothrow_t &) throw()
+{
+	DShow::TrackAllocation(size);
+	return malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) throw()
+{
+	DShow::TrackAllocation(size);
+	return malloc(size ? size : 1);
+}
+
+void operator delete(void *ptr) throw()
+{
+	free(ptr);
+}
+
+void operator delete[](void *ptr) throw()
+{
+	free(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) throw()
+{
+	free(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) throw()
+{
+	free(ptr);
+}
+
+#endif
@@ -0,0 +1,91 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+#pragma once
+
+/*
+ * Steady-state allocation tracking, built with the DSHOW_ALLOC_TRACKING
+ * CMake option.
+ *
+ * Streaming paths are marked with ALLOC_SCOPE.  Once a thread has entered
+ * its scopes ALLOC_WARMUP_CALLS times it is considered warmed up, and any
+ * heap allocation (operator new) or pool miss it makes inside a scope is
+ * counted.  Each new call site is logged once with the scope name and a
+ * short stack of module+offset addresses, which can be resolved with the
+ * pdb.  ALLOC_SUBSCOPE only relabels an enclosing scope, so shared code
+ * such as logging is attributed without tracking every thread that uses
+ * it.  ALLOC_REWARM restarts the warm-up, for format changes.
+ *
+ * The replacement operator new is linked into whatever binary the library
+ * is linked into, so calls into the application (sample, luma, QC and log
+ * callbacks) are wrapped in ALLOC_PAUSE to keep the application's own
+ * allocations out of the counts.  New call sites are logged when the
+ * outermost scope is left, never from inside operator new.
+ */
+
+#ifdef DSHOW_ALLOC_TRACKING
+
+#include <stddef.h>
+
+namespace DShow {
+
+class AllocScope {
+	const char *prevScope;
+	bool       active;
+
+public:
+	AllocScope(const char *name, bool entry);
+	~AllocScope();
+
+	AllocScope(const AllocScope &) = delete;
+	AllocScope &operator=(const AllocScope &) = delete;
+};
+
+/* suspends tracking on this thread, for calls into the application */
+class AllocPause {
+	const char *prevScope;
+
+public:
+	AllocPause();
+	~AllocPause();
+
+	AllocPause(const AllocPause &) = delete;
+	AllocPause &operator=(const AllocPause &) = delete;
+};
+
+void TrackAllocation(size_t size);
+void RewarmAllocationTracking();
+
+}; /* namespace DShow */
+
+#define ALLOC_SCOPE(name)    DShow::AllocScope allocScope_(name, true)
+#define ALLOC_SUBSCOPE(name) DShow::AllocScope allocScope_(name, false)
+#define ALLOC_PAUSE()        DShow::AllocPause allocPause_
+#define ALLOC_TRACK(size)    DShow::TrackAllocation(size)
+#define ALLOC_REWARM()       DShow::RewarmAllocationTracking()
+
+#else
+
+#define ALLOC_SCOPE(name)
+#define ALLOC_SUBSCOPE(name)
+#define ALLOC_PAUSE()
+#define ALLOC_TRACK(size)
+#define ALLOC_REWARM()
+
+#endif
@@ -0,0 +1,97 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+
+#include "bitrate-control.hpp"
+
+namespace DShow {
+
+static inline double Clamp(double val, double minVal, double maxVal)
+{
+	return val < minVal ? minVal : (val > maxVal ? maxVal : val);
+}
+
+void BitrateController::Reset(const BitrateControlConfig &config_,
+		int bitrate_)
+{
+	config  = config_;
+	bitrate = bitrate_;
+	changed = false;
+
+	if (config.maxBitrate < config.minBitrate)
+		config.maxBitrate = config.minBitrate;
+}
+
+bool BitrateController::Update(int bandwidth, long long queueDuration,
+		long long time, int &newBitrate)
+{
+	if (!config.enabled)
+		return false;
+
+	double current = (double)bitrate;
+	double target = bandwidth > 0 ? bandwidth * config.headroom : current;
+
+	if (queueDuration > config.queueHigh) {
+		/* the link isn't keeping up, whatever the estimate says */
+		double backOff = current * (100 - config.maxDecrease) / 100.0;
+		if (target > backOff)
+			target = backOff;
+
+	} else if (queueDuration > config.queueLow) {
+		if (target > current)
+			target = current;
+	}
+
+	target = Clamp(target, config.minBitrate, config.maxBitrate);
+
+	double diff = target - current;
+	double threshold = current * config.hysteresis / 100.0;
+	bool outOfBounds = current < config.minBitrate ||
+		current > config.maxBitrate;
+
+	if (diff > -threshold && diff < threshold && !outOfBounds)
+		return false;
+
+	if (diff > 0.0) {
+		if (changed && time - lastChange < config.increaseInterval)
+			return false;
+
+		double limit = current * (100 + config.maxIncrease) / 100.0;
+		if (target > limit && !outOfBounds)
+			target = limit;
+	} else {
+		if (changed && time - lastChange < config.decreaseInterval)
+			return false;
+
+		double limit = current * (100 - config.maxDecrease) / 100.0;
+		if (target < limit && !outOfBounds)
+			target = limit;
+	}
+
+	newBitrate = (int)target;
+	if (newBitrate == bitrate)
+		return false;
+
+	bitrate    = newBitrate;
+	lastChange = time;
+	changed    = true;
+	return true;
+}
+
+}; /* namespace DShow */
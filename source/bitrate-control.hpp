@@ -0,0 +1,58 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+
+#pragma once
+
+#include "../dshowcapture.hpp"
+
+namespace DShow {
+
+/**
+ * Decides encoder bitrate changes from bandwidth and send queue reports.
+ * Only does the arithmetic, so it can be driven with simulated input.
+ *
+ * The target is the measured bandwidth less the configured headroom.  A
+ * send queue above queueHigh forces a back-off regardless of the
+ * estimate, and a queue between queueLow and queueHigh holds the bitrate
+ * where it is.  Changes are clamped to the configured bounds, limited in
+ * size and frequency, and ignored when below the hysteresis threshold.
+ */
+class BitrateController {
+	BitrateControlConfig       config;
+	int                        bitrate = 0;
+	long long                  lastChange = 0;
+	bool                       changed = false;
+
+public:
+	void Reset(const BitrateControlConfig &config, int bitrate);
+
+	/** Returns true if the bitrate should be changed to 'newBitrate' */
+	bool Update(int bandwidth, long long queueDuration, long long time,
+			int &newBitrate);
+
+	/** Undoes a change that could not be applied */
+	inline void SetBitrate(int bitrate_) {bitrate = bitrate_;}
+
+	inline bool Enabled() const {return config.enabled;}
+	inline int Bitrate() const {return bitrate;}
+	inline const BitrateControlConfig &Config() const {return config;}
+};
+
+}; /* namespace DShow */
@@ -0,0 +1,477 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+
+#include "buffer-pool.hpp"
+#include "fast-copy.hpp"
+#include "dshow-base.hpp"
+#include "alloc-tracker.hpp"
+#include "log.hpp"
+
+#include <malloc.h>
+#include <mutex>
+#include <map>
+#include <vector>
+
+using namespace std;
+
+namespace DShow {
+
+/* blocks below this size come from the CRT heap, larger ones are mapped
+ * directly so they are page aligned and can be NUMA/large-page backed */
+#define SMALL_BLOCK_SIZE        (64 * 1024)
+#define MIN_BLOCK_SIZE          256
+#define POOL_PAGE_SIZE          4096
+#define TRIM_CHECK_INTERVAL_MS  1000
+
+struct PoolBlock {
+	unsigned char *ptr;
+	int           numaNode;
+	ULONGLONG     lastUsed;
+};
+
+struct BufferPool {
+	mutex                          blockMutex;
+	map<size_t, vector<PoolBlock>> freeBlocks;
+	map<const void*, MemoryUsage>  usage;
+	BufferPoolConfig               config;
+	ULONGLONG                      lastTrim = 0;
+	size_t                         largePageSize = 0;
+	bool                           largePagesChecked = false;
+
+	~BufferPool();
+};
+
+static BufferPool &GetPool()
+{
+	static BufferPool pool;
+	return pool;
+}
+
+/* large frame sizes get four classes per power of two, which keeps the
+ * rounding waste under 25% while still letting devices with similar
+ * resolutions share blocks */
+static size_t GetClassSize(size_t size)
+{
+	if (size <= SMALL_BLOCK_SIZE) {
+		size_t classSize = MIN_BLOCK_SIZE;
+		while (classSize < size)
+			classSize *= 2;
+		return classSize;
+	}
+
+	size_t base = SMALL_BLOCK_SIZE;
+	while (base * 2 < size)
+		base *= 2;
+
+	size_t step = base / 4;
+	return (size + step - 1) / step * step;
+}
+
+static bool EnableLockMemoryPrivilege()
+{
+	TOKEN_PRIVILEGES tp = {};
+	HANDLE           token;
+	bool             success;
+
+	if (!OpenProcessToken(GetCurrentProcess(),
+				TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+		return false;
+
+	tp.PrivilegeCount           = 1;
+	tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+
+	success = LookupPrivilegeValueW(nullptr, SE_LOCK_MEMORY_NAME,
+			&tp.Privileges[0].Luid) &&
+		AdjustTokenPrivileges(token, false, &tp, 0, nullptr,
+				nullptr) &&
+		GetLastError() == ERROR_SUCCESS;
+
+	CloseHandle(token);
+	return success;
+}
+
+static size_t GetLargePageSize(BufferPool &pool)
+{
+	if (!pool.largePagesChecked) {
+		pool.largePagesChecked = true;
+
+		if (EnableLockMemoryPrivilege())
+			pool.largePageSize = GetLargePageMinimum();
+		else
+			Warning(L"Buffer pool: large pages unavailable, "
+			        L"SeLockMemoryPrivilege not held");
+	}
+
+	return pool.largePageSize;
+}
+
+static unsigned char *VirtualAllocBlock(size_t size, DWORD type, int numaNode)
+{
+	void *ptr;
+
+	if (numaNode >= 0)
+		ptr = VirtualAllocExNuma(GetCurrentProcess(), nullptr, size,
+				type, PAGE_READWRITE, (DWORD)numaNode);
+	else
+		ptr = VirtualAlloc(nullptr, size, type, PAGE_READWRITE);
+
+	return (unsigned char*)ptr;
+}
+
+static unsigned char *AllocBlock(BufferPool &pool, size_t size, int numaNode)
+{
+	if (size < SMALL_BLOCK_SIZE)
+		return (unsigned char*)_aligned_malloc(size, POOL_ALIGNMENT);
+
+	if (pool.config.largePages) {
+		size_t largePageSize = GetLargePageSize(pool);
+
+		if (largePageSize && size >= largePageSize) {
+			size_t largeSize = (size + largePageSize - 1) /
+				largePageSize * largePageSize;
+			unsigned char *ptr = VirtualAllocBlock(largeSize,
+					MEM_RESERVE | MEM_COMMIT |
+					MEM_LARGE_PAGES, numaNode);
+			if (ptr)
+				return ptr;
+		}
+	}
+
+	return VirtualAllocBlock(size, MEM_RESERVE | MEM_COMMIT, numaNode);
+}
+
+static void FreeBlock(unsigned char *ptr, size_t size)
+{
+	if (size < SMALL_BLOCK_SIZE)
+		_aligned_free(ptr);
+	else
+		VirtualFree(ptr, 0, MEM_RELEASE);
+}
+
+static void Prefault(unsigned char *ptr, size_t size)
+{
+	volatile unsigned char *pages = ptr;
+
+	for (size_t i = 0; i < size; i += POOL_PAGE_SIZE)
+		pages[i] = 0;
+}
+
+static void TrimIdle(BufferPool &pool, ULONGLONG now, ULONGLONG maxIdle)
+{
+	for (auto &freeList : pool.freeBlocks) {
+		vector<PoolBlock> &blocks = freeList.second;
+		size_t            kept    = 0;
+
+		for (size_t i = 0; i < blocks.size(); i++) {
+			if (now - blocks[i].lastUsed >= maxIdle)
+				FreeBlock(blocks[i].ptr, freeList.first);
+			else
+				blocks[kept++] = blocks[i];
+		}
+
+		blocks.resize(kept);
+	}
+
+	pool.lastTrim = now;
+}
+
+BufferPool::~BufferPool()
+{
+	TrimIdle(*this, GetTickCount64(), 0);
+}
+
+static void AddUsage(BufferUsage &usage, size_t bytes)
+{
+	usage.buffers++;
+	usage.bytes += bytes;
+	if (usage.bytes > usage.peakBytes)
+		usage.peakBytes = usage.bytes;
+}
+
+static void SubtractUsage(BufferUsage &usage, size_t bytes)
+{
+	usage.buffers--;
+	usage.bytes -= bytes;
+}
+
+static unsigned char *AcquireBlock(const void *owner,
+		MemorySubsystem subsystem, size_t size, int numaNode,
+		bool prefault, size_t &capacity)
+{
+	BufferPool    &pool     = GetPool();
+	size_t        classSize = GetClassSize(size);
+	unsigned char *ptr      = nullptr;
+
+	lock_guard<mutex> lock(pool.blockMutex);
+
+	vector<PoolBlock> &blocks = pool.freeBlocks[classSize];
+	for (size_t i = blocks.size(); i > 0; i--) {
+		if (blocks[i - 1].numaNode == numaNode) {
+			ptr = blocks[i - 1].ptr;
+			blocks.erase(blocks.begin() + (i - 1));
+			break;
+		}
+	}
+
+	if (!ptr) {
+		ALLOC_TRACK(classSize);
+
+		ptr = AllocBlock(pool, classSize, numaNode);
+		if (!ptr) {
+			Error(L"Buffer pool: failed to allocate %llu bytes",
+					(unsigned long long)classSize);
+			return nullptr;
+		}
+
+		if (prefault)
+			Prefault(ptr, classSize);
+	}
+
+	/* owners that are gone (or were never added) are not accounted */
+	auto usage = pool.usage.find(owner);
+	if (usage != pool.usage.end()) {
+		AddUsage(usage->second.total, classSize);
+		AddUsage(usage->second.subsystems[(int)subsystem], classSize);
+	}
+
+	capacity = classSize;
+	return ptr;
+}
+
+static void ReleaseBlock(const void *owner, MemorySubsystem subsystem,
+		unsigned char *ptr, size_t capacity, int numaNode)
+{
+	BufferPool &pool = GetPool();
+	ULONGLONG  now   = GetTickCount64();
+
+	lock_guard<mutex> lock(pool.blockMutex);
+
+	auto usage = pool.usage.find(owner);
+	if (usage != pool.usage.end()) {
+		SubtractUsage(usage->second.total, capacity);
+		SubtractUsage(usage->second.subsystems[(int)subsystem],
+				capacity);
+	}
+
+	PoolBlock block = {ptr, numaNode, now};
+	pool.freeBlocks[capacity].push_back(block);
+
+	if (pool.config.idleTrimMs &&
+	    now - pool.lastTrim >= TRIM_CHECK_INTERVAL_MS)
+		TrimIdle(pool, now, pool.config.idleTrimMs);
+}
+
+/* ========================================================================= */
+
+PoolBuffer::PoolBuffer(PoolBuffer &&other)
+	: data     (other.data),
+	  size     (other.size),
+	  capacity (other.capacity),
+	  owner     (other.owner),
+	  subsystem (other.subsystem),
+	  numaNode  (other.numaNode)
+{
+	other.data     = nullptr;
+	other.size     = 0;
+	other.capacity = 0;
+}
+
+PoolBuffer &PoolBuffer::operator=(PoolBuffer &&other)
+{
+	if (this != &other) {
+		Free();
+
+		data     = other.data;
+		size     = other.size;
+		capacity = other.capacity;
+		owner     = other.owner;
+		subsystem = other.subsystem;
+		numaNode  = other.numaNode;
+
+		other.data     = nullptr;
+		other.size     = 0;
+		other.capacity = 0;
+	}
+
+	return *this;
+}
+
+void PoolBuffer::SetOwner(const void *owner_, MemorySubsystem subsystem_,
+		int numaNode_)
+{
+	Free();
+	owner     = owner_;
+	subsystem = subsystem_;
+	numaNode  = numaNode_;
+}
+
+bool PoolBuffer::Grow(size_t minCapacity, bool prefault)
+{
+	size_t        newCapacity;
+	unsigned char *newData;
+
+	/* grow geometrically so repeated appends stay amortized */
+	newCapacity = capacity + capacity / 2;
+	if (newCapacity < minCapacity)
+		newCapacity = minCapacity;
+
+	newData = AcquireBlock(owner, subsystem, newCapacity, numaNode,
+			prefault, newCapacity);
+	if (!newData)
+		return false;
+
+	if (size)
+		FastCopy(newData, data, size);
+	if (data)
+		ReleaseBlock(owner, subsystem, data, capacity, numaNode);
+
+	data     = newData;
+	capacity = newCapacity;
+	return true;
+}
+
+bool PoolBuffer::Reserve(size_t newCapacity, bool prefault)
+{
+	if (newCapacity <= capacity)
+		return true;
+
+	return Grow(newCapacity, prefault);
+}
+
+bool PoolBuffer::Resize(size_t newSize)
+{
+	if (!Reserve(newSize))
+		return false;
+
+	size = newSize;
+	return true;
+}
+
+bool PoolBuffer::Append(const void *src, size_t srcSize)
+{
+	if (!Reserve(size + srcSize))
+		return false;
+
+	FastCopy(data + size, src, srcSize);
+	size += srcSize;
+	return true;
+}
+
+void PoolBuffer::Free()
+{
+	if (data)
+		ReleaseBlock(owner, subsystem, data, capacity, numaNode);
+
+	data     = nullptr;
+	size     = 0;
+	capacity = 0;
+}
+
+/* ========================================================================= */
+
+void GetPoolUsage(const void *owner, BufferUsage &usage)
+{
+	BufferPool &pool = GetPool();
+	lock_guard<mutex> lock(pool.blockMutex);
+
+	auto it = pool.usage.find(owner);
+	if (it != pool.usage.end())
+		usage = it->second.total;
+	else
+		usage = BufferUsage();
+}
+
+void GetPoolUsage(const void *owner, MemoryUsage &usage)
+{
+	BufferPool &pool = GetPool();
+	lock_guard<mutex> lock(pool.blockMutex);
+
+	auto it = pool.usage.find(owner);
+	if (it != pool.usage.end())
+		usage = it->second;
+	else
+		usage = MemoryUsage();
+}
+
+void SetPoolBudget(const void *owner, size_t budget)
+{
+	BufferPool &pool = GetPool();
+	lock_guard<mutex> lock(pool.blockMutex);
+
+	auto it = pool.usage.find(owner);
+	if (it != pool.usage.end())
+		it->second.budget = budget;
+}
+
+bool PoolOverBudget(const void *owner, size_t extra)
+{
+	BufferPool &pool = GetPool();
+	lock_guard<mutex> lock(pool.blockMutex);
+
+	auto it = pool.usage.find(owner);
+	if (it == pool.usage.end() || !it->second.budget)
+		return false;
+
+	return it->second.total.bytes + extra > it->second.budget;
+}
+
+void AddPoolDegradation(const void *owner)
+{
+	BufferPool &pool = GetPool();
+	lock_guard<mutex> lock(pool.blockMutex);
+
+	auto it = pool.usage.find(owner);
+	if (it != pool.usage.end())
+		it->second.degradations++;
+}
+
+void AddPoolOwner(const void *owner)
+{
+	BufferPool &pool = GetPool();
+	lock_guard<mutex> lock(pool.blockMutex);
+
+	pool.usage[owner] = MemoryUsage();
+}
+
+void RemovePoolOwner(const void *owner)
+{
+	BufferPool &pool = GetPool();
+	lock_guard<mutex> lock(pool.blockMutex);
+
+	pool.usage.erase(owner);
+}
+
+void SetBufferPoolConfig(const BufferPoolConfig &config)
+{
+	BufferPool &pool = GetPool();
+	lock_guard<mutex> lock(pool.blockMutex);
+
+	pool.config = config;
+}
+
+void TrimBufferPool()
+{
+	BufferPool &pool = GetPool();
+	lock_guard<mutex> lock(pool.blockMutex);
+
+	TrimIdle(pool, GetTickCount64(), 0);
+}
+
+}; /* namespace DShow */
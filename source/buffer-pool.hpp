@@ -0,0 +1,107 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+
+#pragma once
+
+#include "../dshowcapture.hpp"
+
+namespace DShow {
+
+#define POOL_ALIGNMENT 64
+
+/**
+ * Growable byte buffer whose storage comes from the process-wide buffer
+ * pool.  Storage is always POOL_ALIGNMENT-aligned and returns to the pool
+ * when the buffer is freed or destroyed.  Usage is accounted to the owner
+ * (typically an HDevice) so it can be reported per device.
+ */
+class PoolBuffer {
+	unsigned char *data     = nullptr;
+	size_t        size      = 0;
+	size_t        capacity  = 0;
+	const void    *owner    = nullptr;
+	MemorySubsystem subsystem = MemorySubsystem::Capture;
+	int           numaNode  = -1;
+
+	bool Grow(size_t minCapacity, bool prefault);
+
+public:
+	inline PoolBuffer() {}
+	inline PoolBuffer(const void *owner_, MemorySubsystem subsystem_,
+			int numaNode_ = -1)
+		: owner     (owner_),
+		  subsystem (subsystem_),
+		  numaNode  (numaNode_)
+	{}
+
+	PoolBuffer(PoolBuffer &&other);
+	PoolBuffer &operator=(PoolBuffer &&other);
+	inline ~PoolBuffer() {Free();}
+
+	PoolBuffer(const PoolBuffer &) = delete;
+	PoolBuffer &operator=(const PoolBuffer &) = delete;
+
+	/** Sets the owner/NUMA node used for subsequent allocations */
+	void SetOwner(const void *owner, MemorySubsystem subsystem,
+			int numaNode = -1);
+
+	/**
+	 * Ensures room for at least newCapacity bytes, keeping the current
+	 * contents.  If prefault is set, newly allocated pages are touched
+	 * so the first real write does not take page faults.
+	 */
+	bool Reserve(size_t newCapacity, bool prefault = false);
+	bool Resize(size_t newSize);
+	bool Append(const void *src, size_t srcSize);
+	void Free();
+
+	inline void Clear() {size = 0;}
+
+	inline unsigned char *Data() const {return data;}
+	inline size_t Size() const         {return size;}
+	inline size_t Capacity() const     {return capacity;}
+};
+
+/** Gets the usage accounted to an owner */
+void GetPoolUsage(const void *owner, BufferUsage &usage);
+void GetPoolUsage(const void *owner, MemoryUsage &usage);
+
+/** Sets the memory budget of an owner (0 = no limit) */
+void SetPoolBudget(const void *owner, size_t budget);
+
+/**
+ * Whether the owner would be over its budget after allocating 'extra'
+ * more bytes.  Subsystems check this before growing and shed data instead.
+ */
+bool PoolOverBudget(const void *owner, size_t extra = 0);
+
+/** Counts data dropped by an owner to stay within its budget */
+void AddPoolDegradation(const void *owner);
+
+/**
+ * Starts the usage accounting of an owner.  Buffers of owners that were
+ * never added, or have been removed, are not accounted.
+ */
+void AddPoolOwner(const void *owner);
+
+/** Drops the usage accounting of an owner that is going away */
+void RemovePoolOwner(const void *owner);
+
+}; /* namespace DShow */
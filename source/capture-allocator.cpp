@@ -0,0 +1,469 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+
+#include "capture-allocator.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace DShow {
+
+#if 0
+#define PrintFunc(x) Debug(x)
+#else
+#define PrintFunc(x)
+#endif
+
+static inline long AlignUp(long size, long align)
+{
+	return (size + align - 1) & ~(align - 1);
+}
+
+CaptureSample::CaptureSample(CaptureAllocator *allocator_,
+		const void *owner, int numaNode)
+	: allocator (allocator_),
+	  buffer    (owner, MemorySubsystem::Capture, numaNode)
+{
+}
+
+CaptureSample::~CaptureSample()
+{
+}
+
+void CaptureSample::Reset()
+{
+	if (hasMediaType) {
+		mediaType = MediaType();
+		hasMediaType = false;
+	}
+
+	actualSize    = 0;
+	hasTime       = false;
+	hasStopTime   = false;
+	hasMediaTime  = false;
+	syncPoint     = false;
+	preroll       = false;
+	discontinuity = false;
+}
+
+STDMETHODIMP CaptureSample::QueryInterface(REFIID riid, void **ppv)
+{
+	if (riid == IID_IUnknown || riid == IID_IMediaSample) {
+		AddRef();
+		*ppv = (IMediaSample*)this;
+	} else {
+		*ppv = nullptr;
+		return E_NOINTERFACE;
+	}
+
+	return NOERROR;
+}
+
+STDMETHODIMP_(ULONG) CaptureSample::AddRef()
+{
+	return (ULONG)InterlockedIncrement(&refCount);
+}
+
+STDMETHODIMP_(ULONG) CaptureSample::Release()
+{
+	long count = InterlockedDecrement(&refCount);
+
+	/* samples are owned by the allocator, so rather than being deleted
+	 * they are handed back to it once the last reference goes away */
+	if (count == 0)
+		allocator->ReleaseBuffer(this);
+
+	return (ULONG)count;
+}
+
+STDMETHODIMP CaptureSample::GetPointer(BYTE **ppBuffer)
+{
+	if (!ppBuffer)
+		return E_POINTER;
+
+	*ppBuffer = ptr;
+	return S_OK;
+}
+
+STDMETHODIMP_(long) CaptureSample::GetSize()
+{
+	return size;
+}
+
+STDMETHODIMP CaptureSample::GetTime(REFERENCE_TIME *pTimeStart,
+		REFERENCE_TIME *pTimeEnd)
+{
+	if (!pTimeStart || !pTimeEnd)
+		return E_POINTER;
+	if (!hasTime)
+		return VFW_E_SAMPLE_TIME_NOT_SET;
+
+	*pTimeStart = startTime;
+
+	if (!hasStopTime) {
+		*pTimeEnd = startTime + 1;
+		return VFW_S_NO_STOP_TIME;
+	}
+
+	*pTimeEnd = stopTime;
+	return S_OK;
+}
+
+STDMETHODIMP CaptureSample::SetTime(REFERENCE_TIME *pTimeStart,
+		REFERENCE_TIME *pTimeEnd)
+{
+	if (!pTimeStart) {
+		if (pTimeEnd)
+			return E_POINTER;
+
+		hasTime     = false;
+		hasStopTime = false;
+		return S_OK;
+	}
+
+	startTime   = *pTimeStart;
+	hasTime     = true;
+	hasStopTime = !!pTimeEnd;
+
+	if (pTimeEnd)
+		stopTime = *pTimeEnd;
+
+	return S_OK;
+}
+
+STDMETHODIMP CaptureSample::IsSyncPoint()
+{
+	return syncPoint ? S_OK : S_FALSE;
+}
+
+STDMETHODIMP CaptureSample::SetSyncPoint(BOOL bIsSyncPoint)
+{
+	syncPoint = !!bIsSyncPoint;
+	return S_OK;
+}
+
+STDMETHODIMP CaptureSample::IsPreroll()
+{
+	return preroll ? S_OK : S_FALSE;
+}
+
+STDMETHODIMP CaptureSample::SetPreroll(BOOL bIsPreroll)
+{
+	preroll = !!bIsPreroll;
+	return S_OK;
+}
+
+STDMETHODIMP_(long) CaptureSample::GetActualDataLength()
+{
+	return actualSize;
+}
+
+STDMETHODIMP CaptureSample::SetActualDataLength(long length)
+{
+	if (length < 0 || length > size)
+		return VFW_E_BUFFER_OVERFLOW;
+
+	actualSize = length;
+	return S_OK;
+}
+
+STDMETHODIMP CaptureSample::GetMediaType(AM_MEDIA_TYPE **ppMediaType)
+{
+	if (!ppMediaType)
+		return E_POINTER;
+
+	if (!hasMediaType) {
+		*ppMediaType = nullptr;
+		return S_FALSE;
+	}
+
+	*ppMediaType = mediaType.Duplicate();
+	return S_OK;
+}
+
+STDMETHODIMP CaptureSample::SetMediaType(AM_MEDIA_TYPE *pMediaType)
+{
+	if (!pMediaType) {
+		mediaType = MediaType();
+		hasMediaType = false;
+		return S_OK;
+	}
+
+	mediaType = pMediaType;
+	hasMediaType = true;
+	return S_OK;
+}
+
+STDMETHODIMP CaptureSample::IsDiscontinuity()
+{
+	return discontinuity ? S_OK : S_FALSE;
+}
+
+STDMETHODIMP CaptureSample::SetDiscontinuity(BOOL bDiscontinuity)
+{
+	discontinuity = !!bDiscontinuity;
+	return S_OK;
+}
+
+STDMETHODIMP CaptureSample::GetMediaTime(LONGLONG *pTimeStart,
+		LONGLONG *pTimeEnd)
+{
+	if (!pTimeStart || !pTimeEnd)
+		return E_POINTER;
+	if (!hasMediaTime)
+		return VFW_E_MEDIA_TIME_NOT_SET;
+
+	*pTimeStart = mediaStart;
+	*pTimeEnd   = mediaStop;
+	return S_OK;
+}
+
+STDMETHODIMP CaptureSample::SetMediaTime(LONGLONG *pTimeStart,
+		LONGLONG *pTimeEnd)
+{
+	if (!pTimeStart || !pTimeEnd) {
+		hasMediaTime = false;
+		return S_OK;
+	}
+
+	mediaStart   = *pTimeStart;
+	mediaStop    = *pTimeEnd;
+	hasMediaTime = true;
+	return S_OK;
+}
+
+/* ========================================================================= */
+
+CaptureAllocator::CaptureAllocator(const void *owner_, int numaNode_,
+		long minBuffers_)
+	: owner      (owner_),
+	  numaNode   (numaNode_),
+	  minBuffers (minBuffers_)
+{
+}
+
+CaptureAllocator::~CaptureAllocator()
+{
+	FreeSamples();
+}
+
+void CaptureAllocator::FreeSamples()
+{
+	for (CaptureSample *sample : freeSamples)
+		delete sample;
+	freeSamples.clear();
+}
+
+STDMETHODIMP CaptureAllocator::QueryInterface(REFIID riid, void **ppv)
+{
+	if (riid == IID_IUnknown || riid == IID_IMemAllocator) {
+		AddRef();
+		*ppv = (IMemAllocator*)this;
+	} else {
+		*ppv = nullptr;
+		return E_NOINTERFACE;
+	}
+
+	return NOERROR;
+}
+
+STDMETHODIMP_(ULONG) CaptureAllocator::AddRef()
+{
+	return (ULONG)InterlockedIncrement(&refCount);
+}
+
+STDMETHODIMP_(ULONG) CaptureAllocator::Release()
+{
+	long count = InterlockedDecrement(&refCount);
+	if (!count)
+		delete this;
+
+	return (ULONG)count;
+}
+
+STDMETHODIMP CaptureAllocator::SetProperties(ALLOCATOR_PROPERTIES *pRequest,
+		ALLOCATOR_PROPERTIES *pActual)
+{
+	PrintFunc(L"CaptureAllocator::SetProperties");
+
+	if (!pRequest || !pActual)
+		return E_POINTER;
+
+	lock_guard<mutex> lock(sampleMutex);
+
+	if (committed)
+		return VFW_E_ALREADY_COMMITTED;
+	if (outstanding)
+		return VFW_E_BUFFERS_OUTSTANDING;
+
+	long align = pRequest->cbAlign ? pRequest->cbAlign : 1;
+	if ((align & (align - 1)) != 0 || align > POOL_ALIGNMENT)
+		return VFW_E_BADALIGN;
+	if (pRequest->cBuffers < 0 || pRequest->cbBuffer < 0 ||
+	    pRequest->cbPrefix < 0)
+		return E_INVALIDARG;
+
+	/* never go below the configured pipeline depth, even if upstream
+	 * ignored our allocator requirements */
+	props.cBuffers = max(pRequest->cBuffers, max(minBuffers, 1L));
+	props.cbBuffer = AlignUp(pRequest->cbBuffer, align);
+	props.cbAlign  = align;
+	props.cbPrefix = pRequest->cbPrefix;
+	propsSet       = true;
+
+	/* samples sized for the old properties are useless now */
+	FreeSamples();
+
+	*pActual = props;
+	return S_OK;
+}
+
+STDMETHODIMP CaptureAllocator::GetProperties(ALLOCATOR_PROPERTIES *pProps)
+{
+	if (!pProps)
+		return E_POINTER;
+
+	lock_guard<mutex> lock(sampleMutex);
+	*pProps = props;
+	return S_OK;
+}
+
+STDMETHODIMP CaptureAllocator::Commit()
+{
+	PrintFunc(L"CaptureAllocator::Commit");
+
+	lock_guard<mutex> lock(sampleMutex);
+
+	if (committed)
+		return S_OK;
+	if (!propsSet)
+		return VFW_E_SIZENOTSET;
+
+	/* the prefix sits in front of the data pointer, so it is padded to
+	 * keep the data itself on a pool-aligned boundary */
+	long prefix = AlignUp(props.cbPrefix, POOL_ALIGNMENT);
+	size_t total = size_t(prefix) + size_t(props.cbBuffer);
+	long count = props.cBuffers - outstanding - (long)freeSamples.size();
+
+	for (long i = 0; i < count; i++) {
+		CaptureSample *sample = new CaptureSample(this, owner,
+				numaNode);
+
+		if (!sample->buffer.Reserve(total, true) ||
+		    !sample->buffer.Resize(total)) {
+			delete sample;
+			FreeSamples();
+			return E_OUTOFMEMORY;
+		}
+
+		sample->ptr  = sample->buffer.Data() + prefix;
+		sample->size = props.cbBuffer;
+		freeSamples.push_back(sample);
+	}
+
+	committed = true;
+	return S_OK;
+}
+
+STDMETHODIMP CaptureAllocator::Decommit()
+{
+	PrintFunc(L"CaptureAllocator::Decommit");
+
+	{
+		lock_guard<mutex> lock(sampleMutex);
+
+		if (!committed)
+			return S_OK;
+
+		/* outstanding samples are freed as they come back */
+		committed = false;
+		FreeSamples();
+	}
+
+	sampleCond.notify_all();
+	return S_OK;
+}
+
+STDMETHODIMP CaptureAllocator::GetBuffer(IMediaSample **ppBuffer,
+		REFERENCE_TIME *pStartTime, REFERENCE_TIME *pEndTime,
+		DWORD dwFlags)
+{
+	if (!ppBuffer)
+		return E_POINTER;
+
+	*ppBuffer = nullptr;
+
+	unique_lock<mutex> lock(sampleMutex);
+
+	for (;;) {
+		if (!committed)
+			return VFW_E_NOT_COMMITTED;
+		if (!freeSamples.empty())
+			break;
+		if ((dwFlags & AM_GBF_NOWAIT) != 0)
+			return VFW_E_TIMEOUT;
+
+		sampleCond.wait(lock);
+	}
+
+	CaptureSample *sample = freeSamples.back();
+	freeSamples.pop_back();
+	outstanding++;
+	lock.unlock();
+
+	sample->Reset();
+	sample->refCount = 1;
+	AddRef();
+
+	DSHOW_UNUSED(pStartTime);
+	DSHOW_UNUSED(pEndTime);
+
+	*ppBuffer = sample;
+	return S_OK;
+}
+
+/* only ever called by CaptureSample::Release, same as the base classes */
+STDMETHODIMP CaptureAllocator::ReleaseBuffer(IMediaSample *pBuffer)
+{
+	if (!pBuffer)
+		return E_POINTER;
+
+	CaptureSample *sample = static_cast<CaptureSample*>(pBuffer);
+
+	{
+		lock_guard<mutex> lock(sampleMutex);
+
+		outstanding--;
+		if (committed)
+			freeSamples.push_back(sample);
+		else
+			delete sample;
+	}
+
+	sampleCond.notify_one();
+
+	/* drops the reference taken in GetBuffer, may delete the allocator */
+	Release();
+	return S_OK;
+}
+
+}; /* namespace DShow */
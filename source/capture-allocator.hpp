@@ -0,0 +1,137 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+
+#pragma once
+
+#include "dshow-base.hpp"
+#include "dshow-media-type.hpp"
+#include "buffer-pool.hpp"
+
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+namespace DShow {
+
+class CaptureAllocator;
+
+class CaptureSample : public IMediaSample {
+	friend class CaptureAllocator;
+
+	volatile long                  refCount = 0;
+	CaptureAllocator               *allocator;
+	PoolBuffer                     buffer;
+	BYTE                           *ptr = nullptr;
+	long                           size = 0;
+	long                           actualSize = 0;
+
+	REFERENCE_TIME                 startTime = 0;
+	REFERENCE_TIME                 stopTime = 0;
+	LONGLONG                       mediaStart = 0;
+	LONGLONG                       mediaStop = 0;
+	MediaType                      mediaType;
+
+	bool                           hasTime = false;
+	bool                           hasStopTime = false;
+	bool                           hasMediaTime = false;
+	bool                           hasMediaType = false;
+	bool                           syncPoint = false;
+	bool                           preroll = false;
+	bool                           discontinuity = false;
+
+	void Reset();
+
+public:
+	CaptureSample(CaptureAllocator *allocator, const void *owner,
+			int numaNode);
+	virtual ~CaptureSample();
+
+	// IUnknown methods
+	STDMETHODIMP QueryInterface(REFIID riid, void **ppv);
+	STDMETHODIMP_(ULONG) AddRef();
+	STDMETHODIMP_(ULONG) Release();
+
+	// IMediaSample methods
+	STDMETHODIMP GetPointer(BYTE **ppBuffer);
+	STDMETHODIMP_(long) GetSize();
+	STDMETHODIMP GetTime(REFERENCE_TIME *pTimeStart,
+			REFERENCE_TIME *pTimeEnd);
+	STDMETHODIMP SetTime(REFERENCE_TIME *pTimeStart,
+			REFERENCE_TIME *pTimeEnd);
+	STDMETHODIMP IsSyncPoint();
+	STDMETHODIMP SetSyncPoint(BOOL bIsSyncPoint);
+	STDMETHODIMP IsPreroll();
+	STDMETHODIMP SetPreroll(BOOL bIsPreroll);
+	STDMETHODIMP_(long) GetActualDataLength();
+	STDMETHODIMP SetActualDataLength(long length);
+	STDMETHODIMP GetMediaType(AM_MEDIA_TYPE **ppMediaType);
+	STDMETHODIMP SetMediaType(AM_MEDIA_TYPE *pMediaType);
+	STDMETHODIMP IsDiscontinuity();
+	STDMETHODIMP SetDiscontinuity(BOOL bDiscontinuity);
+	STDMETHODIMP GetMediaTime(LONGLONG *pTimeStart, LONGLONG *pTimeEnd);
+	STDMETHODIMP SetMediaTime(LONGLONG *pTimeStart, LONGLONG *pTimeEnd);
+};
+
+/**
+ * Allocator offered to upstream filters by the capture pin.  Sample memory
+ * comes from the buffer pool, so it is POOL_ALIGNMENT-aligned, accounted to
+ * the device and pre-faulted when the allocator is committed.
+ */
+class CaptureAllocator : public IMemAllocator {
+	friend class CaptureSample;
+
+	volatile long                  refCount = 0;
+	const void                     *owner;
+	int                            numaNode;
+	long                           minBuffers;
+
+	std::mutex                     sampleMutex;
+	std::condition_variable        sampleCond;
+	std::vector<CaptureSample*>    freeSamples;
+	ALLOCATOR_PROPERTIES           props = {};
+	long                           outstanding = 0;
+	bool                           propsSet = false;
+	bool                           committed = false;
+
+	void FreeSamples();
+
+public:
+	CaptureAllocator(const void *owner, int numaNode,
+			long minBuffers = 0);
+	virtual ~CaptureAllocator();
+
+	// IUnknown methods
+	STDMETHODIMP QueryInterface(REFIID riid, void **ppv);
+	STDMETHODIMP_(ULONG) AddRef();
+	STDMETHODIMP_(ULONG) Release();
+
+	// IMemAllocator methods
+	STDMETHODIMP SetProperties(ALLOCATOR_PROPERTIES *pRequest,
+			ALLOCATOR_PROPERTIES *pActual);
+	STDMETHODIMP GetProperties(ALLOCATOR_PROPERTIES *pProps);
+	STDMETHODIMP Commit();
+	STDMETHODIMP Decommit();
+	STDMETHODIMP GetBuffer(IMediaSample **ppBuffer,
+			REFERENCE_TIME *pStartTime, REFERENCE_TIME *pEndTime,
+			DWORD dwFlags);
+	STDMETHODIMP ReleaseBuffer(IMediaSample *pBuffer);
+};
+
+}; /* namespace DShow */
@@ -132,7 +132,9 @@ STDMETHODIMP CapturePin::Disconnect()
 	if (!connectedPin)
 		return S_FALSE;
 
-	connectedPin = nullptr;
+	connectedPin      = nullptr;
+	upstreamAllocator = nullptr;
+	memset(&allocatorProps, 0, sizeof(allocatorProps));
 	return S_OK;
 }
 
@@ -270,8 +272,16 @@ STDMETHODIMP CapturePin::GetAllocator(IMemAllocator **ppAllocator)
 {
 	PrintFunc(L"CapturePin::GetAllocator");
 
-	DSHOW_UNUSED(ppAllocator);
-	return VFW_E_NO_ALLOCATOR;
+	if (!ppAllocator)
+		return E_POINTER;
+
+	if (!allocator)
+		allocator = new CaptureAllocator(captureInfo.bufferOwner,
+				captureInfo.numaNode, captureInfo.bufferCount);
+
+	allocator->AddRef();
+	*ppAllocator = allocator;
+	return S_OK;
 }
 
 STDMETHODIMP CapturePin::NotifyAllocator(IMemAllocator *pAllocator,
@@ -279,8 +289,28 @@ STDMETHODIMP CapturePin::NotifyAllocator(IMemAllocator *pAllocator,
 {
 	PrintFunc(L"CapturePin::NotifyAllocator");
 
-	DSHOW_UNUSED(pAllocator);
-	DSHOW_UNUSED(bReadOnly);
+	if (!pAllocator)
+		return E_POINTER;
+
+	bool ours = !!allocator && pAllocator == (IMemAllocator*)allocator;
+
+	memset(&allocatorProps, 0, sizeof(allocatorProps));
+	pAllocator->GetProperties(&allocatorProps);
+
+	Info(L"Capture pin: upstream is using %s allocator%s, "
+			L"%ld buffers of %ld bytes (align %ld, prefix %ld)",
+			ours ? L"the pooled" : L"its own",
+			bReadOnly ? L" (read-only samples)" : L"",
+			allocatorProps.cBuffers, allocatorProps.cbBuffer,
+			allocatorProps.cbAlign, allocatorProps.cbPrefix);
+
+	if (captureInfo.bufferCount &&
+	    allocatorProps.cBuffers < captureInfo.bufferCount)
+		Warning(L"Capture pin: requested %ld buffers, device "
+				L"only allocated %ld", captureInfo.bufferCount,
+				allocatorProps.cBuffers);
+
+	upstreamAllocator = pAllocator;
 	return S_OK;
 }
 
@@ -288,8 +318,13 @@ STDMETHODIMP CapturePin::GetAllocatorRequirements(ALLOCATOR_PROPERTIES *pProps)
 {
 	PrintFunc(L"CapturePin::GetAllocatorRequirements");
 
-	DSHOW_UNUSED(pProps);
-	return E_NOTIMPL;
+	if (!pProps)
+		return E_POINTER;
+
+	memset(pProps, 0, sizeof(*pProps));
+	pProps->cBuffers = captureInfo.bufferCount;
+	pProps->cbAlign  = POOL_ALIGNMENT;
+	return S_OK;
 }
 
 STDMETHODIMP CapturePin::Receive(IMediaSample *pSample)
@@ -300,7 +335,7 @@ STDMETHODIMP CapturePin::Receive(IMediaSample *pSample)
 		return S_FALSE;
 
 	if (pSample)
-		captureInfo.callback(pSample);
+		captureInfo.callback(captureInfo.param, pSample);
 
 	return S_OK;
 }
@@ -315,7 +350,8 @@ STDMETHODIMP CapturePin::ReceiveMultiple(IMediaSample **pSamples,
 
 	for (long i = 0; i < nSamples; i++)
 		if (pSamples[i])
-			captureInfo.callback(pSamples[i]);
+			captureInfo.callback(captureInfo.param,
+					pSamples[i]);
 
 	*nSamplesProcessed = nSamples;
 
@@ -324,6 +360,20 @@ STDMETHODIMP CapturePin::ReceiveMultiple(IMediaSample **pSamples,
 
 STDMETHODIMP CapturePin::ReceiveCanBlock() {return S_FALSE;}
 
+bool CapturePin::GetAllocatorInfo(AllocatorInfo &info) const
+{
+	if (!upstreamAllocator)
+		return false;
+
+	info.buffers    = allocatorProps.cBuffers;
+	info.bufferSize = allocatorProps.cbBuffer;
+	info.alignment  = allocatorProps.cbAlign;
+	info.prefix     = allocatorProps.cbPrefix;
+	info.pooled     = !!allocator && upstreamAllocator ==
+		(IMemAllocator*)allocator;
+	return true;
+}
+
 bool CapturePin::IsValidMediaType(const AM_MEDIA_TYPE *pmt) const
 {
 	if (pmt->pbFormat) {
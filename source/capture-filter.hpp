@@ -21,6 +21,7 @@
 
 #include "dshow-base.hpp"
 #include "dshow-media-type.hpp"
+#include "capture-allocator.hpp"
 #include "../dshowcapture.hpp"
 
 namespace DShow {
@@ -31,9 +32,13 @@ class CaptureSource;
 typedef void (*CaptureCallback)(void *param, IMediaSample *sample);
 
 struct PinCaptureInfo {
-	std::function<void (IMediaSample *sample)> callback;
-	GUID                                       expectedMajorType;
-	GUID                                       expectedSubType;
+	CaptureCallback callback = nullptr;
+	void            *param = nullptr;
+	GUID            expectedMajorType;
+	GUID            expectedSubType;
+	const void      *bufferOwner = nullptr;
+	int             numaNode = -1;
+	long            bufferCount = 0;
 };
 
 class CapturePin : public IPin, public IMemInputPin {
@@ -45,6 +50,9 @@ class CapturePin : public IPin, public IMemInputPin {
 	ComPtr<IPin>           connectedPin;
 	CaptureFilter          *filter;
 	MediaType              connectedMediaType;
+	ComPtr<CaptureAllocator> allocator;
+	ComPtr<IMemAllocator>  upstreamAllocator;
+	ALLOCATOR_PROPERTIES   allocatorProps = {};
 	volatile bool          flushing = false;
 
 	bool IsValidMediaType(const AM_MEDIA_TYPE *pmt) const;
@@ -85,6 +93,15 @@ public:
 	STDMETHODIMP ReceiveMultiple(IMediaSample **pSamples, long nSamples,
 			long *nSamplesProcessed);
 	STDMETHODIMP ReceiveCanBlock();
+
+	bool GetAllocatorInfo(AllocatorInfo &info) const;
+
+	/* only safe to call from the streaming thread */
+	inline void SetCallback(CaptureCallback callback, void *param)
+	{
+		captureInfo.callback = callback;
+		captureInfo.param    = param;
+	}
 };
 
 class CaptureFilter : public IBaseFilter {
@@ -0,0 +1,389 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+#include "device-controls.hpp"
+#include "log.hpp"
+
+#undef DEFINE_GUID
+#define DEFINE_GUID(name, l, w1, w2, b1, b2, b3, b4, b5, b6, b7, b8) \
+        EXTERN_C const GUID DECLSPEC_SELECTANY name \
+                = { l, w1, w2, { b1, b2,  b3,  b4,  b5,  b6,  b7,  b8 } }
+
+#include "IVideoCaptureFilter.h"
+
+using namespace std;
+
+namespace DShow {
+
+#define ELGATO_CONTROL_MAX     10000
+#define ELGATO_CONTROL_DEFAULT 5000
+
+const DeviceControls::ControlMapping
+DeviceControls::controlMappings[(int)VideoControl::Count] = {
+	{ControlSource::ProcAmp,       VideoProcAmp_Brightness},
+	{ControlSource::ProcAmp,       VideoProcAmp_Contrast},
+	{ControlSource::ProcAmp,       VideoProcAmp_Hue},
+	{ControlSource::ProcAmp,       VideoProcAmp_Saturation},
+	{ControlSource::ProcAmp,       VideoProcAmp_Sharpness},
+	{ControlSource::ProcAmp,       VideoProcAmp_Gamma},
+	{ControlSource::ProcAmp,       VideoProcAmp_WhiteBalance},
+	{ControlSource::ProcAmp,       VideoProcAmp_BacklightCompensation},
+	{ControlSource::ProcAmp,       VideoProcAmp_Gain},
+	{ControlSource::CameraControl, CameraControl_Exposure},
+	{ControlSource::CameraControl, CameraControl_Focus},
+	{ControlSource::CameraControl, CameraControl_Zoom},
+	{ControlSource::CameraControl, CameraControl_Pan},
+	{ControlSource::CameraControl, CameraControl_Tilt},
+	{ControlSource::CameraControl, CameraControl_Iris}
+};
+
+static int *GetElgatoValue(VIDEO_CAPTURE_FILTER_SETTINGS &settings,
+		VideoControl control)
+{
+	switch (control) {
+	case VideoControl::Brightness: return &settings.brightness;
+	case VideoControl::Contrast:   return &settings.contrast;
+	case VideoControl::Hue:        return &settings.hue;
+	case VideoControl::Saturation: return &settings.saturation;
+	default:                       return nullptr;
+	}
+}
+
+static bool ControlsEqual(const ControlState &a, const ControlState &b)
+{
+	return a.supported     == b.supported     &&
+	       a.minValue      == b.minValue      &&
+	       a.maxValue      == b.maxValue      &&
+	       a.step          == b.step          &&
+	       a.defaultValue  == b.defaultValue  &&
+	       a.value         == b.value         &&
+	       a.autoSupported == b.autoSupported &&
+	       a.autoMode      == b.autoMode;
+}
+
+DeviceControls::~DeviceControls()
+{
+	Stop();
+}
+
+void DeviceControls::Start(IBaseFilter *filter, const VideoConfig &config)
+{
+	Stop();
+
+	filter->QueryInterface(IID_IAMVideoProcAmp, (void**)&procAmp);
+	filter->QueryInterface(IID_IAMCameraControl, (void**)&cameraControl);
+	filter->QueryInterface(IID_IElgatoVideoCaptureFilter2,
+			(void**)&elgato);
+
+	if (!procAmp && !cameraControl && !elgato)
+		return;
+
+	callback         = config.controlCallback;
+	refreshMs        = config.controlRefreshMs;
+	snapshot         = ControlSnapshot();
+	writesPending    = false;
+	refreshRequested = false;
+	stopping         = false;
+
+	for (int i = 0; i < (int)VideoControl::Count; i++) {
+		pending[i].set = false;
+		sources[i]     = ControlSource::None;
+	}
+
+	thread = std::thread(&DeviceControls::ControlThread, this);
+}
+
+void DeviceControls::Stop()
+{
+	if (thread.joinable()) {
+		{
+			lock_guard<mutex> lock(controlMutex);
+			stopping = true;
+		}
+
+		controlCond.notify_one();
+		thread.join();
+	}
+
+	procAmp.Release();
+	cameraControl.Release();
+	elgato.Release();
+	callback = nullptr;
+}
+
+bool DeviceControls::Get(ControlSnapshot &controls) const
+{
+	lock_guard<mutex> lock(controlMutex);
+
+	if (!thread.joinable())
+		return false;
+
+	controls = snapshot;
+	return true;
+}
+
+bool DeviceControls::Set(VideoControl control, long value, bool autoMode)
+{
+	int index = (int)control;
+	if (index < 0 || index >= (int)VideoControl::Count)
+		return false;
+
+	lock_guard<mutex> lock(controlMutex);
+
+	if (!thread.joinable())
+		return false;
+
+	/* unsupported controls are only known once the first read is done */
+	if (snapshot.readTime && !snapshot.controls[index].supported)
+		return false;
+
+	PendingWrite &write = pending[index];
+	write.set      = true;
+	write.value    = value;
+	write.autoMode = autoMode;
+
+	writesPending = true;
+	controlCond.notify_one();
+	return true;
+}
+
+void DeviceControls::Refresh()
+{
+	lock_guard<mutex> lock(controlMutex);
+
+	refreshRequested = true;
+	controlCond.notify_one();
+}
+
+HRESULT DeviceControls::GetRange(int index, ControlState &state)
+{
+	const ControlMapping &mapping = controlMappings[index];
+	long caps = 0;
+	HRESULT hr = E_NOINTERFACE;
+
+	if (mapping.source == ControlSource::ProcAmp && !!procAmp)
+		hr = procAmp->GetRange(mapping.property, &state.minValue,
+				&state.maxValue, &state.step,
+				&state.defaultValue, &caps);
+	else if (mapping.source == ControlSource::CameraControl &&
+	         !!cameraControl)
+		hr = cameraControl->GetRange(mapping.property, &state.minValue,
+				&state.maxValue, &state.step,
+				&state.defaultValue, &caps);
+
+	/* the Auto flag has the same value for both interfaces */
+	state.autoSupported = (caps & VideoProcAmp_Flags_Auto) != 0;
+	return hr;
+}
+
+void DeviceControls::ReadControls(ControlSnapshot &controls, bool ranges)
+{
+	VIDEO_CAPTURE_FILTER_SETTINGS settings;
+	bool haveSettings = !!elgato && SUCCEEDED(elgato->GetSettings(
+				&settings));
+
+	for (int i = 0; i < (int)VideoControl::Count; i++) {
+		const ControlMapping &mapping = controlMappings[i];
+		ControlState &state = controls.controls[i];
+		int *elgatoValue = haveSettings ?
+			GetElgatoValue(settings, (VideoControl)i) : nullptr;
+		long value = 0, flags = 0;
+		HRESULT hr = E_FAIL;
+
+		if (ranges) {
+			sources[i] = ControlSource::None;
+
+			if (SUCCEEDED(GetRange(i, state))) {
+				sources[i] = mapping.source;
+
+			} else if (elgatoValue) {
+				sources[i]          = ControlSource::Elgato;
+				state.minValue      = 0;
+				state.maxValue      = ELGATO_CONTROL_MAX;
+				state.step          = 1;
+				state.defaultValue  = ELGATO_CONTROL_DEFAULT;
+				state.autoSupported = false;
+			}
+
+			state.supported = sources[i] != ControlSource::None;
+		}
+
+		switch (sources[i]) {
+		case ControlSource::ProcAmp:
+			hr = procAmp->Get(mapping.property, &value, &flags);
+			break;
+		case ControlSource::CameraControl:
+			hr = cameraControl->Get(mapping.property, &value,
+					&flags);
+			break;
+		case ControlSource::Elgato:
+			if (elgatoValue) {
+				value = *elgatoValue;
+				flags = 0;
+				hr    = S_OK;
+			}
+			break;
+		case ControlSource::None:
+			break;
+		}
+
+		if (SUCCEEDED(hr)) {
+			state.value    = value;
+			state.autoMode = (flags & VideoProcAmp_Flags_Auto) != 0;
+		}
+	}
+}
+
+void DeviceControls::ApplyWrites(const PendingWrite *writes)
+{
+	VIDEO_CAPTURE_FILTER_SETTINGS settings;
+	bool elgatoChanged = false;
+	bool elgatoRead = false;
+
+	for (int i = 0; i < (int)VideoControl::Count; i++) {
+		const ControlMapping &mapping = controlMappings[i];
+		const PendingWrite &write = writes[i];
+		long flags = write.autoMode ? VideoProcAmp_Flags_Auto :
+			VideoProcAmp_Flags_Manual;
+		HRESULT hr = S_OK;
+
+		if (!write.set)
+			continue;
+
+		switch (sources[i]) {
+		case ControlSource::ProcAmp:
+			hr = procAmp->Set(mapping.property, write.value, flags);
+			break;
+		case ControlSource::CameraControl:
+			hr = cameraControl->Set(mapping.property, write.value,
+					flags);
+			break;
+		case ControlSource::Elgato:
+			/* the Elgato settings are one structure, so all of
+			 * its writes go out in a single SetSettings */
+			if (!elgatoRead) {
+				elgatoRead    = true;
+				elgatoChanged = SUCCEEDED(elgato->GetSettings(
+							&settings));
+			}
+			if (elgatoChanged)
+				*GetElgatoValue(settings, (VideoControl)i) =
+					(int)write.value;
+			break;
+		case ControlSource::None:
+			break;
+		}
+
+		if (FAILED(hr))
+			WarningHR(L"DeviceControls: Failed to set control", hr);
+	}
+
+	if (elgatoChanged) {
+		HRESULT hr = elgato->SetSettings(&settings);
+		if (FAILED(hr))
+			WarningHR(L"DeviceControls: Failed to set Elgato "
+			          L"settings", hr);
+	}
+}
+
+void DeviceControls::Publish(const ControlSnapshot &controls)
+{
+	ControlProc    notify;
+	ControlSnapshot copy;
+
+	{
+		lock_guard<mutex> lock(controlMutex);
+		bool changed = false;
+
+		for (int i = 0; i < (int)VideoControl::Count; i++) {
+			if (!ControlsEqual(snapshot.controls[i],
+						controls.controls[i])) {
+				changed = true;
+				break;
+			}
+		}
+
+		unsigned long long version = snapshot.version;
+		snapshot = controls;
+		snapshot.version  = changed ? version + 1 : version;
+		snapshot.readTime = GetTickCount64();
+
+		if (!changed || !callback)
+			return;
+
+		notify = callback;
+		copy   = snapshot;
+	}
+
+	notify(copy);
+}
+
+void DeviceControls::ControlThread()
+{
+	HRESULT hrCom = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+
+	ControlSnapshot controls = {};
+	ReadControls(controls, true);
+	Publish(controls);
+
+	unique_lock<mutex> lock(controlMutex);
+
+	for (;;) {
+		auto ready = [this] ()
+		{
+			return stopping || writesPending || refreshRequested;
+		};
+
+		if (refreshMs)
+			controlCond.wait_for(lock,
+					chrono::milliseconds(refreshMs), ready);
+		else
+			controlCond.wait(lock, ready);
+
+		if (stopping)
+			break;
+
+		PendingWrite writes[(int)VideoControl::Count];
+		bool haveWrites = writesPending;
+
+		for (int i = 0; i < (int)VideoControl::Count; i++) {
+			writes[i] = pending[i];
+			pending[i].set = false;
+		}
+
+		writesPending    = false;
+		refreshRequested = false;
+		lock.unlock();
+
+		if (haveWrites)
+			ApplyWrites(writes);
+
+		ReadControls(controls, false);
+		Publish(controls);
+
+		lock.lock();
+	}
+
+	lock.unlock();
+
+	if (SUCCEEDED(hrCom))
+		CoUninitialize();
+}
+
+}; /* namespace DShow */
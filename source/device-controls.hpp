@@ -0,0 +1,93 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+#pragma once
+
+#include "../dshowcapture.hpp"
+#include "dshow-base.hpp"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+struct IElgatoVideoCaptureFilter2;
+
+namespace DShow {
+
+/**
+ * Keeps a snapshot of a video filter's controls.  All driver calls are made
+ * on the control thread: the snapshot is read when the filter is set and
+ * then periodically, and writes are queued, coalesced per control and
+ * applied in one batch before the next read.
+ */
+class DeviceControls {
+	enum class ControlSource {
+		None,
+		ProcAmp,
+		CameraControl,
+		Elgato
+	};
+
+	struct ControlMapping {
+		ControlSource          source;
+		long                   property;
+	};
+
+	static const ControlMapping controlMappings[(int)VideoControl::Count];
+
+	struct PendingWrite {
+		bool                   set;
+		long                   value;
+		bool                   autoMode;
+	};
+
+	ComPtr<IAMVideoProcAmp>    procAmp;
+	ComPtr<IAMCameraControl>   cameraControl;
+	ComPtr<IElgatoVideoCaptureFilter2> elgato;
+	ControlProc                callback;
+	unsigned int               refreshMs = 0;
+
+	std::thread                thread;
+	mutable std::mutex         controlMutex;
+	std::condition_variable    controlCond;
+	ControlSnapshot            snapshot = {};
+	PendingWrite               pending[(int)VideoControl::Count];
+	ControlSource              sources[(int)VideoControl::Count];
+	bool                       writesPending = false;
+	bool                       refreshRequested = false;
+	bool                       stopping = false;
+
+	void ControlThread();
+	HRESULT GetRange(int index, ControlState &state);
+	void ReadControls(ControlSnapshot &controls, bool ranges);
+	void ApplyWrites(const PendingWrite *writes);
+	void Publish(const ControlSnapshot &controls);
+
+public:
+	~DeviceControls();
+
+	void Start(IBaseFilter *filter, const VideoConfig &config);
+	void Stop();
+
+	bool Get(ControlSnapshot &snapshot) const;
+	bool Set(VideoControl control, long value, bool autoMode);
+	void Refresh();
+};
+
+}; /* namespace DShow */
@@ -22,25 +22,40 @@
 #include "dshow-media-type.hpp"
 #include "dshow-formats.hpp"
 #include "dshow-enum.hpp"
+#include "dshow-thread.hpp"
+#include "video-convert.hpp"
+#include "alloc-tracker.hpp"
 #include "log.hpp"
 
+#include <algorithm>
+
 #define ROCKET_WAIT_TIME_MS 5000
 
 namespace DShow {
 
 bool SetRocketEnabled(IBaseFilter *encoder, bool enable);
 
-HDevice::HDevice()
-	: initialized (false),
-	  active      (false)
+HDevice::HDevice(const void *owner_)
+	: owner       (owner_),
+	  initialized (false),
+	  active      (false),
+	  simulcast   (owner_),
+	  decoder     (owner_)
 {
+	encodedVideo.bytes.SetOwner(owner, MemorySubsystem::Reassembly);
+	encodedAudio.bytes.SetOwner(owner, MemorySubsystem::Reassembly);
+	convertedVideo.SetOwner(owner, MemorySubsystem::Conversion);
 }
 
 HDevice::~HDevice()
 {
+	governor.Stop();
+
 	if (active)
 		Stop();
 
+	decoder.Stop();
+	controls.Stop();
 	DisconnectFilters();
 
 	/*
@@ -55,6 +70,13 @@ HDevice::~HDevice()
 		Sleep(ROCKET_WAIT_TIME_MS);
 		SetRocketEnabled(rocketEncoder, false);
 	}
+
+	StopRecording();
+
+	encodedVideo.bytes.Free();
+	encodedAudio.bytes.Free();
+	convertedVideo.Free();
+	simulcast.Free();
 }
 
 bool HDevice::EnsureInitialized(const wchar_t *func)
@@ -87,6 +109,13 @@ bool HDevice::EnsureInactive(const wchar_t *func)
 	return true;
 }
 
+inline bool HDevice::HasCallback(bool video) const
+{
+	return video ?
+		(videoConfig.sampleCallback || videoConfig.callback) :
+		(audioConfig.sampleCallback || audioConfig.callback);
+}
+
 inline void HDevice::SendToCallback(bool video,
 		unsigned char *data, size_t size,
 		long long startTime, long long stopTime)
@@ -94,29 +123,66 @@ inline void HDevice::SendToCallback(bool video,
 	if (!size)
 		return;
 
-	if (video)
-		videoConfig.callback(videoConfig, data, size, startTime,
-				stopTime);
-	else
-		audioConfig.callback(audioConfig, data, size, startTime,
-				stopTime);
+	ALLOC_PAUSE();
+
+	if (video) {
+		if (videoConfig.sampleCallback)
+			videoConfig.sampleCallback(videoConfig.sampleParam,
+					videoConfig, data, size,
+					startTime, stopTime);
+		else if (videoConfig.callback)
+			videoConfig.callback(videoConfig, data, size,
+					startTime, stopTime);
+	} else {
+		if (audioConfig.sampleCallback)
+			audioConfig.sampleCallback(audioConfig.sampleParam,
+					audioConfig, data, size,
+					startTime, stopTime);
+		else if (audioConfig.callback)
+			audioConfig.callback(audioConfig, data, size,
+					startTime, stopTime);
+	}
 }
 
-void HDevice::Receive(bool isVideo, IMediaSample *sample)
+inline bool HDevice::WantsRawVideo() const
 {
-	BYTE *ptr;
-	MediaTypePtr mt;
-	bool encoded = isVideo ?
+	return simulcast.Active() || signalQC.Active() ||
+		decoder.Active() || !!videoConfig.lumaCallback;
+}
+
+bool HDevice::IsEncodedStream(bool isVideo) const
+{
+	return isVideo ?
 		((int)videoConfig.format >= 400) :
 		((int)audioConfig.format >= 200);
+}
 
-	if (!sample)
-		return;
+template<bool isVideo, bool encoded>
+void HDevice::Receive(IMediaSample *sample)
+{
+	MediaTypePtr mt;
 
-	if (isVideo ? !videoConfig.callback : !audioConfig.callback)
-		return;
+	ALLOC_SCOPE("receive");
+
+	if (!HasCallback(isVideo)) {
+		if (!recording && !(isVideo && WantsRawVideo()))
+			return;
+	}
+
+	/* upstream filters may change their streaming thread whenever the
+	 * graph is restarted, so configure each new thread as it shows up */
+	ThreadState &thread = isVideo ? videoThread : audioThread;
+	if (thread.id != GetCurrentThreadId()) {
+		RestoreThread(thread);
+		if (isVideo)
+			ConfigureThread(videoConfig, thread);
+		else
+			ConfigureThread(audioConfig, thread);
+	}
 
 	if (sample->GetMediaType(&mt) == S_OK) {
+		ALLOC_REWARM();
+
 		if (isVideo) {
 			videoMediaType = mt;
 			ConvertVideoSettings();
@@ -124,8 +190,29 @@ void HDevice::Receive(bool isVideo, IMediaSample *sample)
 			audioMediaType = mt;
 			ConvertAudioSettings();
 		}
+
+		/* a dynamic format change can switch between raw and encoded
+		 * data, so swap the specialization used for later samples */
+		if (IsEncodedStream(isVideo) != encoded) {
+			CaptureFilter *capture = isVideo ?
+				videoCapture.Get() : audioCapture.Get();
+
+			capture->GetPin()->SetCallback(
+					GetReceiveCallback(isVideo, !encoded),
+					this);
+			ReceiveData<isVideo, !encoded>(sample);
+			return;
+		}
 	}
 
+	ReceiveData<isVideo, encoded>(sample);
+}
+
+template<bool isVideo, bool encoded>
+inline void HDevice::ReceiveData(IMediaSample *sample)
+{
+	BYTE *ptr;
+
 	int size = sample->GetActualDataLength();
 	if (!size)
 		return;
@@ -142,41 +229,147 @@ void HDevice::Receive(bool isVideo, IMediaSample *sample)
 		/* packets that have time are the first packet in a group of
 		 * segments */
 		if (hasTime) {
-			SendToCallback(isVideo,
-					data.bytes.data(), data.bytes.size(),
-					data.lastStartTime, data.lastStopTime);
-
-			data.bytes.resize(0);
+			if (recording && !data.dropping)
+				Record(isVideo, data.bytes.Data(),
+						data.bytes.Size(),
+						data.lastStartTime);
+
+			/* with decoding on, the callback gets the decoded
+			 * frames from the decode thread instead */
+			if (!data.dropping && isVideo && decoder.Active())
+				decoder.Push(data.bytes.Data(),
+						data.bytes.Size(),
+						data.lastStartTime,
+						data.lastStopTime);
+			else if (!data.dropping)
+				SendToCallback(isVideo, data.bytes.Data(),
+						data.bytes.Size(),
+						data.lastStartTime,
+						data.lastStopTime);
+
+			data.bytes.Clear();
 			data.lastStartTime = startTime;
 			data.lastStopTime  = stopTime;
+			data.dropping      = false;
+
+		} else if (data.dropping) {
+			return;
+		}
+
+		/* a frame that never ends must not take all the memory */
+		if (data.bytes.Size() + size > data.bytes.Capacity()) {
+			if (PoolOverBudget(owner, size)) {
+				if (!data.warnedBudget)
+					Warning(L"Device over its memory budget, "
+					        L"dropping encoded %s frames",
+					        isVideo ? L"video" : L"audio");
+
+				AddPoolDegradation(owner);
+				data.bytes.Free();
+				data.dropping     = true;
+				data.warnedBudget = true;
+				return;
+			}
+
+			data.warnedBudget = false;
 		}
 
-		data.bytes.insert(data.bytes.end(),
-				(unsigned char*)ptr,
-				(unsigned char*)ptr + size);
+		data.bytes.Append(ptr, size);
 
 	} else if (hasTime) {
-		SendToCallback(isVideo, ptr, size, startTime, stopTime);
+		size_t dataSize = (size_t)size;
+		LumaStatsBuilder *luma = nullptr;
+
+		if (isVideo && (videoConfig.lumaCallback || signalQC.Active())) {
+			lumaStats.Reset(videoConfig.lumaSubsample,
+					signalQC.Active());
+			luma = &lumaStats;
+		}
+
+		if (isVideo && convertVideo) {
+			if (!ConvertVideoFrame(videoConfig, ptr, size,
+						convertedVideo, luma))
+				return;
+
+			ptr      = convertedVideo.Data();
+			dataSize = convertedVideo.Size();
+
+		} else if (luma && !luma->AddFrame(videoConfig, ptr, dataSize)) {
+			if (!warnedLuma)
+				Warning(L"No luma statistics or signal QC for "
+				        L"this video format");
+
+			luma       = nullptr;
+			warnedLuma = true;
+		}
+
+		if (luma) {
+			const LumaStats &stats = luma->Finish();
+
+			if (videoConfig.lumaCallback) {
+				ALLOC_PAUSE();
+				videoConfig.lumaCallback(videoConfig, stats,
+						startTime, stopTime);
+			}
+			if (signalQC.Active())
+				signalQC.Process(videoConfig, stats, *luma,
+						startTime);
+		}
+
+		bool measure = isVideo && governor.Active();
+		long long callbackStart = measure ? governor.Now() : 0;
+
+		SendToCallback(isVideo, ptr, dataSize, startTime, stopTime);
+
+		if (measure)
+			governor.FrameDelivered(startTime, callbackStart);
+
+		if (isVideo && simulcast.Active())
+			simulcast.Process(ptr, dataSize, startTime, stopTime);
 	}
 }
 
+template<bool isVideo, bool encoded>
+void HDevice::ReceiveSample(void *param, IMediaSample *sample)
+{
+	reinterpret_cast<HDevice*>(param)->Receive<isVideo, encoded>(sample);
+}
+
+CaptureCallback HDevice::GetReceiveCallback(bool isVideo, bool encoded)
+{
+	if (isVideo)
+		return encoded ?
+			ReceiveSample<true, true> : ReceiveSample<true, false>;
+	else
+		return encoded ?
+			ReceiveSample<false, true> : ReceiveSample<false, false>;
+}
+
 void HDevice::ConvertVideoSettings()
 {
-	VIDEOINFOHEADER  *vih  = (VIDEOINFOHEADER*)videoMediaType->pbFormat;
-	BITMAPINFOHEADER *bmih = GetBitmapInfoHeader(videoMediaType);
+	REFERENCE_TIME   *avgTime = GetAvgTimePerFrame(videoMediaType);
+	BITMAPINFOHEADER *bmih    = GetBitmapInfoHeader(videoMediaType);
 
 	if (bmih) {
 		Debug(L"Video media type changed");
 
 		videoConfig.cx            = bmih->biWidth;
 		videoConfig.cy            = bmih->biHeight;
-		videoConfig.frameInterval = vih->AvgTimePerFrame;
+		videoConfig.frameInterval = *avgTime;
 
 		bool same = videoConfig.internalFormat == videoConfig.format;
 		GetMediaTypeVFormat(videoMediaType, videoConfig.internalFormat);
 
 		if (same)
 			videoConfig.format = videoConfig.internalFormat;
+
+		convertVideo = CanConvertVideo(videoConfig.internalFormat,
+				videoConfig.format);
+		warnedLuma   = false;
+
+		simulcast.Configure(videoConfig);
+		signalQC.Configure(videoConfig);
+		PublishVideoFormat();
 	}
 }
 
@@ -202,6 +395,34 @@ void HDevice::ConvertAudioSettings()
 		audioConfig.format = AudioFormat::WaveFloat;
 	else
 		audioConfig.format = AudioFormat::Unknown;
+
+	PublishAudioFormat();
+}
+
+void HDevice::PublishVideoFormat()
+{
+	VideoStreamFormat format = videoFormat.Read();
+
+	format.cx             = videoConfig.cx;
+	format.cy             = videoConfig.cy;
+	format.frameInterval  = videoConfig.frameInterval;
+	format.internalFormat = videoConfig.internalFormat;
+	format.format         = videoConfig.format;
+	format.changes++;
+
+	videoFormat.Write(format);
+}
+
+void HDevice::PublishAudioFormat()
+{
+	AudioStreamFormat format = audioFormat.Read();
+
+	format.sampleRate = audioConfig.sampleRate;
+	format.channels   = audioConfig.channels;
+	format.format     = audioConfig.format;
+	format.changes++;
+
+	audioFormat.Write(format);
 }
 
 #define HD_PVR1_NAME L"Hauppauge HD PVR Capture"
@@ -211,10 +432,10 @@ bool HDevice::SetupExceptionVideoCapture(IBaseFilter *filter,
 {
 	ComPtr<IPin> pin;
 
-	if (GetPinByName(filter, PINDIR_OUTPUT, L"656", &pin))
+	if (pins.GetPinByName(filter, PINDIR_OUTPUT, L"656", &pin))
 		return SetupEncodedVideoCapture(filter, config, HD_PVR2);
 
-	else if (GetPinByName(filter, PINDIR_OUTPUT, L"TS Out", &pin))
+	else if (pins.GetPinByName(filter, PINDIR_OUTPUT, L"TS Out", &pin))
 		return SetupEncodedVideoCapture(filter, config, Roxio);
 
 	return false;
@@ -229,7 +450,8 @@ static bool GetPinMediaType(IPin *pin, MediaType &mt)
 		ULONG        count = 0;
 
 		while (mediaTypes->Next(1, &curMT, &count) == S_OK) {
-			if (curMT->formattype == FORMAT_VideoInfo) {
+			if (curMT->formattype == FORMAT_VideoInfo ||
+			    curMT->formattype == FORMAT_VideoInfo2) {
 				mt = curMT;
 				return true;
 			}
@@ -256,8 +478,8 @@ bool HDevice::SetupVideoCapture(IBaseFilter *filter, VideoConfig &config)
 	else if (config.name.find(HD_PVR1_NAME) != std::string::npos)
 		return SetupEncodedVideoCapture(filter, config, HD_PVR1);
 
-	success = GetFilterPin(filter, MEDIATYPE_Video, PIN_CATEGORY_CAPTURE,
-			PINDIR_OUTPUT, &pin);
+	success = pins.GetFilterPin(filter, MEDIATYPE_Video,
+			PIN_CATEGORY_CAPTURE, PINDIR_OUTPUT, &pin);
 	if (!success) {
 		if (SetupExceptionVideoCapture(filter, config)) {
 			return true;
@@ -310,8 +532,13 @@ bool HDevice::SetupVideoCapture(IBaseFilter *filter, VideoConfig &config)
 	ConvertVideoSettings();
 
 	PinCaptureInfo info;
-	info.callback          = [this] (IMediaSample *s) {Receive(true, s);};
+	info.callback          = GetReceiveCallback(true,
+			IsEncodedStream(true));
+	info.param             = this;
 	info.expectedMajorType = videoMediaType->majortype;
+	info.bufferOwner       = owner;
+	info.numaNode          = GetAffinityNumaNode(config.affinityMask);
+	info.bufferCount       = config.pipelineDepth;
 
 	/* attempt to force intermediary filters for these types */
 	if (videoConfig.format == VideoFormat::XRGB)
@@ -338,12 +565,18 @@ bool HDevice::SetupVideoCapture(IBaseFilter *filter, VideoConfig &config)
 bool HDevice::SetVideoConfig(VideoConfig *config)
 {
 	ComPtr<IBaseFilter> filter;
+	lock_guard<recursive_mutex> lock(configMutex);
 
 	if (!EnsureInitialized(L"SetVideoConfig") ||
 	    !EnsureInactive(L"SetVideoConfig"))
 		return false;
 
 	videoMediaType = NULL;
+	convertVideo   = false;
+	decoder.Stop();
+	controls.Stop();
+	pins.Remove(videoFilter);
+	pins.Remove(videoCapture);
 	graph->RemoveFilter(videoFilter);
 	graph->RemoveFilter(videoCapture);
 	videoFilter.Release();
@@ -372,9 +605,17 @@ bool HDevice::SetVideoConfig(VideoConfig *config)
 
 	videoConfig = *config;
 
+	encodedVideo.bytes.SetOwner(owner, MemorySubsystem::Reassembly,
+			GetAffinityNumaNode(config->affinityMask));
+	convertedVideo.SetOwner(owner, MemorySubsystem::Conversion,
+			GetAffinityNumaNode(config->affinityMask));
+
 	if (!SetupVideoCapture(filter, videoConfig))
 		return false;
 
+	controls.Start(filter, videoConfig);
+	PublishVideoFormat();
+
 	*config = videoConfig;
 	return true;
 }
@@ -411,8 +652,8 @@ bool HDevice::SetupAudioCapture(IBaseFilter *filter, AudioConfig &config)
 	bool          success;
 	HRESULT       hr;
 
-	success = GetFilterPin(filter, MEDIATYPE_Audio, PIN_CATEGORY_CAPTURE,
-			PINDIR_OUTPUT, &pin);
+	success = pins.GetFilterPin(filter, MEDIATYPE_Audio,
+			PIN_CATEGORY_CAPTURE, PINDIR_OUTPUT, &pin);
 	if (!success) {
 		Error(L"Could not get audio pin");
 		return false;
@@ -451,9 +692,14 @@ bool HDevice::SetupAudioCapture(IBaseFilter *filter, AudioConfig &config)
 	ConvertAudioSettings();
 
 	PinCaptureInfo info;
-	info.callback          = [this] (IMediaSample *s) {Receive(false, s);};
+	info.callback          = GetReceiveCallback(false,
+			(int)config.format >= 200);
+	info.param             = this;
 	info.expectedMajorType = audioMediaType->majortype;
 	info.expectedSubType   = audioMediaType->subtype;
+	info.bufferOwner       = owner;
+	info.numaNode          = GetAffinityNumaNode(config.affinityMask);
+	info.bufferCount       = config.pipelineDepth;
 
 	audioCapture = new CaptureFilter(info);
 	audioFilter  = filter;
@@ -496,13 +742,18 @@ bool HDevice::SetupAudioOutput(IBaseFilter *filter, AudioConfig &config)
 bool HDevice::SetAudioConfig(AudioConfig *config)
 {
 	ComPtr<IBaseFilter> filter;
+	lock_guard<recursive_mutex> lock(configMutex);
 
 	if (!EnsureInitialized(L"SetAudioConfig") ||
 	    !EnsureInactive(L"SetAudioConfig"))
 		return false;
 
-	if (!audioConfig.useVideoDevice)
+	if (!audioConfig.useVideoDevice) {
+		pins.Remove(audioFilter);
 		graph->RemoveFilter(audioFilter);
+	}
+	pins.Remove(audioCapture);
+	pins.Remove(audioOutput);
 	graph->RemoveFilter(audioCapture);
 	graph->RemoveFilter(audioOutput);
 	audioFilter.Release();
@@ -551,10 +802,14 @@ bool HDevice::SetAudioConfig(AudioConfig *config)
 
 	audioConfig = *config;
 
+	encodedAudio.bytes.SetOwner(owner, MemorySubsystem::Reassembly,
+			GetAffinityNumaNode(config->affinityMask));
+
 	if (config->mode == AudioMode::Capture) {
 		if (!SetupAudioCapture(filter, audioConfig))
 			return false;
 
+		PublishAudioFormat();
 		*config = audioConfig;
 		return true;
 	}
@@ -587,7 +842,7 @@ bool HDevice::FindCrossbar(IBaseFilter *filter, IBaseFilter **crossbar)
 	if (SUCCEEDED(hr))
 		return true;
 
-	if (!GetPinByName(filter, PINDIR_INPUT, nullptr, &pin))
+	if (!pins.GetPinByName(filter, PINDIR_INPUT, nullptr, &pin))
 		return false;
 	if (!GetPinMedium(pin, medium))
 		return false;
@@ -606,6 +861,7 @@ bool HDevice::ConnectPins(const GUID &category, const GUID &type,
 	ComPtr<IPin> filterPin;
 	ComPtr<IPin> capturePin;
 	bool connectCrossbar = !encodedDevice && type == MEDIATYPE_Video;
+	lock_guard<recursive_mutex> lock(configMutex);
 
 	if (!EnsureInitialized(L"HDevice::ConnectPins") ||
 	    !EnsureInactive(L"HDevice::ConnectPins"))
@@ -619,12 +875,13 @@ bool HDevice::ConnectPins(const GUID &category, const GUID &type,
 		}
 	}
 
-	if (!GetFilterPin(filter, type, category, PINDIR_OUTPUT, &filterPin)) {
+	if (!pins.GetFilterPin(filter, type, category, PINDIR_OUTPUT,
+				&filterPin)) {
 		Error(L"HDevice::ConnectPins: Failed to find pin");
 		return false;
 	}
 
-	if (!GetPinByName(capture, PINDIR_INPUT, nullptr, &capturePin)) {
+	if (!pins.GetPinByName(capture, PINDIR_INPUT, nullptr, &capturePin)) {
 		Error(L"HDevice::ConnectPins: Failed to find capture pin");
 		return false;
 	}
@@ -643,6 +900,7 @@ bool HDevice::RenderFilters(const GUID &category, const GUID &type,
 		IBaseFilter *filter, IBaseFilter *capture)
 {
 	HRESULT hr;
+	lock_guard<recursive_mutex> lock(configMutex);
 
 	if (!EnsureInitialized(L"HDevice::RenderFilters") ||
 	    !EnsureInactive(L"HDevice::RenderFilters"))
@@ -660,7 +918,7 @@ bool HDevice::RenderFilters(const GUID &category, const GUID &type,
 void HDevice::SetAudioBuffering(int bufferingMs)
 {
 	ComPtr<IPin> pin;
-	bool success = GetFilterPin(audioFilter, MEDIATYPE_Audio,
+	bool success = pins.GetFilterPin(audioFilter, MEDIATYPE_Audio,
 			PIN_CATEGORY_CAPTURE, PINDIR_OUTPUT, &pin);
 	if (!success)
 		return;
@@ -698,6 +956,7 @@ void HDevice::SetAudioBuffering(int bufferingMs)
 bool HDevice::ConnectFilters()
 {
 	bool success = true;
+	lock_guard<recursive_mutex> lock(configMutex);
 
 	if (!EnsureInitialized(L"ConnectFilters") ||
 	    !EnsureInactive(L"ConnectFilters"))
@@ -761,11 +1020,14 @@ void HDevice::DisconnectFilters()
 		graph->RemoveFilter(filter);
 		filterEnum->Reset();
 	}
+
+	pins.Clear();
 }
 
 Result HDevice::Start()
 {
 	HRESULT hr;
+	lock_guard<recursive_mutex> lock(configMutex);
 
 	if (!EnsureInitialized(L"Start") ||
 	    !EnsureInactive(L"Start"))
@@ -774,9 +1036,23 @@ Result HDevice::Start()
 	if (!!rocketEncoder)
 		Sleep(ROCKET_WAIT_TIME_MS);
 
+	/* fault in the reassembly buffer up front so the first keyframes
+	 * don't stall the demuxer's thread on page faults */
+	if (encodedDevice)
+		encodedVideo.bytes.Reserve(
+				size_t(videoConfig.cx) * videoConfig.cy, true);
+
+	signalQC.Restart();
+
+	/* started before the graph runs so the first keyframe is decoded */
+	if (videoConfig.decode && videoConfig.format == VideoFormat::H264)
+		decoder.Start(videoConfig);
+
 	hr = control->Run();
 
 	if (FAILED(hr)) {
+		decoder.Stop();
+
 		if (hr == (HRESULT)0x8007001F) {
 			WarningHR(L"Run failed, device already in use", hr);
 			return Result::InUse;
@@ -787,15 +1063,282 @@ Result HDevice::Start()
 	}
 
 	active = true;
+
+	if (downgradePolicy.enabled && videoCapture && !encodedDevice) {
+		vector<QualityStep> steps;
+		GetQualitySteps(steps);
+		governor.Start(downgradePolicy, steps, ApplyQualityStep, this);
+	}
+
 	return Result::Success;
 }
 
 void HDevice::Stop()
 {
+	/* waits for a mode switch that may be in progress.  Not under the
+	 * lock, which the switch holds */
+	governor.Stop();
+
+	lock_guard<recursive_mutex> lock(configMutex);
+
 	if (active) {
 		control->Stop();
 		active = false;
 	}
+
+	/* nothing is delivered once stopped; the next Start decodes from
+	 * the next keyframe */
+	decoder.Stop();
+
+	/* the streaming threads belong to the upstream filters and may be
+	 * reused after the graph has stopped */
+	RestoreThread(videoThread);
+	RestoreThread(audioThread);
+}
+
+static inline double GetPixelRate(const QualityStep &step)
+{
+	return (double)step.cx * abs(step.cy) / (double)step.frameInterval;
+}
+
+void HDevice::GetQualitySteps(vector<QualityStep> &steps)
+{
+	QualityStep current;
+	current.cx            = videoConfig.cx;
+	current.cy            = videoConfig.cy;
+	current.frameInterval = videoConfig.frameInterval;
+
+	steps.clear();
+	if (current.frameInterval <= 0)
+		return;
+
+	steps.push_back(current);
+
+	vector<QualityStep> candidates = downgradePolicy.steps;
+
+	if (candidates.empty()) {
+		ComPtr<IPin>      pin;
+		vector<VideoInfo> caps;
+
+		if (pins.GetFilterPin(videoFilter, MEDIATYPE_Video,
+					PIN_CATEGORY_CAPTURE, PINDIR_OUTPUT,
+					&pin))
+			EnumVideoCaps(pin, caps);
+
+		for (const VideoInfo &info : caps) {
+			if (info.format != videoConfig.internalFormat)
+				continue;
+
+			QualityStep step;
+			step.cx            = info.maxCX;
+			step.cy            = info.maxCY;
+			step.frameInterval = info.minInterval;
+			candidates.push_back(step);
+		}
+
+		sort(candidates.begin(), candidates.end(),
+				[] (const QualityStep &a, const QualityStep &b)
+		{
+			return GetPixelRate(a) > GetPixelRate(b);
+		});
+	}
+
+	/* every step has to be cheaper than the one before it */
+	for (const QualityStep &step : candidates) {
+		if (step.cx <= 0 || !step.cy || step.frameInterval <= 0)
+			continue;
+		if (GetPixelRate(step) < GetPixelRate(steps.back()))
+			steps.push_back(step);
+	}
+}
+
+/* removes what RenderStream put between a pin and the capture filter */
+static void RemoveRenderedChain(IGraphBuilder *graph, IPin *pin,
+		IBaseFilter *capture)
+{
+	ComPtr<IPin> peer;
+	PIN_INFO     pinInfo;
+
+	if (FAILED(pin->ConnectedTo(&peer)))
+		return;
+
+	graph->Disconnect(peer);
+	graph->Disconnect(pin);
+
+	if (FAILED(peer->QueryPinInfo(&pinInfo)) || !pinInfo.pFilter)
+		return;
+
+	ComPtr<IBaseFilter> filter = pinInfo.pFilter;
+	pinInfo.pFilter->Release();
+
+	if (filter == capture)
+		return;
+
+	ComPtr<IEnumPins> pinEnum;
+	if (SUCCEEDED(filter->EnumPins(&pinEnum))) {
+		ComPtr<IPin> output;
+
+		while (pinEnum->Next(1, &output, nullptr) == S_OK) {
+			PIN_DIRECTION dir;
+			if (SUCCEEDED(output->QueryDirection(&dir)) &&
+			    dir == PINDIR_OUTPUT)
+				RemoveRenderedChain(graph, output, capture);
+		}
+	}
+
+	graph->RemoveFilter(filter);
+}
+
+static bool RenderVideo(ICaptureGraphBuilder2 *builder, IBaseFilter *filter,
+		IBaseFilter *capture)
+{
+	return SUCCEEDED(builder->RenderStream(&PIN_CATEGORY_CAPTURE,
+				&MEDIATYPE_Video, filter, NULL, capture));
+}
+
+/* the device stays active for the whole switch, so that the API calls
+ * that require an inactive device keep failing while the graph is being
+ * rebuilt */
+bool HDevice::ReconfigureVideo(const QualityStep &step)
+{
+	ComPtr<IPin> filterPin;
+	ComPtr<IPin> capturePin;
+	MediaType    mt;
+	HRESULT      hr;
+
+	lock_guard<recursive_mutex> lock(configMutex);
+
+	if (!active)
+		return false;
+
+	if (!pins.GetFilterPin(videoFilter, MEDIATYPE_Video,
+				PIN_CATEGORY_CAPTURE, PINDIR_OUTPUT,
+				&filterPin) ||
+	    !pins.GetPinByName(videoCapture, PINDIR_INPUT, nullptr,
+				&capturePin))
+		return false;
+
+	ComQIPtr<IAMStreamConfig> pinConfig(filterPin);
+	if (!pinConfig)
+		return false;
+
+	VideoConfig config      = videoConfig;
+	config.cx               = step.cx;
+	config.cy               = step.cy;
+	config.frameInterval    = step.frameInterval;
+	config.useDefaultConfig = false;
+
+	if (!GetClosestVideoMediaType(videoFilter, config, mt))
+		return false;
+
+	control->Stop();
+	RestoreThread(videoThread);
+	RestoreThread(audioThread);
+
+	RemoveRenderedChain(graph, filterPin, videoCapture);
+
+	hr = pinConfig->SetFormat(mt);
+	bool success = SUCCEEDED(hr) || hr == E_NOTIMPL;
+
+	if (success) {
+		hr = graph->ConnectDirect(filterPin, capturePin, nullptr);
+		if (FAILED(hr))
+			success = RenderVideo(builder, videoFilter,
+					videoCapture);
+	}
+
+	if (success) {
+		videoMediaType = mt;
+		ConvertVideoSettings();
+		governor.ModeChanged(videoConfig.frameInterval);
+	} else {
+		/* go back to the mode that worked */
+		WarningHR(L"ReconfigureVideo: Could not switch mode", hr);
+		RemoveRenderedChain(graph, filterPin, videoCapture);
+		pinConfig->SetFormat(videoMediaType);
+
+		hr = graph->ConnectDirect(filterPin, capturePin, nullptr);
+		if (FAILED(hr))
+			RenderVideo(builder, videoFilter, videoCapture);
+	}
+
+	signalQC.Restart();
+
+	/* drop frames queued in the old mode and decode the new one from
+	 * its first keyframe */
+	if (decoder.Active())
+		decoder.Start(videoConfig);
+
+	/* the device is in the new mode either way; stop switching rather
+	 * than have the governor drop a step the device is running in */
+	hr = control->Run();
+	if (FAILED(hr)) {
+		ErrorHR(L"ReconfigureVideo: Run failed, the device has "
+		        L"stopped streaming", hr);
+		governor.Halt();
+	}
+
+	return success;
+}
+
+bool HDevice::ApplyQualityStep(void *param, const QualityStep &step)
+{
+	return reinterpret_cast<HDevice*>(param)->ReconfigureVideo(step);
+}
+
+void HDevice::Record(bool video, unsigned char *data, size_t size,
+		long long timestamp)
+{
+	lock_guard<mutex> lock(recorderMutex);
+
+	if (recorder)
+		recorder->Push(video, data, size, timestamp);
+}
+
+bool HDevice::StartRecording(const RecordConfig &config)
+{
+	if (!EnsureInitialized(L"StartRecording"))
+		return false;
+
+	bool video = config.video && videoCapture != nullptr &&
+		videoConfig.format == VideoFormat::H264;
+	bool audio = config.audio && audioCapture != nullptr &&
+		audioConfig.format == AudioFormat::AAC;
+
+	if (!encodedDevice || (!video && !audio)) {
+		Error(L"StartRecording: Recording requires an encoded device "
+		      L"with H.264 video or AAC audio");
+		return false;
+	}
+
+	StopRecording();
+
+	Recorder *newRecorder = new Recorder(owner);
+	if (!newRecorder->Open(config, video ? &videoConfig : nullptr,
+				audio ? &audioConfig : nullptr)) {
+		delete newRecorder;
+		return false;
+	}
+
+	lock_guard<mutex> lock(recorderMutex);
+	recorder.reset(newRecorder);
+	recording = true;
+	return true;
+}
+
+void HDevice::StopRecording()
+{
+	unique_ptr<Recorder> oldRecorder;
+
+	{
+		lock_guard<mutex> lock(recorderMutex);
+		oldRecorder = move(recorder);
+		recording = false;
+	}
+
+	/* flushes and closes the file on this thread rather than inside the
+	 * lock the capture threads take */
+	oldRecorder.reset();
 }
 
 }; /* namespace DShow */
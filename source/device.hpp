@@ -21,7 +21,20 @@
 
 #include "../dshowcapture.hpp"
 #include "capture-filter.hpp"
-
+#include "buffer-pool.hpp"
+#include "recorder.hpp"
+#include "simulcast.hpp"
+#include "device-controls.hpp"
+#include "pin-cache.hpp"
+#include "seqlock.hpp"
+#include "luma-stats.hpp"
+#include "signal-qc.hpp"
+#include "dshow-thread.hpp"
+#include "quality-governor.hpp"
+#include "h264-decoder.hpp"
+
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 using namespace std;
@@ -31,7 +44,11 @@ namespace DShow {
 struct EncodedData {
 	long long                      lastStartTime = 0;
 	long long                      lastStopTime  = 0;
-	vector<unsigned char>          bytes;
+	PoolBuffer                     bytes;
+
+	/* discards the rest of a frame that was dropped for the budget */
+	bool                           dropping = false;
+	bool                           warnedBudget = false;
 };
 
 struct EncodedDevice {
@@ -47,6 +64,9 @@ struct EncodedDevice {
 };
 
 struct HDevice {
+	/* pool accounting key, the Device outlives its graph contexts */
+	const void                     *owner;
+
 	ComPtr<IGraphBuilder>          graph;
 	ComPtr<ICaptureGraphBuilder2>  builder;
 	ComPtr<IMediaControl>          control;
@@ -62,28 +82,73 @@ struct HDevice {
 	VideoConfig                    videoConfig;
 	AudioConfig                    audioConfig;
 
+	/* the parts of videoConfig/audioConfig that the streaming threads
+	 * change, published for readers on other threads */
+	SeqLock<VideoStreamFormat>     videoFormat;
+	SeqLock<AudioStreamFormat>     audioFormat;
+
 	bool                           encodedDevice = false;
 	bool                           initialized;
 	bool                           active;
 
+	ThreadState                    videoThread;
+	ThreadState                    audioThread;
+
 	EncodedData                    encodedVideo;
 	EncodedData                    encodedAudio;
 
-	HDevice();
+	bool                           convertVideo = false;
+	PoolBuffer                     convertedVideo;
+	LumaStatsBuilder               lumaStats;
+	bool                           warnedLuma = false;
+	SignalQC                       signalQC;
+	QualityGovernor                governor;
+	DowngradePolicy                downgradePolicy;
+	Simulcast                      simulcast;
+	H264Decoder                    decoder;
+	DeviceControls                 controls;
+	PinCache                       pins;
+
+	/* held by everything that changes the graph or the configs, which
+	 * includes mode switches made on the governor thread */
+	std::recursive_mutex           configMutex;
+
+	std::mutex                     recorderMutex;
+	std::unique_ptr<Recorder>      recorder;
+	volatile bool                  recording = false;
+
+	HDevice(const void *owner);
 	~HDevice();
 
 	void ConvertVideoSettings();
 	void ConvertAudioSettings();
+	void PublishVideoFormat();
+	void PublishAudioFormat();
 
 	bool EnsureInitialized(const wchar_t *func);
 	bool EnsureActive(const wchar_t *func);
 	bool EnsureInactive(const wchar_t *func);
 
+	inline bool HasCallback(bool video) const;
+	inline bool WantsRawVideo() const;
 	inline void SendToCallback(bool video,
 			unsigned char *data, size_t size,
 			long long startTime, long long stopTime);
 
-	void Receive(bool video, IMediaSample *sample);
+	/* the receive path is instantiated once per stream kind so that
+	 * per-sample work does not branch on it, see GetReceiveCallback */
+	template<bool isVideo, bool encoded>
+	void Receive(IMediaSample *sample);
+	template<bool isVideo, bool encoded>
+	void ReceiveData(IMediaSample *sample);
+	template<bool isVideo, bool encoded>
+	static void ReceiveSample(void *param, IMediaSample *sample);
+
+	static CaptureCallback GetReceiveCallback(bool isVideo, bool encoded);
+	bool IsEncodedStream(bool isVideo) const;
+
+	void Record(bool video, unsigned char *data, size_t size,
+			long long timestamp);
 
 	bool SetupEncodedVideoCapture(IBaseFilter *filter,
 				VideoConfig &config,
@@ -94,6 +159,10 @@ struct HDevice {
 
 	bool SetupExceptionAudioCapture(IPin *pin);
 
+	void GetQualitySteps(std::vector<QualityStep> &steps);
+	bool ReconfigureVideo(const QualityStep &step);
+	static bool ApplyQualityStep(void *param, const QualityStep &step);
+
 	bool SetupVideoCapture(IBaseFilter *filter, VideoConfig &config);
 	bool SetupAudioCapture(IBaseFilter *filter, AudioConfig &config);
 
@@ -113,6 +182,9 @@ struct HDevice {
 	void DisconnectFilters();
 	Result Start();
 	void Stop();
+
+	bool StartRecording(const RecordConfig &config);
+	void StopRecording();
 };
 
 }; /* namespace DShow */
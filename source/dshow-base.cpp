@@ -125,9 +125,65 @@ static bool GetDeviceCallback(DeviceFilterCallbackInfo &info,
 	return false;
 }
 
+static HRESULT ReadProperty(IMoniker *moniker, const wchar_t *property,
+		wchar_t *value, int size);
+
+#define MAX_DEVICE_PATH 1024
+
+static bool BindDeviceMoniker(IMoniker *moniker, const wchar_t *name,
+		const wchar_t *path, IBaseFilter **out)
+{
+	wchar_t value[MAX_DEVICE_PATH];
+
+	/* the parsed name only says which device node it is; make sure it
+	 * really is the requested device */
+	if (FAILED(ReadProperty(moniker, L"DevicePath", value,
+					MAX_DEVICE_PATH)) ||
+	    _wcsicmp(value, path) != 0)
+		return false;
+
+	if (name && *name) {
+		if (FAILED(ReadProperty(moniker, L"FriendlyName", value,
+						MAX_DEVICE_PATH)) ||
+		    wcscmp(value, name) != 0)
+			return false;
+	}
+
+	return SUCCEEDED(moniker->BindToObject(NULL, 0, IID_IBaseFilter,
+				(void**)out));
+}
+
+/* parses the moniker of a device from its path instead of binding every
+ * device in its category.  Parsing is cheap, so monikers are not kept:
+ * they are COM objects that would outlive the caller's apartment */
+static bool GetDeviceFilterByPath(const wchar_t *name, const wchar_t *path,
+		IBaseFilter **out)
+{
+	ComPtr<IBindCtx> bindCtx;
+	ComPtr<IMoniker> moniker;
+	ULONG            eaten = 0;
+	wstring          displayName = L"@device:pnp:";
+
+	displayName += path;
+
+	if (FAILED(CreateBindCtx(0, &bindCtx)) ||
+	    FAILED(MkParseDisplayName(bindCtx, displayName.c_str(), &eaten,
+			    &moniker)))
+		return false;
+
+	return BindDeviceMoniker(moniker, name, path, out);
+}
+
 bool GetDeviceFilter(const IID &type, const wchar_t *name, const wchar_t *path,
 		IBaseFilter **out)
 {
+	/* KS devices can be bound straight from their device path.  Audio
+	 * capture devices are wave devices, not the KS filters their paths
+	 * lead to, so those are always enumerated. */
+	if (path && *path && type != CLSID_AudioInputDeviceCategory &&
+	    GetDeviceFilterByPath(name, path, out))
+		return true;
+
 	DeviceFilterCallbackInfo info;
 	info.name = name;
 	info.path = path;
@@ -23,11 +23,12 @@
 #include "dshow-demux.hpp"
 #include "capture-filter.hpp"
 #include "device.hpp"
+#include "dshow-thread.hpp"
 #include "log.hpp"
 
 namespace DShow {
 
-static inline bool CreateFilters(IBaseFilter *filter,
+static inline bool CreateFilters(PinCache &pins, IBaseFilter *filter,
 		IBaseFilter **crossbar, IBaseFilter **encoder,
 		IBaseFilter **demuxer)
 {
@@ -38,12 +39,12 @@ static inline bool CreateFilters(IBaseFilter *filter,
 	bool          hasOutMedium;
 	HRESULT       hr;
 
-	if (!GetPinByName(filter, PINDIR_INPUT, nullptr, &inputPin)) {
+	if (!pins.GetPinByName(filter, PINDIR_INPUT, nullptr, &inputPin)) {
 		Warning(L"Encoded Device: Failed to get input pin");
 		return false;
 	}
 
-	if (!GetPinByName(filter, PINDIR_OUTPUT, nullptr, &outputPin)) {
+	if (!pins.GetPinByName(filter, PINDIR_OUTPUT, nullptr, &outputPin)) {
 		Warning(L"Encoded Device: Failed to get output pin");
 		return false;
 	}
@@ -107,18 +108,21 @@ static inline bool ConnectEncodedFilters(IGraphBuilder *graph,
 	return true;
 }
 
-static inline bool MapPacketIDs(IBaseFilter *demuxer, ULONG video, ULONG audio)
+static inline bool MapPacketIDs(PinCache &pins, IBaseFilter *demuxer,
+		ULONG video, ULONG audio)
 {
 	ComPtr<IPin>  videoPin, audioPin;
 	HRESULT       hr;
 
-	if (!GetPinByName(demuxer, PINDIR_OUTPUT, DEMUX_VIDEO_PIN, &videoPin)) {
+	if (!pins.GetPinByName(demuxer, PINDIR_OUTPUT, DEMUX_VIDEO_PIN,
+				&videoPin)) {
 		Warning(L"Encoded Device: Could not get video pin from "
 		        L"demuxer");
 		return false;
 	}
 
-	if (!GetPinByName(demuxer, PINDIR_OUTPUT, DEMUX_AUDIO_PIN, &audioPin)) {
+	if (!pins.GetPinByName(demuxer, PINDIR_OUTPUT, DEMUX_AUDIO_PIN,
+				&audioPin)) {
 		Warning(L"Encoded Device: Could not get audio pin from "
 		        L"demuxer");
 		return false;
@@ -200,7 +204,7 @@ bool HDevice::SetupEncodedVideoCapture(IBaseFilter *filter,
 	MediaType            mtVideo;
 	MediaType            mtAudio;
 
-	if (!CreateFilters(filter, &crossbar, &encoder, &demuxer))
+	if (!CreateFilters(pins, filter, &crossbar, &encoder, &demuxer))
 		return false;
 
 	if (!CreateDemuxVideoPin(demuxer, mtVideo, info.width, info.height,
@@ -218,9 +222,13 @@ bool HDevice::SetupEncodedVideoCapture(IBaseFilter *filter,
 	config.internalFormat = info.videoFormat;
 
 	PinCaptureInfo pci;
-	pci.callback          = [this] (IMediaSample *s) {Receive(true, s);};
+	pci.callback          = GetReceiveCallback(true, true);
+	pci.param             = this;
 	pci.expectedMajorType = mtVideo->majortype;
 	pci.expectedSubType   = mtVideo->subtype;
+	pci.bufferOwner       = owner;
+	pci.numaNode          = GetAffinityNumaNode(config.affinityMask);
+	pci.bufferCount       = config.pipelineDepth;
 
 	videoCapture = new CaptureFilter(pci);
 	videoFilter  = demuxer;
@@ -243,7 +251,7 @@ bool HDevice::SetupEncodedVideoCapture(IBaseFilter *filter,
 	bool success = ConnectEncodedFilters(graph, filter, crossbar,
 			encoder, demuxer);
 	if (success)
-		success = MapPacketIDs(demuxer, info.videoPacketID,
+		success = MapPacketIDs(pins, demuxer, info.videoPacketID,
 				info.audioPacketID);
 
 	encodedDevice = success;
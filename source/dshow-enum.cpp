@@ -21,6 +21,7 @@
 #include <mutex>
 #include "dshow-enum.hpp"
 #include "dshow-formats.hpp"
+#include "mode-probe.hpp"
 #include "log.hpp"
 
 #undef DEFINE_GUID
@@ -86,13 +87,13 @@ static bool Get_FORMAT_VideoInfo_Data(VideoInfo &info,
 		const AM_MEDIA_TYPE &mt, const BYTE *data)
 {
 	const VIDEO_STREAM_CONFIG_CAPS *vscc;
-	const VIDEOINFOHEADER          *viHeader;
 	const BITMAPINFOHEADER         *bmiHeader;
 	VideoFormat                    format;
 
 	vscc      = reinterpret_cast<const VIDEO_STREAM_CONFIG_CAPS*>(data);
-	viHeader  = reinterpret_cast<const VIDEOINFOHEADER*>(mt.pbFormat);
-	bmiHeader = &viHeader->bmiHeader;
+	bmiHeader = GetBitmapInfoHeader(mt);
+	if (!bmiHeader)
+		return false;
 
 	if (!GetMediaTypeVFormat(mt, format))
 		return false;
@@ -157,6 +158,9 @@ struct ClosestVideoData {
 	MediaType   &mt;
 	long long   bestVal;
 	bool        found;
+	bool        bestProven = false;
+
+	vector<VideoModeProbe> probes;
 
 	ClosestVideoData &operator=(ClosestVideoData const&) = delete;
 	ClosestVideoData &operator=(ClosestVideoData&&) = delete;
@@ -174,9 +178,23 @@ static inline void ClampToGranularity(LONG &val, int minVal, int granularity)
 	val -= ((val - minVal) % granularity);
 }
 
+/* 10-bit and full-chroma formats most consumers don't expect */
+static inline bool IsOptInFormat(VideoFormat format)
+{
+	return format == VideoFormat::P010 ||
+	       format == VideoFormat::P210 ||
+	       format == VideoFormat::I422 ||
+	       format == VideoFormat::I444 ||
+	       format == VideoFormat::NV16 ||
+	       format == VideoFormat::V210;
+}
+
 static inline int GetFormatRating(VideoFormat format)
 {
-	if (format >= VideoFormat::I420 && format < VideoFormat::YVYU)
+	/* only pick these when explicitly asked for */
+	if (IsOptInFormat(format))
+		return 12;
+	else if (format >= VideoFormat::I420 && format < VideoFormat::YVYU)
 		return 0;
 	else if (format >= VideoFormat::YVYU && format < VideoFormat::MJPEG)
 		return 5;
@@ -191,7 +209,8 @@ static bool ClosestVideoMTCallback(ClosestVideoData &data,
 {
 	VideoInfo info;
 
-	if (mt.formattype == FORMAT_VideoInfo) {
+	if (mt.formattype == FORMAT_VideoInfo ||
+	    mt.formattype == FORMAT_VideoInfo2) {
 		if (!Get_FORMAT_VideoInfo_Data(info, mt, capData))
 			return true;
 	} else {
@@ -199,7 +218,7 @@ static bool ClosestVideoMTCallback(ClosestVideoData &data,
 	}
 
 	MediaType           copiedMT = mt;
-	VIDEOINFOHEADER     *vih     = (VIDEOINFOHEADER*)copiedMT->pbFormat;
+	REFERENCE_TIME      *avgTime = GetAvgTimePerFrame(copiedMT);
 	BITMAPINFOHEADER    *bmih    = GetBitmapInfoHeader(copiedMT);
 
 	if (data.config.internalFormat != VideoFormat::Any &&
@@ -230,27 +249,46 @@ static bool ClosestVideoMTCallback(ClosestVideoData &data,
 
 	long long totalVal = frameVal + yVal + xVal + formatVal;
 
-	if (!data.found || data.bestVal > totalVal) {
-		if (xVal == 0) {
-			bmih->biWidth = data.config.cx;
-			ClampToGranularity(bmih->biWidth, info.minCX,
-					info.granularityCX);
-		}
+	LONG      cx       = bmih->biWidth;
+	LONG      cy       = bmih->biHeight;
+	long long interval = *avgTime;
 
-		if (yVal == 0) {
-			bmih->biHeight = data.config.cy;
-			ClampToGranularity(bmih->biHeight, info.minCY,
-					info.granularityCY);
-		}
+	if (xVal == 0) {
+		cx = data.config.cx;
+		ClampToGranularity(cx, info.minCX, info.granularityCX);
+	}
+
+	if (yVal == 0) {
+		cy = data.config.cy;
+		ClampToGranularity(cy, info.minCY, info.granularityCY);
+	}
 
-		if (frameVal == 0)
-			vih->AvgTimePerFrame = data.config.frameInterval;
+	if (frameVal == 0)
+		interval = data.config.frameInterval;
 
-		data.found   = true;
-		data.bestVal = totalVal;
-		data.mt      = copiedMT;
+	/* a mode that was measured falling short of its nominal rate is
+	 * rated by the rate it actually delivered */
+	const VideoModeProbe *probe = FindModeProbe(data.probes, info.format,
+			cx, cy, interval);
+	bool proven = probe && probe->sustained;
 
-		if (totalVal == 0)
+	if (probe && probe->started && !probe->sustained)
+		totalVal += max(probe->interval - interval, 1LL);
+
+	bool better = !data.found || data.bestVal > totalVal ||
+		(data.bestVal == totalVal && proven && !data.bestProven);
+
+	if (better) {
+		bmih->biWidth  = cx;
+		bmih->biHeight = cy;
+		*avgTime       = interval;
+
+		data.found      = true;
+		data.bestVal    = totalVal;
+		data.bestProven = proven;
+		data.mt         = copiedMT;
+
+		if (totalVal == 0 && (proven || data.probes.empty()))
 			return false;
 	}
 
@@ -264,6 +302,8 @@ bool GetClosestVideoMediaType(IBaseFilter *filter, VideoConfig &config,
 	ClosestVideoData data(config, mt);
 	bool             success;
 
+	GetModeProbes(config, data.probes);
+
 	success = GetFilterPin(filter, MEDIATYPE_Video, PIN_CATEGORY_CAPTURE,
 			PINDIR_OUTPUT, &pin);
 	if (!success || pin == NULL) {
@@ -393,7 +433,8 @@ static bool EnumVideoCap(vector<VideoInfo> &caps,
 {
 	VideoInfo info;
 
-	if (mt.formattype == FORMAT_VideoInfo)
+	if (mt.formattype == FORMAT_VideoInfo ||
+	    mt.formattype == FORMAT_VideoInfo2)
 		if (Get_FORMAT_VideoInfo_Data(info, mt, data))
 			caps.push_back(info);
 
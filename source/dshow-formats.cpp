@@ -59,6 +59,18 @@ static bool GetFourCCVFormat(DWORD fourCC, VideoFormat &format)
 		format = VideoFormat::NV12; break;
 	case MAKEFOURCC('Y', '8', '0', '0'):
 		format = VideoFormat::Y800; break;
+	case MAKEFOURCC('P', '0', '1', '0'):
+		format = VideoFormat::P010; break;
+	case MAKEFOURCC('P', '2', '1', '0'):
+		format = VideoFormat::P210; break;
+	case MAKEFOURCC('I', '4', '2', '2'):
+	case MAKEFOURCC('Y', '4', '2', 'B'):
+		format = VideoFormat::I422; break;
+	case MAKEFOURCC('I', '4', '4', '4'):
+	case MAKEFOURCC('Y', '4', '4', '4'):
+		format = VideoFormat::I444; break;
+	case MAKEFOURCC('N', 'V', '1', '6'):
+		format = VideoFormat::NV16; break;
 
 	/* packed YUV formats */
 	case MAKEFOURCC('Y', 'V', 'Y', 'U'):
@@ -69,6 +81,8 @@ static bool GetFourCCVFormat(DWORD fourCC, VideoFormat &format)
 		format = VideoFormat::UYVY; break;
 	case MAKEFOURCC('H', 'D', 'Y', 'C'):
 		format = VideoFormat::HDYC; break;
+	case MAKEFOURCC('v', '2', '1', '0'):
+		format = VideoFormat::V210; break;
 
 	/* compressed formats */
 	case MAKEFOURCC('H', '2', '6', '4'):
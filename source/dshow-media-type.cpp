@@ -93,4 +93,36 @@ const BITMAPINFOHEADER *GetBitmapInfoHeader(const AM_MEDIA_TYPE &mt)
 	return NULL;
 }
 
+REFERENCE_TIME *GetAvgTimePerFrame(AM_MEDIA_TYPE &mt)
+{
+	if (mt.formattype == FORMAT_VideoInfo) {
+		VIDEOINFOHEADER *vih;
+		vih = reinterpret_cast<VIDEOINFOHEADER*>(mt.pbFormat);
+		return &vih->AvgTimePerFrame;
+
+	} else if (mt.formattype == FORMAT_VideoInfo2) {
+		VIDEOINFOHEADER2 *vih;
+		vih = reinterpret_cast<VIDEOINFOHEADER2*>(mt.pbFormat);
+		return &vih->AvgTimePerFrame;
+	}
+
+	return NULL;
+}
+
+const REFERENCE_TIME *GetAvgTimePerFrame(const AM_MEDIA_TYPE &mt)
+{
+	if (mt.formattype == FORMAT_VideoInfo) {
+		const VIDEOINFOHEADER *vih;
+		vih = reinterpret_cast<const VIDEOINFOHEADER*>(mt.pbFormat);
+		return &vih->AvgTimePerFrame;
+
+	} else if (mt.formattype == FORMAT_VideoInfo2) {
+		const VIDEOINFOHEADER2 *vih;
+		vih = reinterpret_cast<const VIDEOINFOHEADER2*>(mt.pbFormat);
+		return &vih->AvgTimePerFrame;
+	}
+
+	return NULL;
+}
+
 }; /* namespace DShow */
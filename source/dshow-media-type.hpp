@@ -29,6 +29,9 @@ void    FreeMediaType(AM_MEDIA_TYPE &mt);
 BITMAPINFOHEADER *GetBitmapInfoHeader(AM_MEDIA_TYPE &mt);
 const BITMAPINFOHEADER *GetBitmapInfoHeader(const AM_MEDIA_TYPE &mt);
 
+REFERENCE_TIME *GetAvgTimePerFrame(AM_MEDIA_TYPE &mt);
+const REFERENCE_TIME *GetAvgTimePerFrame(const AM_MEDIA_TYPE &mt);
+
 class MediaTypePtr;
 
 class MediaType {
@@ -0,0 +1,144 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+
+#include "dshow-thread.hpp"
+#include "log.hpp"
+
+#include <avrt.h>
+
+#pragma comment(lib, "avrt.lib")     // for AvSetMmThreadCharacteristics
+
+namespace DShow {
+
+static int GetWindowsPriority(ThreadPriority priority)
+{
+	switch (priority) {
+	case ThreadPriority::AboveNormal:
+		return THREAD_PRIORITY_ABOVE_NORMAL;
+	case ThreadPriority::Highest:
+		return THREAD_PRIORITY_HIGHEST;
+	case ThreadPriority::TimeCritical:
+		return THREAD_PRIORITY_TIME_CRITICAL;
+	case ThreadPriority::Default:
+		break;
+	}
+
+	return THREAD_PRIORITY_NORMAL;
+}
+
+void ConfigureThread(const Config &config, ThreadState &state)
+{
+	HANDLE thread = GetCurrentThread();
+
+	state = ThreadState();
+	state.id = GetCurrentThreadId();
+
+	if (!config.affinityMask &&
+	    config.priority == ThreadPriority::Default)
+		return;
+
+	/* a real handle, so the settings can be restored from another
+	 * thread once the stream stops */
+	state.thread = OpenThread(THREAD_SET_INFORMATION |
+			THREAD_QUERY_INFORMATION, FALSE, state.id);
+	if (!state.thread) {
+		Warning(L"ConfigureThread: OpenThread failed (%lu)",
+				GetLastError());
+		return;
+	}
+
+	state.priority = GetThreadPriority(thread);
+
+	if (config.affinityMask) {
+		DWORD_PTR processMask, systemMask;
+		DWORD_PTR mask = (DWORD_PTR)config.affinityMask;
+
+		if (GetProcessAffinityMask(GetCurrentProcess(), &processMask,
+					&systemMask))
+			mask &= processMask;
+
+		if (!mask)
+			Warning(L"ConfigureThread: affinity mask 0x%llX does "
+			        L"not intersect the process affinity",
+			        config.affinityMask);
+		else if (!(state.affinity = SetThreadAffinityMask(thread,
+							mask)))
+			Warning(L"ConfigureThread: SetThreadAffinityMask "
+			        L"failed (%lu)", GetLastError());
+	}
+
+	if (config.priority != ThreadPriority::Default &&
+	    !SetThreadPriority(thread, GetWindowsPriority(config.priority)))
+		Warning(L"ConfigureThread: SetThreadPriority failed (%lu)",
+				GetLastError());
+}
+
+void RestoreThread(ThreadState &state)
+{
+	if (state.thread) {
+		/* fails harmlessly if the thread has already exited */
+		if (state.affinity)
+			SetThreadAffinityMask(state.thread, state.affinity);
+		SetThreadPriority(state.thread, state.priority);
+		CloseHandle(state.thread);
+	}
+
+	state = ThreadState();
+}
+
+HANDLE EnterMMCSS(const Config &config)
+{
+	if (!config.useMMCSS)
+		return nullptr;
+
+	DWORD taskIndex = 0;
+	HANDLE mmcss = AvSetMmThreadCharacteristicsW(L"Capture", &taskIndex);
+	if (!mmcss)
+		Warning(L"EnterMMCSS: Could not register thread with MMCSS "
+		        L"(%lu)", GetLastError());
+	return mmcss;
+}
+
+void LeaveMMCSS(HANDLE mmcss)
+{
+	if (mmcss)
+		AvRevertMmThreadCharacteristics(mmcss);
+}
+
+int GetAffinityNumaNode(unsigned long long affinityMask)
+{
+	UCHAR processor = 0;
+	UCHAR node;
+
+	if (!affinityMask)
+		return -1;
+
+	while (!(affinityMask & 1)) {
+		affinityMask >>= 1;
+		processor++;
+	}
+
+	if (!GetNumaProcessorNode(processor, &node) || node == 0xFF)
+		return -1;
+
+	return (int)node;
+}
+
+}; /* namespace DShow */
@@ -0,0 +1,68 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+
+#pragma once
+
+#include "../dshowcapture.hpp"
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+namespace DShow {
+
+/** What ConfigureThread changed on a thread, so that it can be undone */
+struct ThreadState {
+	DWORD     id       = 0;
+	HANDLE    thread   = nullptr; /* null if nothing was changed */
+	int       priority = THREAD_PRIORITY_NORMAL;
+	DWORD_PTR affinity = 0;       /* 0 if the affinity was not changed */
+};
+
+/**
+ * Applies the affinity and priority settings of a stream config to the
+ * calling thread.  Used on the threads that deliver samples to us, which
+ * are owned by the upstream filters rather than by the library.  Those are
+ * not registered with MMCSS: the registration can only be undone on the
+ * thread itself, and the filter may have registered it already.
+ */
+void ConfigureThread(const Config &config, ThreadState &state);
+
+/**
+ * Undoes ConfigureThread, so that a thread the upstream filter reuses does
+ * not keep the capture scheduling.  May be called from any thread once the
+ * thread has stopped delivering samples.
+ */
+void RestoreThread(ThreadState &state);
+
+/**
+ * Registers the calling thread with the MMCSS "Capture" task if the config
+ * asks for it.  For the library's own threads; the result must be passed
+ * to LeaveMMCSS on the same thread.
+ */
+HANDLE EnterMMCSS(const Config &config);
+void LeaveMMCSS(HANDLE mmcss);
+
+/**
+ * Gets the NUMA node of the first processor in an affinity mask, or -1 if
+ * there is no mask or the node cannot be determined.
+ */
+int GetAffinityNumaNode(unsigned long long affinityMask);
+
+}; /* namespace DShow */
@@ -20,16 +20,21 @@
 #include "../dshowcapture.hpp"
 #include "dshow-base.hpp"
 #include "dshow-enum.hpp"
+#include "mode-probe.hpp"
 #include "device.hpp"
+#include "buffer-pool.hpp"
 #include "dshow-device-defs.hpp"
 #include "log.hpp"
 
+#include <mutex>
 #include <vector>
 
 namespace DShow {
 
-Device::Device(InitGraph initialize) : context(new HDevice)
+Device::Device(InitGraph initialize) : context(new HDevice(this))
 {
+	AddPoolOwner(this);
+
 	if (initialize == InitGraph::True)
 		context->CreateGraph();
 }
@@ -37,6 +42,7 @@ Device::Device(InitGraph initialize) : context(new HDevice)
 Device::~Device()
 {
 	delete context;
+	RemovePoolOwner(this);
 }
 
 bool Device::Valid() const
@@ -44,19 +50,28 @@ bool Device::Valid() const
 	return context->initialized;
 }
 
+/* pool usage is accounted to the device itself, so the budget and the
+ * current/peak usage carry over to the new graph */
+static void RecreateContext(const Device *owner, HDevice *&context)
+{
+	DowngradePolicy policy = context->downgradePolicy;
+
+	delete context;
+	context = new HDevice(owner);
+	context->downgradePolicy = policy;
+}
+
 bool Device::ResetGraph()
 {
 	/* cheap and easy way to clear all the filters */
-	delete context;
-	context = new HDevice;
+	RecreateContext(this, context);
 
 	return context->CreateGraph();
 }
 
 void Device::ShutdownGraph()
 {
-	delete context;
-	context = new HDevice;
+	RecreateContext(this, context);
 }
 
 bool Device::SetVideoConfig(VideoConfig *config)
@@ -89,7 +104,18 @@ bool Device::GetVideoConfig(VideoConfig &config) const
 	if (context->videoCapture == NULL)
 		return false;
 
-	config = context->videoConfig;
+	/* mode switches rewrite the config on the governor thread, so copy
+	 * it under the config lock.  The streaming thread only changes the
+	 * format fields, which come from the published snapshot */
+	std::lock_guard<std::recursive_mutex> lock(context->configMutex);
+	VideoStreamFormat format = context->videoFormat.Read();
+
+	config                = context->videoConfig;
+	config.cx             = format.cx;
+	config.cy             = format.cy;
+	config.frameInterval  = format.frameInterval;
+	config.internalFormat = format.internalFormat;
+	config.format         = format.format;
 	return true;
 }
 
@@ -98,7 +124,40 @@ bool Device::GetAudioConfig(AudioConfig &config) const
 	if (context->audioCapture == NULL)
 		return false;
 
-	config = context->audioConfig;
+	std::lock_guard<std::recursive_mutex> lock(context->configMutex);
+	AudioStreamFormat format = context->audioFormat.Read();
+
+	config            = context->audioConfig;
+	config.sampleRate = format.sampleRate;
+	config.channels   = format.channels;
+	config.format     = format.format;
+	return true;
+}
+
+bool Device::GetVideoFormat(VideoStreamFormat &format) const
+{
+	if (context->videoCapture == NULL)
+		return false;
+
+	format = context->videoFormat.Read();
+	return true;
+}
+
+bool Device::GetAudioFormat(AudioStreamFormat &format) const
+{
+	if (context->audioCapture == NULL)
+		return false;
+
+	format = context->audioFormat.Read();
+	return true;
+}
+
+bool Device::GetSignalStatus(SignalStatus &status) const
+{
+	if (context->videoCapture == NULL || !context->signalQC.Active())
+		return false;
+
+	status = context->signalQC.GetStatus();
 	return true;
 }
 
@@ -120,6 +179,72 @@ bool Device::GetAudioDeviceId(DeviceId &id) const
 	return true;
 }
 
+bool Device::GetBufferUsage(BufferUsage &usage) const
+{
+	GetPoolUsage(this, usage);
+	return true;
+}
+
+bool Device::GetMemoryUsage(MemoryUsage &usage) const
+{
+	GetPoolUsage(this, usage);
+	return true;
+}
+
+void Device::SetMemoryBudget(size_t bytes)
+{
+	SetPoolBudget(this, bytes);
+}
+
+void Device::SetDowngradePolicy(const DowngradePolicy &policy)
+{
+	/* Start reads it under the lock; a running governor keeps the
+	 * policy it was started with */
+	std::lock_guard<std::recursive_mutex> lock(context->configMutex);
+	context->downgradePolicy = policy;
+}
+
+bool Device::GetControls(ControlSnapshot &snapshot) const
+{
+	return context->controls.Get(snapshot);
+}
+
+bool Device::SetControl(VideoControl control, long value, bool autoMode)
+{
+	return context->controls.Set(control, value, autoMode);
+}
+
+void Device::RefreshControls()
+{
+	context->controls.Refresh();
+}
+
+bool Device::GetVideoAllocatorInfo(AllocatorInfo &info) const
+{
+	if (context->videoCapture == NULL)
+		return false;
+
+	return context->videoCapture->GetPin()->GetAllocatorInfo(info);
+}
+
+bool Device::GetAudioAllocatorInfo(AllocatorInfo &info) const
+{
+	if (context->audioCapture == NULL)
+		return false;
+
+	return context->audioCapture->GetPin()->GetAllocatorInfo(info);
+}
+
+bool Device::StartRecording(const RecordConfig &config)
+{
+	return context->StartRecording(config);
+}
+
+void Device::StopRecording()
+{
+	context->StopRecording();
+}
+
 static void OpenPropertyPages(HWND hwnd, IUnknown *propertyObject)
 {
 	if (!propertyObject)
@@ -278,6 +403,12 @@ bool Device::EnumVideoDevices(std::vector<VideoDevice> &devices)
 			EnumDeviceCallback(EnumVideoDevice), &devices);
 }
 
+bool Device::ProbeVideoModes(const DeviceId &device,
+		vector<VideoModeProbe> &modes, unsigned int durationMs)
+{
+	return RunModeProbes(device, modes, durationMs);
+}
+
 static bool EnumAudioDevice(vector<AudioDevice> &devices,
 		IBaseFilter *filter,
 		const wchar_t *deviceName,
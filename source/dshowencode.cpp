@@ -55,8 +55,15 @@ bool VideoEncoder::ResetGraph()
 bool VideoEncoder::SetConfig(VideoEncoderConfig &config)
 {
 	if (context->active) {
+		BitrateControlConfig control;
+		{
+			lock_guard<mutex> lock(context->bitrateMutex);
+			control = context->bitrateControl.Config();
+		}
+
 		delete context;
 		context = new HVideoEncoder;
+		context->SetBitrateControl(control);
 	}
 
 	return context->SetConfig(config);
@@ -67,10 +74,33 @@ bool VideoEncoder::GetConfig(VideoEncoderConfig &config) const
 	if (context->encoder == nullptr)
 		return false;
 
+	lock_guard<mutex> lock(context->bitrateMutex);
 	config = context->config;
 	return true;
 }
 
+bool VideoEncoder::SetBitrateControl(const BitrateControlConfig &config)
+{
+	if (config.minBitrate <= 0 || config.maxBitrate < config.minBitrate ||
+	    config.headroom <= 0.0) {
+		Warning(L"VideoEncoder::SetBitrateControl: Invalid bounds");
+		return false;
+	}
+
+	context->SetBitrateControl(config);
+	return true;
+}
+
+void VideoEncoder::UpdateNetworkStats(int bandwidth, long long queueDuration)
+{
+	context->UpdateNetworkStats(bandwidth, queueDuration);
+}
+
+int VideoEncoder::GetBitrate() const
+{
+	return context->GetBitrate();
+}
+
 bool VideoEncoder::Encode(unsigned char *data[DSHOW_MAX_PLANES],
 		size_t linesize[DSHOW_MAX_PLANES],
 		long long timestampStart, long long timestampEnd,
@@ -18,6 +18,7 @@
  */
 
 #include "encoder.hpp"
+#include "alloc-tracker.hpp"
 #include "log.hpp"
 #include "avermedia-encode.h"
 
@@ -26,6 +27,8 @@ namespace DShow {
 HVideoEncoder::HVideoEncoder()
 {
 	initialized = CreateFilterGraph(&graph, &builder, &control);
+	if (initialized)
+		AddPoolOwner(this);
 }
 
 HVideoEncoder::~HVideoEncoder()
@@ -40,6 +43,8 @@ HVideoEncoder::~HVideoEncoder()
 	if (active)
 		control->Stop();
 
+	pins.Clear();
+
 	/* seems like you have to manually release the entire graph otherwise
 	 * the encoder device might not end up releasing properly */
 	hr = graph->EnumFilters(&filterEnum);
@@ -50,6 +55,10 @@ HVideoEncoder::~HVideoEncoder()
 			filter->Release();
 		}
 	}
+
+	packets.clear();
+	curPacket.data.Free();
+	RemovePoolOwner(this);
 }
 
 bool HVideoEncoder::ConnectFilters()
@@ -61,27 +70,28 @@ bool HVideoEncoder::ConnectFilters()
 	bool success;
 	HRESULT hr;
 
-	success = GetPinByName(device, PINDIR_INPUT, L"YUV In", &deviceIn);
+	success = pins.GetPinByName(device, PINDIR_INPUT, L"YUV In", &deviceIn);
 	if (!success) {
 		Warning(L"Failed to get YUV In pin");
 		return false;
 	}
 
-	success = GetPinByName(device, PINDIR_OUTPUT, L"Virtual Video Out",
+	success = pins.GetPinByName(device, PINDIR_OUTPUT, L"Virtual Video Out",
 			&deviceOut);
 	if (!success) {
 		Warning(L"Failed to get Virtual Video Out pin");
 		return false;
 	}
 
-	success = GetPinByName(encoder, PINDIR_INPUT, L"Virtual Video In",
+	success = pins.GetPinByName(encoder, PINDIR_INPUT, L"Virtual Video In",
 			&encoderIn);
 	if (!success) {
 		Warning(L"Failed to get encoder input pin");
 		return false;
 	}
 
-	success = GetPinByName(encoder, PINDIR_OUTPUT, nullptr, &encoderOut);
+	success = pins.GetPinByName(encoder, PINDIR_OUTPUT, nullptr,
+			&encoderOut);
 	if (!success) {
 		Warning(L"Failed to get encoder output pin");
 		return false;
@@ -138,7 +148,8 @@ bool HVideoEncoder::SetupCrossbar()
 	if (config.name.find(L"C353") != std::string::npos)
 		return true;
 
-	if (!GetPinByName(device, PINDIR_INPUT, L"Analog Video In", &pin)) {
+	if (!pins.GetPinByName(device, PINDIR_INPUT, L"Analog Video In",
+				&pin)) {
 		Warning(L"Failed to get Analog Video In pin");
 		return false;
 	}
@@ -206,11 +217,11 @@ bool HVideoEncoder::SetupEncoder(IBaseFilter *filter)
 	MediaTypePtr                   mtRaw;
 	MediaTypePtr                   mtEncoded;
 
-	if (!GetPinByName(filter, PINDIR_INPUT, nullptr, &inputPin)) {
+	if (!pins.GetPinByName(filter, PINDIR_INPUT, nullptr, &inputPin)) {
 		Warning(L"Could not get encoder input pin");
 		return false;
 	}
-	if (!GetPinByName(filter, PINDIR_OUTPUT, nullptr, &outputPin)) {
+	if (!pins.GetPinByName(filter, PINDIR_OUTPUT, nullptr, &outputPin)) {
 		Warning(L"Could not get encoder output pin");
 		return false;
 	}
@@ -226,7 +237,8 @@ bool HVideoEncoder::SetupEncoder(IBaseFilter *filter)
 		Warning(L"Could not get device filter from medium");
 		return false;
 	}
-	if (!GetPinByName(deviceFilter, PINDIR_INPUT, L"YUV In", &inputPin)) {
+	if (!pins.GetPinByName(deviceFilter, PINDIR_INPUT, L"YUV In",
+				&inputPin)) {
 		Warning(L"Could not device YUV pin");
 		return false;
 	}
@@ -240,7 +252,8 @@ bool HVideoEncoder::SetupEncoder(IBaseFilter *filter)
 	}
 
 	PinCaptureInfo captureInfo;
-	captureInfo.callback           = [this] (IMediaSample *s) {Receive(s);};
+	captureInfo.callback           = ReceiveSample;
+	captureInfo.param              = this;
 	captureInfo.expectedMajorType  = mtEncoded->majortype;
 	captureInfo.expectedSubType    = mtEncoded->subtype;
 
@@ -353,6 +366,12 @@ bool HVideoEncoder::SetConfig(VideoEncoderConfig &config)
 	ComPtr<IBaseFilter> filter;
 	ComPtr<IBaseFilter> crossbar;
 
+	if (active) {
+		Warning(L"Video encoder is already running, create a new "
+		        L"encoder to change its configuration");
+		return false;
+	}
+
 	if (config.name.empty() && config.path.empty()) {
 		Warning(L"No video encoder name or path specified");
 		return false;
@@ -371,7 +390,13 @@ bool HVideoEncoder::SetConfig(VideoEncoderConfig &config)
 		return false;
 	}
 
-	this->config = config;
+	{
+		/* the bitrate is shared with UpdateNetworkStats and
+		 * GetBitrate */
+		lock_guard<mutex> lock(bitrateMutex);
+		this->config = config;
+		bitrateControl.Reset(bitrateControl.Config(), config.bitrate);
+	}
 
 	if (!SetupEncoder(filter)) {
 		Warning(L"Failed to set up encoder");
@@ -398,15 +423,79 @@ bool HVideoEncoder::SetConfig(VideoEncoderConfig &config)
 		return false;
 	}
 
+	lock_guard<mutex> lock(bitrateMutex);
 	active = true;
 	return true;
 }
 
+void HVideoEncoder::SetBitrateControl(const BitrateControlConfig &control)
+{
+	lock_guard<mutex> lock(bitrateMutex);
+	bitrateControl.Reset(control, active ? config.bitrate : 0);
+}
+
+void HVideoEncoder::UpdateNetworkStats(int bandwidth, long long queueDuration)
+{
+	long long now = (long long)GetTickCount64() * 10000;
+	int oldBitrate, newBitrate;
+
+	/* keeps the driver and config.bitrate in step when called from
+	 * several threads */
+	lock_guard<mutex> updateLock(updateMutex);
+
+	{
+		lock_guard<mutex> lock(bitrateMutex);
+
+		if (!active || !bitrateControl.Update(bandwidth,
+					queueDuration, now, newBitrate))
+			return;
+
+		oldBitrate = config.bitrate;
+	}
+
+	/* the driver call can take a while; GetBitrate and GetConfig must
+	 * not wait for it */
+	ComQIPtr<IKsPropertySet> propertySet(device);
+	HRESULT hr = E_NOINTERFACE;
+
+	if (propertySet)
+		hr = SetAVMEncoderSetting(propertySet,
+				AVER_PARAMETER_ENCODE_BIT_RATE,
+				ULONG(newBitrate), 0);
+
+	lock_guard<mutex> lock(bitrateMutex);
+
+	if (FAILED(hr)) {
+		WarningHR(L"Failed to change Avermedia encoder bitrate", hr);
+		bitrateControl.SetBitrate(config.bitrate);
+		return;
+	}
+
+	Debug(L"Encoder bitrate changed from %d to %d kbps (bandwidth: %d, "
+	      L"queue: %lldms)", oldBitrate, newBitrate, bandwidth,
+	      queueDuration / 10000);
+
+	config.bitrate = newBitrate;
+}
+
+int HVideoEncoder::GetBitrate()
+{
+	lock_guard<mutex> lock(bitrateMutex);
+	return config.bitrate;
+}
+
+void HVideoEncoder::ReceiveSample(void *param, IMediaSample *s)
+{
+	reinterpret_cast<HVideoEncoder*>(param)->Receive(s);
+}
+
 void HVideoEncoder::Receive(IMediaSample *s)
 {
 	BYTE *data;
 	size_t size;
 
+	ALLOC_SCOPE("encode-output");
+
 	if (FAILED(s->GetPointer(&data)))
 		return;
 
@@ -415,7 +504,7 @@ void HVideoEncoder::Receive(IMediaSample *s)
 		return;
 
 	packetMutex.lock();
-	packets.emplace_back(data, size);
+	packets.emplace_back(this, data, size);
 	packetMutex.unlock();
 }
 
@@ -429,6 +518,8 @@ bool HVideoEncoder::Encode(unsigned char *data[DSHOW_MAX_PLANES],
 	if (!active)
 		return false;
 
+	ALLOC_SCOPE("encode");
+
 	output->Send(data, linesize, timestampStart, timestampEnd);
 	ptsVals.push_back(timestampStart);
 
@@ -439,8 +530,8 @@ bool HVideoEncoder::Encode(unsigned char *data[DSHOW_MAX_PLANES],
 		packets.pop_front();
 		ptsVals.pop_front();
 
-		packet.data = curPacket.data.data();
-		packet.size = curPacket.data.size();
+		packet.data = curPacket.data.Data();
+		packet.size = curPacket.data.Size();
 		packet.pts  = ptsOut;
 		packet.dts  = ptsOut;
 		new_packet  = true;
@@ -22,6 +22,9 @@
 #include "../dshowcapture.hpp"
 #include "output-filter.hpp"
 #include "capture-filter.hpp"
+#include "buffer-pool.hpp"
+#include "bitrate-control.hpp"
+#include "pin-cache.hpp"
 
 #include <string>
 #include <vector>
@@ -30,14 +33,15 @@
 using namespace std;
 
 struct EncodedData {
-	vector<unsigned char>          data;
+	DShow::PoolBuffer              data;
 
 	inline EncodedData() {}
 
-	inline EncodedData(unsigned char *data_, size_t size)
+	inline EncodedData(const void *owner, unsigned char *data_,
+			size_t size)
+		: data(owner, DShow::MemorySubsystem::Packets)
 	{
-		data.resize(size);
-		memcpy(data.data(), data_, size);
+		data.Append(data_, size);
 	}
 };
 
@@ -52,6 +56,7 @@ struct HVideoEncoder {
 	ComPtr<IBaseFilter>            device;
 	ComPtr<OutputFilter>           output;
 	ComPtr<CaptureFilter>          capture;
+	PinCache                       pins;
 
 	VideoEncoderConfig             config;
 
@@ -61,6 +66,10 @@ struct HVideoEncoder {
 
 	deque<long long>               ptsVals;
 
+	mutex                          bitrateMutex;
+	mutex                          updateMutex; /* one change at a time */
+	BitrateController              bitrateControl;
+
 	bool                           initialized = false;
 	bool                           active = false;
 
@@ -70,6 +79,7 @@ struct HVideoEncoder {
 	bool SetupCrossbar();
 
 	void Receive(IMediaSample *s);
+	static void ReceiveSample(void *param, IMediaSample *s);
 
 	bool ConnectFilters();
 
@@ -78,6 +88,10 @@ struct HVideoEncoder {
 
 	bool SetConfig(VideoEncoderConfig &config);
 
+	void SetBitrateControl(const BitrateControlConfig &config);
+	void UpdateNetworkStats(int bandwidth, long long queueDuration);
+	int GetBitrate();
+
 	bool Encode(unsigned char *frame[DSHOW_MAX_PLANES],
 			size_t linesize[DSHOW_MAX_PLANES],
 			long long timestampStart, long long timestampEnd,
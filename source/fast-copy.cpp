@@ -0,0 +1,118 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+
+#include "fast-copy.hpp"
+#include "worker-pool.hpp"
+
+#include <string.h>
+#include <stdint.h>
+
+#ifdef DSHOW_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace DShow {
+
+/* below this, the destination is likely to be read again soon anyway and
+ * regular stores are faster */
+#define STREAMING_COPY_THRESHOLD  (256 * 1024)
+#define PARALLEL_COPY_THRESHOLD   (4 * 1024 * 1024)
+#define PARALLEL_COPY_CHUNK       (1024 * 1024)
+
+static void StreamingCopy(void *dst_, const void *src_, size_t size)
+{
+#ifdef DSHOW_SSE2
+	uint8_t       *dst = (uint8_t*)dst_;
+	const uint8_t *src = (const uint8_t*)src_;
+
+	size_t head = (16 - ((uintptr_t)dst & 15)) & 15;
+	if (head > size)
+		head = size;
+
+	memcpy(dst, src, head);
+	dst  += head;
+	src  += head;
+	size -= head;
+
+	size_t blocks = size / 64;
+
+	for (size_t i = 0; i < blocks; i++) {
+		__m128i a = _mm_loadu_si128((const __m128i*)(src));
+		__m128i b = _mm_loadu_si128((const __m128i*)(src + 16));
+		__m128i c = _mm_loadu_si128((const __m128i*)(src + 32));
+		__m128i d = _mm_loadu_si128((const __m128i*)(src + 48));
+		_mm_stream_si128((__m128i*)(dst),      a);
+		_mm_stream_si128((__m128i*)(dst + 16), b);
+		_mm_stream_si128((__m128i*)(dst + 32), c);
+		_mm_stream_si128((__m128i*)(dst + 48), d);
+		src += 64;
+		dst += 64;
+	}
+
+	/* streaming stores are weakly ordered; make them visible before the
+	 * buffer is handed to anything else */
+	_mm_sfence();
+
+	memcpy(dst, src, size - blocks * 64);
+#else
+	memcpy(dst_, src_, size);
+#endif
+}
+
+struct CopyJob {
+	uint8_t       *dst;
+	const uint8_t *src;
+	size_t        size;
+};
+
+static void CopyChunk(void *param, size_t index)
+{
+	CopyJob &job    = *reinterpret_cast<CopyJob*>(param);
+	size_t  offset  = index * PARALLEL_COPY_CHUNK;
+	size_t  size    = job.size - offset;
+
+	if (size > PARALLEL_COPY_CHUNK)
+		size = PARALLEL_COPY_CHUNK;
+
+	StreamingCopy(job.dst + offset, job.src + offset, size);
+}
+
+void FastCopy(void *dst, const void *src, size_t size)
+{
+	if (size < STREAMING_COPY_THRESHOLD) {
+		memcpy(dst, src, size);
+		return;
+	}
+
+	WorkerPool &pool = GetWorkerPool();
+
+	if (size < PARALLEL_COPY_THRESHOLD || !pool.ThreadCount()) {
+		StreamingCopy(dst, src, size);
+		return;
+	}
+
+	CopyJob job = {(uint8_t*)dst, (const uint8_t*)src, size};
+	size_t  chunks = (size + PARALLEL_COPY_CHUNK - 1) /
+		PARALLEL_COPY_CHUNK;
+
+	pool.Run(CopyChunk, &job, chunks);
+}
+
+}; /* namespace DShow */
@@ -0,0 +1,40 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+
+#pragma once
+
+#include <stddef.h>
+
+#if defined(_M_X64) || defined(__SSE2__) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DSHOW_SSE2 1
+#endif
+
+namespace DShow {
+
+/**
+ * Copies large buffers such as whole frames.  Above a threshold it uses
+ * non-temporal stores so the destination doesn't evict the caller's working
+ * set from the cache, and very large copies are split across the worker
+ * pool.  Small copies simply use memcpy.
+ */
+void FastCopy(void *dst, const void *src, size_t size);
+
+}; /* namespace DShow */
@@ -0,0 +1,549 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+#include "h264-decoder.hpp"
+#include "h264-nal.hpp"
+#include "dshow-thread.hpp"
+#include "log.hpp"
+
+#include <mfapi.h>
+#include <mferror.h>
+#include <mftransform.h>
+#include <codecapi.h>
+#include <wmcodecdsp.h>
+#include <stdlib.h>
+#include <string.h>
+
+#pragma comment(lib, "mfplat.lib")
+#pragma comment(lib, "mfuuid.lib")
+
+using namespace std;
+
+namespace DShow {
+
+H264Decoder::H264Decoder(const void *owner_)
+	: owner (owner_)
+{
+	frame.SetOwner(owner, MemorySubsystem::Decoding);
+}
+
+H264Decoder::~H264Decoder()
+{
+	Stop();
+}
+
+void H264Decoder::Start(const VideoConfig &config_)
+{
+	Stop();
+
+	if (!config_.sampleCallback && !config_.callback)
+		return;
+
+	if (config_.decodeFormat != VideoFormat::NV12 &&
+	    config_.decodeFormat != VideoFormat::I420) {
+		Warning(L"H264Decoder: Only NV12 and I420 output is "
+		        L"supported, using NV12");
+	}
+
+	config                  = config_;
+	outputConfig            = config_;
+	outputConfig.format     = config_.decodeFormat == VideoFormat::I420 ?
+		VideoFormat::I420 : VideoFormat::NV12;
+	outputConfig.internalFormat = outputConfig.format;
+
+	maxQueued     = config.decodeQueueFrames > 0 ?
+		(size_t)config.decodeQueueFrames : 1;
+	waitKeyframe  = true;
+	discontinuity = false;
+	warnedDrop    = false;
+	stopping      = false;
+
+	frame.SetOwner(owner, MemorySubsystem::Decoding);
+
+	started = false;
+	ready   = false;
+	thread  = std::thread(&H264Decoder::DecodeThread, this);
+
+	/* the transform is created on the decode thread (which owns the
+	 * COM/MF init); only take frames once it exists, so none are queued
+	 * to a decoder that failed to start */
+	{
+		unique_lock<mutex> lock(queueMutex);
+		readyCond.wait(lock, [this] ()
+		{
+			return started;
+		});
+	}
+
+	if (!ready) {
+		thread.join();
+		return;
+	}
+
+	active = true;
+}
+
+void H264Decoder::Stop()
+{
+	active = false;
+
+	if (thread.joinable()) {
+		{
+			lock_guard<mutex> lock(queueMutex);
+			stopping = true;
+		}
+
+		queueCond.notify_one();
+		thread.join();
+	}
+
+	queue.clear();
+	freePackets.clear();
+	frame.Free();
+	waitKeyframe  = true;
+	discontinuity = false;
+}
+
+void H264Decoder::Push(const unsigned char *data, size_t size,
+		long long startTime, long long stopTime)
+{
+	{
+		lock_guard<mutex> lock(queueMutex);
+
+		/* a late decoder only adds latency; drop what is waiting and
+		 * start over at the next keyframe */
+		if (queue.size() >= maxQueued) {
+			if (!warnedDrop)
+				Warning(L"H264Decoder: Decoder is falling "
+				        L"behind, dropping frames");
+
+			while (!queue.empty()) {
+				freePackets.push_back(move(queue.front()));
+				queue.pop_front();
+			}
+
+			warnedDrop    = true;
+			waitKeyframe  = true;
+			discontinuity = true;
+		}
+
+		if (waitKeyframe) {
+			if (!IsKeyframe(data, size))
+				return;
+			waitKeyframe = false;
+		}
+
+		Packet packet;
+		if (!freePackets.empty()) {
+			packet = move(freePackets.back());
+			freePackets.pop_back();
+		} else {
+			packet.data.SetOwner(owner, MemorySubsystem::Decoding);
+		}
+
+		packet.startTime     = startTime;
+		packet.stopTime      = stopTime;
+		packet.discontinuity = discontinuity;
+		packet.data.Clear();
+		if (!packet.data.Append(data, size)) {
+			freePackets.push_back(move(packet));
+			waitKeyframe = true;
+			return;
+		}
+
+		discontinuity = false;
+		queue.push_back(move(packet));
+	}
+
+	queueCond.notify_one();
+}
+
+bool H264Decoder::CreateTransform()
+{
+	ComPtr<IMFAttributes> attributes;
+	ComPtr<IMFMediaType>  inputType;
+	HRESULT hr;
+
+	hr = CoCreateInstance(CLSID_CMSH264DecoderMFT, nullptr,
+			CLSCTX_INPROC_SERVER, IID_IMFTransform,
+			(void**)&transform);
+	if (FAILED(hr)) {
+		ErrorHR(L"H264Decoder: Failed to create the decoder", hr);
+		return false;
+	}
+
+	/* deliver each frame as soon as it is decoded instead of holding
+	 * frames back for reordering */
+	if (SUCCEEDED(transform->GetAttributes(&attributes))) {
+		attributes->SetUINT32(CODECAPI_AVLowLatencyMode, TRUE);
+		if (config.decodeThreads > 0)
+			attributes->SetUINT32(CODECAPI_AVDecNumWorkerThreads,
+					(UINT32)config.decodeThreads);
+	}
+
+	hr = MFCreateMediaType(&inputType);
+	if (FAILED(hr)) {
+		ErrorHR(L"H264Decoder: Failed to create the input type", hr);
+		return false;
+	}
+
+	inputType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
+	inputType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_H264);
+	if (config.cx > 0 && config.cy != 0)
+		MFSetAttributeSize(inputType, MF_MT_FRAME_SIZE,
+				(UINT32)config.cx, (UINT32)abs(config.cy));
+	if (config.frameInterval > 0)
+		MFSetAttributeRatio(inputType, MF_MT_FRAME_RATE, 10000000,
+				(UINT32)config.frameInterval);
+
+	hr = transform->SetInputType(0, inputType, 0);
+	if (FAILED(hr)) {
+		ErrorHR(L"H264Decoder: Failed to set the input type", hr);
+		return false;
+	}
+
+	if (!SetOutputType())
+		return false;
+
+	transform->ProcessMessage(MFT_MESSAGE_NOTIFY_BEGIN_STREAMING, 0);
+	transform->ProcessMessage(MFT_MESSAGE_NOTIFY_START_OF_STREAM, 0);
+	return true;
+}
+
+bool H264Decoder::SetOutputType()
+{
+	for (DWORD i = 0;; i++) {
+		ComPtr<IMFMediaType> type;
+		GUID subtype;
+
+		if (FAILED(transform->GetOutputAvailableType(0, i, &type)))
+			break;
+		if (FAILED(type->GetGUID(MF_MT_SUBTYPE, &subtype)) ||
+		    subtype != MFVideoFormat_NV12)
+			continue;
+
+		HRESULT hr = transform->SetOutputType(0, type, 0);
+		if (FAILED(hr)) {
+			ErrorHR(L"H264Decoder: Failed to set the output type",
+					hr);
+			return false;
+		}
+
+		UINT32 cx = 0, cy = 0;
+		MFGetAttributeSize(type, MF_MT_FRAME_SIZE, &cx, &cy);
+		frameCX = (int)cx;
+		frameCY = (int)cy;
+
+		/* the frame size is rounded up to whole macroblocks; the
+		 * stream's cropping is given as the display aperture */
+		MFVideoArea area = {};
+		UINT32 areaSize = 0;
+		HRESULT hrArea = type->GetBlob(MF_MT_MINIMUM_DISPLAY_APERTURE,
+				(UINT8*)&area, sizeof(area), &areaSize);
+
+		if (SUCCEEDED(hrArea) && areaSize == sizeof(area) &&
+		    area.Area.cx > 0 && area.Area.cy > 0 &&
+		    area.OffsetX.value >= 0 && area.OffsetY.value >= 0 &&
+		    area.OffsetX.value + area.Area.cx <= frameCX &&
+		    area.OffsetY.value + area.Area.cy <= frameCY) {
+			displayX  = area.OffsetX.value & ~1;
+			displayY  = area.OffsetY.value & ~1;
+			displayCX = (int)area.Area.cx;
+			displayCY = (int)area.Area.cy;
+		} else {
+			displayX  = 0;
+			displayY  = 0;
+			displayCX = frameCX;
+			displayCY = frameCY;
+		}
+
+		MFT_OUTPUT_STREAM_INFO info = {};
+		transform->GetOutputStreamInfo(0, &info);
+		providesSamples = (info.dwFlags &
+				(MFT_OUTPUT_STREAM_PROVIDES_SAMPLES |
+				 MFT_OUTPUT_STREAM_CAN_PROVIDE_SAMPLES)) != 0;
+		outputSize = info.cbSize;
+
+		/* the output size may have changed */
+		outputSample.Clear();
+		outputBuffer.Clear();
+		return true;
+	}
+
+	Error(L"H264Decoder: Decoder has no NV12 output");
+	return false;
+}
+
+bool H264Decoder::Decode(const Packet &packet)
+{
+	ComPtr<IMFMediaBuffer> buffer;
+	ComPtr<IMFSample>      sample;
+	DWORD size = (DWORD)packet.data.Size();
+	BYTE *ptr;
+	HRESULT hr;
+
+	/* the decoder may keep a reference to its input, so every frame
+	 * gets its own sample */
+	hr = MFCreateMemoryBuffer(size, &buffer);
+	if (SUCCEEDED(hr))
+		hr = MFCreateSample(&sample);
+	if (SUCCEEDED(hr))
+		hr = sample->AddBuffer(buffer);
+	if (SUCCEEDED(hr))
+		hr = buffer->Lock(&ptr, nullptr, nullptr);
+	if (FAILED(hr)) {
+		WarningHR(L"H264Decoder: Failed to create input sample", hr);
+		return false;
+	}
+
+	memcpy(ptr, packet.data.Data(), size);
+	buffer->Unlock();
+	buffer->SetCurrentLength(size);
+
+	sample->SetSampleTime(packet.startTime);
+	sample->SetSampleDuration(packet.stopTime - packet.startTime);
+	if (packet.discontinuity)
+		sample->SetUINT32(MFSampleExtension_Discontinuity, TRUE);
+
+	hr = transform->ProcessInput(0, sample, 0);
+	if (hr == MF_E_NOTACCEPTING) {
+		if (!DrainOutput())
+			return false;
+		hr = transform->ProcessInput(0, sample, 0);
+	}
+
+	if (FAILED(hr)) {
+		WarningHR(L"H264Decoder: ProcessInput failed", hr);
+		return false;
+	}
+
+	return DrainOutput();
+}
+
+bool H264Decoder::DrainOutput()
+{
+	for (;;) {
+		MFT_OUTPUT_DATA_BUFFER output = {};
+		DWORD status = 0;
+		HRESULT hr;
+
+		if (!providesSamples) {
+			if (!outputSample) {
+				hr = MFCreateMemoryBuffer(outputSize,
+						&outputBuffer);
+				if (SUCCEEDED(hr))
+					hr = MFCreateSample(&outputSample);
+				if (SUCCEEDED(hr))
+					hr = outputSample->AddBuffer(
+							outputBuffer);
+				if (FAILED(hr)) {
+					outputSample.Clear();
+					WarningHR(L"H264Decoder: Failed to "
+					          L"create output sample", hr);
+					return false;
+				}
+			}
+
+			outputBuffer->SetCurrentLength(0);
+			output.pSample = outputSample;
+		}
+
+		hr = transform->ProcessOutput(0, 1, &output, &status);
+
+		if (output.pEvents)
+			output.pEvents->Release();
+
+		if (hr == MF_E_TRANSFORM_NEED_MORE_INPUT)
+			return true;
+
+		if (hr == MF_E_TRANSFORM_STREAM_CHANGE) {
+			if (!SetOutputType())
+				return false;
+			continue;
+		}
+
+		if (FAILED(hr)) {
+			WarningHR(L"H264Decoder: ProcessOutput failed", hr);
+			return false;
+		}
+
+		if (output.pSample)
+			Deliver(output.pSample);
+		if (providesSamples && output.pSample)
+			output.pSample->Release();
+	}
+}
+
+static void CopyNV12(unsigned char *out, const BYTE *y, const BYTE *uv,
+		LONG pitch, int cx, int cy)
+{
+	int uvRows = (cy + 1) / 2;
+	int uvCX   = (cx + 1) & ~1;
+
+	for (int row = 0; row < cy; row++)
+		memcpy(out + row * cx, y + row * pitch, cx);
+
+	out += cx * cy;
+	for (int row = 0; row < uvRows; row++)
+		memcpy(out + row * uvCX, uv + row * pitch, uvCX);
+}
+
+static void CopyI420(unsigned char *out, const BYTE *y, const BYTE *uv,
+		LONG pitch, int cx, int cy)
+{
+	int uvRows = (cy + 1) / 2;
+	int uvCX   = (cx + 1) / 2;
+	unsigned char *u = out + cx * cy;
+	unsigned char *v = u + uvCX * uvRows;
+
+	for (int row = 0; row < cy; row++)
+		memcpy(out + row * cx, y + row * pitch, cx);
+
+	for (int row = 0; row < uvRows; row++) {
+		const BYTE *in = uv + row * pitch;
+
+		for (int x = 0; x < uvCX; x++) {
+			*(u++) = in[x * 2];
+			*(v++) = in[x * 2 + 1];
+		}
+	}
+}
+
+void H264Decoder::Deliver(IMFSample *sample)
+{
+	ComPtr<IMFMediaBuffer> buffer;
+	LONGLONG time = 0, duration = 0;
+	BYTE *ptr = nullptr;
+	LONG pitch = 0;
+
+	if (FAILED(sample->GetBufferByIndex(0, &buffer)))
+		return;
+
+	sample->GetSampleTime(&time);
+	sample->GetSampleDuration(&duration);
+
+	/* 2D buffers may be padded, so prefer their real pitch */
+	ComQIPtr<IMF2DBuffer> buffer2D(buffer);
+	bool locked2D = buffer2D && SUCCEEDED(buffer2D->Lock2D(&ptr, &pitch));
+
+	if (!locked2D) {
+		DWORD length = 0;
+		if (FAILED(buffer->Lock(&ptr, nullptr, &length)))
+			return;
+		if ((size_t)length < (size_t)frameCX * frameCY * 3 / 2) {
+			buffer->Unlock();
+			return;
+		}
+		pitch = frameCX;
+	}
+
+	int cx = displayCX;
+	int cy = displayCY;
+
+	size_t uvSize = (size_t)((cx + 1) & ~1) * ((cy + 1) / 2);
+
+	if (frame.Resize((size_t)cx * cy + uvSize)) {
+		const BYTE *uv = ptr + (size_t)pitch * frameCY;
+
+		ptr += (size_t)pitch * displayY + displayX;
+		uv  += (size_t)pitch * (displayY / 2) + displayX;
+
+		if (outputConfig.format == VideoFormat::I420)
+			CopyI420(frame.Data(), ptr, uv, pitch, cx, cy);
+		else
+			CopyNV12(frame.Data(), ptr, uv, pitch, cx, cy);
+	}
+
+	if (locked2D)
+		buffer2D->Unlock2D();
+	else
+		buffer->Unlock();
+
+	if (frame.Size() != (size_t)cx * cy + uvSize)
+		return;
+
+	outputConfig.cx = cx;
+	outputConfig.cy = cy;
+
+	if (outputConfig.sampleCallback)
+		outputConfig.sampleCallback(outputConfig.sampleParam,
+				outputConfig, frame.Data(), frame.Size(),
+				time, time + duration);
+	else
+		outputConfig.callback(outputConfig, frame.Data(),
+				frame.Size(), time, time + duration);
+}
+
+void H264Decoder::DecodeThread()
+{
+	HRESULT hrCom = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+	HANDLE  mmcss = EnterMMCSS(config);
+	HRESULT hrMF  = MFStartup(MF_VERSION, MFSTARTUP_LITE);
+	bool success  = SUCCEEDED(hrMF) && CreateTransform();
+
+	if (FAILED(hrMF))
+		ErrorHR(L"H264Decoder: MFStartup failed", hrMF);
+
+	unique_lock<mutex> lock(queueMutex);
+
+	started = true;
+	ready   = success;
+	readyCond.notify_one();
+
+	while (success) {
+		queueCond.wait(lock, [this] ()
+		{
+			return stopping || !queue.empty();
+		});
+
+		if (stopping)
+			break;
+
+		Packet packet = move(queue.front());
+		queue.pop_front();
+		lock.unlock();
+
+		if (!Decode(packet)) {
+			lock.lock();
+			waitKeyframe  = true;
+			discontinuity = true;
+		} else {
+			lock.lock();
+		}
+
+		freePackets.push_back(move(packet));
+	}
+
+	lock.unlock();
+
+	outputSample.Clear();
+	outputBuffer.Clear();
+	if (transform) {
+		transform->ProcessMessage(MFT_MESSAGE_NOTIFY_END_STREAMING, 0);
+		transform.Clear();
+	}
+
+	if (SUCCEEDED(hrMF))
+		MFShutdown();
+	LeaveMMCSS(mmcss);
+	if (SUCCEEDED(hrCom))
+		CoUninitialize();
+}
+
+}; /* namespace DShow */
@@ -0,0 +1,116 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+#pragma once
+
+#include "../dshowcapture.hpp"
+#include "buffer-pool.hpp"
+#include "ComPtr.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+struct IMFTransform;
+struct IMFSample;
+struct IMFMediaBuffer;
+
+namespace DShow {
+
+/**
+ * Decodes the frames of an H.264 device with the Media Foundation H.264
+ * decoder on its own thread, and passes NV12 or I420 frames to the
+ * config's video callback.  The capture thread only copies the frames
+ * into a short queue; when the decoder falls behind the queue is dropped
+ * and decoding resumes at the next keyframe.
+ */
+class H264Decoder {
+	struct Packet {
+		long long              startTime;
+		long long              stopTime;
+		bool                   discontinuity;
+		PoolBuffer             data;
+	};
+
+	const void                 *owner;
+	VideoConfig                config;
+	VideoConfig                outputConfig;
+	PoolBuffer                 frame;
+
+	ComPtr<IMFTransform>       transform;
+	ComPtr<IMFSample>          outputSample;
+	ComPtr<IMFMediaBuffer>     outputBuffer;
+	bool                       providesSamples = false;
+	unsigned long              outputSize = 0;
+	int                        frameCX = 0;
+	int                        frameCY = 0;
+
+	/* the picture inside the macroblock-aligned frame */
+	int                        displayX = 0;
+	int                        displayY = 0;
+	int                        displayCX = 0;
+	int                        displayCY = 0;
+
+	std::thread                thread;
+	std::mutex                 queueMutex;
+	std::condition_variable    queueCond;
+	std::condition_variable    readyCond;
+	std::deque<Packet>         queue;
+	std::vector<Packet>        freePackets;
+	size_t                     maxQueued = 2;
+	bool                       stopping = false;
+	bool                       started = false;
+	bool                       ready = false;
+	bool                       waitKeyframe = true;
+	bool                       discontinuity = false;
+	bool                       warnedDrop = false;
+	volatile bool              active = false;
+
+	void DecodeThread();
+	bool CreateTransform();
+	bool SetOutputType();
+	bool Decode(const Packet &packet);
+	bool DrainOutput();
+	void Deliver(IMFSample *sample);
+
+public:
+	H264Decoder(const void *owner);
+	~H264Decoder();
+
+	/**
+	 * Starts decoding; returns once the decoder has been created, and
+	 * leaves the decoder inactive if that failed
+	 */
+	void Start(const VideoConfig &config);
+
+	/** Stops the decode thread and drops any queued frames */
+	void Stop();
+
+	inline bool Active() const {return active;}
+
+	void Push(const unsigned char *data, size_t size,
+			long long startTime, long long stopTime);
+};
+
+}; /* namespace DShow */
@@ -0,0 +1,56 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace DShow {
+
+/* Annex B helpers shared by the muxers, the recorder and the decoder */
+
+static inline const uint8_t *FindStartCode(const uint8_t *p,
+		const uint8_t *end)
+{
+	for (; p + 3 <= end; p++) {
+		if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+			return p;
+	}
+
+	return end;
+}
+
+/* true if the access unit has an IDR slice */
+static inline bool IsKeyframe(const uint8_t *data, size_t size)
+{
+	const uint8_t *end = data + size;
+	const uint8_t *nal = FindStartCode(data, end);
+
+	while (nal + 3 < end) {
+		if ((nal[3] & 0x1F) == 5)
+			return true;
+
+		nal = FindStartCode(nal + 3, end);
+	}
+
+	return false;
+}
+
+}; /* namespace DShow */
@@ -19,6 +19,7 @@
 
 #include "dshow-base.hpp"
 #include "log.hpp"
+#include "alloc-tracker.hpp"
 #include "../dshowcapture.hpp"
 
 namespace DShow {
@@ -34,11 +35,15 @@ void SetLogCallback(LogCallback callback, void *param)
 
 static void Log(LogType type, const wchar_t *format, va_list args)
 {
+	ALLOC_SUBSCOPE("log");
+
 	wchar_t str[4096];
 	vswprintf_s(str, 4096, format, args);
 
-	if (logCallback)
+	if (logCallback) {
+		ALLOC_PAUSE();
 		logCallback(type, str, logParam);
+	}
 }
 
 void Error  (const wchar_t *format, ...)
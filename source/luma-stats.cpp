@@ -0,0 +1,231 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+
+#include "luma-stats.hpp"
+#include "fast-copy.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef DSHOW_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace DShow {
+
+/* clipping thresholds, the nominal black and white of limited range video
+ * (plus or minus one code value) */
+#define LUMA_LOW_CLIP  16
+#define LUMA_HIGH_CLIP 235
+
+void LumaStatsBuilder::Reset(int subsample_, bool keepThumbnail_)
+{
+	memset(&stats, 0, sizeof(stats));
+
+	subsample     = subsample_ > 0 ? subsample_ : 1;
+	sum           = 0;
+	low           = 0;
+	high          = 0;
+	pixels        = 0;
+	keepThumbnail = keepThumbnail_;
+	thumbCX       = 0;
+	thumbCY       = 0;
+}
+
+#ifdef DSHOW_SSE2
+/* sums and counts the clipped samples of 16 pixels at a time; returns the
+ * number of pixels handled */
+static int AddRowSSE2(const uint8_t *y, int cx, int step,
+		uint64_t &sum, uint64_t &low, uint64_t &high)
+{
+	const __m128i zero     = _mm_setzero_si128();
+	const __m128i one      = _mm_set1_epi8(1);
+	const __m128i lowClip  = _mm_set1_epi8((char)LUMA_LOW_CLIP);
+	const __m128i highClip = _mm_set1_epi8((char)LUMA_HIGH_CLIP);
+	const __m128i mask     = _mm_set1_epi16(0x00FF);
+
+	__m128i sums  = zero;
+	__m128i lows  = zero;
+	__m128i highs = zero;
+	int x = 0;
+
+	/* the packed loads read one byte past the last sample they use */
+	int limit = step == 1 ? cx - 16 : cx - 17;
+
+	for (; x <= limit; x += 16) {
+		__m128i v;
+
+		if (step == 1) {
+			v = _mm_loadu_si128((const __m128i*)(y + x));
+		} else {
+			const __m128i *p = (const __m128i*)(y + x * 2);
+			__m128i a = _mm_loadu_si128(p);
+			__m128i b = _mm_loadu_si128(p + 1);
+			v = _mm_packus_epi16(_mm_and_si128(a, mask),
+			                     _mm_and_si128(b, mask));
+		}
+
+		__m128i isLow  = _mm_cmpeq_epi8(_mm_min_epu8(v, lowClip), v);
+		__m128i isHigh = _mm_cmpeq_epi8(_mm_max_epu8(v, highClip), v);
+
+		sums  = _mm_add_epi64(sums, _mm_sad_epu8(v, zero));
+		lows  = _mm_add_epi64(lows, _mm_sad_epu8(
+					_mm_and_si128(isLow, one), zero));
+		highs = _mm_add_epi64(highs, _mm_sad_epu8(
+					_mm_and_si128(isHigh, one), zero));
+	}
+
+	uint64_t lanes[2];
+
+	_mm_storeu_si128((__m128i*)lanes, sums);
+	sum += lanes[0] + lanes[1];
+	_mm_storeu_si128((__m128i*)lanes, lows);
+	low += lanes[0] + lanes[1];
+	_mm_storeu_si128((__m128i*)lanes, highs);
+	high += lanes[0] + lanes[1];
+
+	return x;
+}
+#endif
+
+void LumaStatsBuilder::AddRow(const uint8_t *y, int cx, int step)
+{
+	int x = 0;
+
+	/* mean and clipping use every pixel of the row, which SIMD makes
+	 * nearly free; the histogram only takes every Nth pixel */
+#ifdef DSHOW_SSE2
+	x = AddRowSSE2(y, cx, step, sum, low, high);
+#endif
+
+	for (; x < cx; x++) {
+		uint8_t v = y[x * step];
+
+		sum += v;
+		if (v <= LUMA_LOW_CLIP)
+			low++;
+		else if (v >= LUMA_HIGH_CLIP)
+			high++;
+	}
+
+	if (keepThumbnail) {
+		/* the buffer keeps its size between frames of the same
+		 * format, so this only allocates when the format changes */
+		thumbCX = (cx + subsample - 1) / subsample;
+		size_t offset = (size_t)thumbCX * thumbCY++;
+		if (thumbnail.size() < offset + thumbCX)
+			thumbnail.resize(offset + thumbCX);
+
+		uint8_t *out = thumbnail.data() + offset;
+
+		for (x = 0; x < cx; x += subsample) {
+			uint8_t v = y[x * step];
+			stats.histogram[v]++;
+			*(out++) = v;
+		}
+	} else {
+		for (x = 0; x < cx; x += subsample)
+			stats.histogram[y[x * step]]++;
+	}
+
+	pixels += (uint64_t)cx;
+}
+
+bool LumaStatsBuilder::AddFrame(const VideoConfig &config,
+		const uint8_t *data, size_t size)
+{
+	int cx = config.cx;
+	int cy = abs(config.cy);
+	size_t rows = (size_t)cy;
+	size_t stride;
+	int offset = 0;
+	int step = 1;
+
+	if (cx <= 0 || !cy)
+		return false;
+
+	switch (config.format) {
+	case VideoFormat::I420:
+	case VideoFormat::YV12:
+	case VideoFormat::NV12:
+		rows   = rows + (rows + 1) / 2;
+		stride = (size_t)cx;
+		break;
+	case VideoFormat::I422:
+	case VideoFormat::NV16:
+		rows   = rows * 2;
+		stride = (size_t)cx;
+		break;
+	case VideoFormat::I444:
+		rows   = rows * 3;
+		stride = (size_t)cx;
+		break;
+	case VideoFormat::Y800:
+		stride = (size_t)cx;
+		break;
+	case VideoFormat::P010:
+	case VideoFormat::P210:
+		rows   = config.format == VideoFormat::P010 ?
+			rows + (rows + 1) / 2 : rows * 2;
+		stride = (size_t)cx * 2;
+		offset = 1;
+		step   = 2;
+		break;
+	case VideoFormat::YVYU:
+	case VideoFormat::YUY2:
+		stride = ((size_t)cx + 1) / 2 * 4;
+		step   = 2;
+		break;
+	case VideoFormat::UYVY:
+	case VideoFormat::HDYC:
+		stride = ((size_t)cx + 1) / 2 * 4;
+		offset = 1;
+		step   = 2;
+		break;
+	default:
+		return false;
+	}
+
+	/* drivers may pad rows, see GetSourceStride in video-convert.cpp */
+	if (size / rows > stride)
+		stride = (size / rows) & ~(size_t)1;
+	if (stride * rows > size)
+		return false;
+
+	for (int row = 0; row < cy; row += subsample)
+		AddRow(data + stride * row + offset, cx, step);
+
+	return true;
+}
+
+const LumaStats &LumaStatsBuilder::Finish()
+{
+	stats.pixels = pixels;
+
+	if (pixels) {
+		stats.mean            = (float)((double)sum / pixels);
+		stats.lowClipPercent  = (float)((double)low * 100.0 / pixels);
+		stats.highClipPercent = (float)((double)high * 100.0 / pixels);
+	}
+
+	return stats;
+}
+
+}; /* namespace DShow */
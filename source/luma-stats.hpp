@@ -0,0 +1,75 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+#pragma once
+
+#include "../dshowcapture.hpp"
+
+#include <stdint.h>
+#include <vector>
+
+namespace DShow {
+
+/**
+ * Accumulates LumaStats from rows of 8-bit luma samples.  Rows are handed
+ * over by whatever pass already touches the frame (usually the conversion),
+ * so the statistics don't cost another sweep over memory.
+ */
+class LumaStatsBuilder {
+	LumaStats stats;
+	int       subsample = 1;
+	uint64_t  sum = 0;
+	uint64_t  low = 0;
+	uint64_t  high = 0;
+	uint64_t  pixels = 0;
+
+	/* the histogram samples, kept as a downscaled frame when asked to */
+	bool                 keepThumbnail = false;
+	std::vector<uint8_t> thumbnail;
+	int                  thumbCX = 0;
+	int                  thumbCY = 0;
+
+public:
+	void Reset(int subsample, bool keepThumbnail = false);
+
+	inline bool WantsRow(int row) const {return row % subsample == 0;}
+
+	/**
+	 * Adds a row of cx samples, 'step' bytes apart (1 for planar luma,
+	 * 2 for packed 4:2:2 and for the high bytes of 16-bit samples)
+	 */
+	void AddRow(const uint8_t *y, int cx, int step);
+
+	/**
+	 * Adds the sampled rows of an unconverted frame.  Returns false if
+	 * the frame's format has no luma the builder can read (RGB, V210,
+	 * compressed formats).
+	 */
+	bool AddFrame(const VideoConfig &config, const uint8_t *data,
+			size_t size);
+
+	const LumaStats &Finish();
+
+	inline const uint8_t *Thumbnail() const {return thumbnail.data();}
+	inline int ThumbnailCX() const {return thumbCX;}
+	inline int ThumbnailCY() const {return thumbCY;}
+	inline int Subsample() const {return subsample;}
+};
+
+}; /* namespace DShow */
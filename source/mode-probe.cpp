@@ -0,0 +1,271 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+
+#include "mode-probe.hpp"
+#include "dshow-base.hpp"
+#include "log.hpp"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <map>
+#include <mutex>
+
+using namespace std;
+
+namespace DShow {
+
+/* frames per second the arrival buffer is sized for */
+#define MAX_PROBE_FPS        300
+
+/* delivered intervals up to this much above nominal still count */
+#define SUSTAINED_PERCENT    105
+
+static mutex                                  probeMutex;
+static map<wstring, vector<VideoModeProbe>>   probeCache;
+
+struct ProbeState {
+	LARGE_INTEGER     frequency;
+	vector<long long> arrivals;
+};
+
+static inline const wstring &GetProbeKey(const DeviceId &device)
+{
+	return device.path.empty() ? device.name : device.path;
+}
+
+static inline long long GetProbeTime(const LARGE_INTEGER &frequency)
+{
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+
+	long long seconds = counter.QuadPart / frequency.QuadPart;
+	long long rest    = counter.QuadPart % frequency.QuadPart;
+	return seconds * 10000000LL + rest * 10000000LL / frequency.QuadPart;
+}
+
+/* runs on the capture thread; the arrival buffer is reserved up front so
+ * nothing is allocated while measuring */
+static void ProbeCallback(void *param, const VideoConfig &config,
+		unsigned char *data, size_t size,
+		long long startTime, long long stopTime)
+{
+	ProbeState *state = reinterpret_cast<ProbeState*>(param);
+
+	if (state->arrivals.size() < state->arrivals.capacity())
+		state->arrivals.push_back(GetProbeTime(state->frequency));
+
+	(void)config;
+	(void)data;
+	(void)size;
+	(void)startTime;
+	(void)stopTime;
+}
+
+static void MeasureProbe(VideoModeProbe &mode, const ProbeState &state,
+		long long startTime)
+{
+	const vector<long long> &arrivals = state.arrivals;
+	size_t count = arrivals.size();
+
+	mode.frames = (unsigned int)count;
+	if (!count)
+		return;
+
+	mode.latency = arrivals[0] - startTime;
+	if (count < 2)
+		return;
+
+	mode.interval = (arrivals[count - 1] - arrivals[0]) /
+		(long long)(count - 1);
+
+	double variance = 0.0;
+	for (size_t i = 1; i < count; i++) {
+		double delta = (double)(arrivals[i] - arrivals[i - 1] -
+				mode.interval);
+		variance += delta * delta;
+	}
+
+	mode.jitter    = (long long)sqrt(variance / (double)(count - 1));
+	mode.sustained = mode.interval * 100 <=
+		mode.frameInterval * SUSTAINED_PERCENT;
+}
+
+static bool ProbeMode(const DeviceId &device, VideoModeProbe &mode,
+		unsigned int durationMs)
+{
+	Device      capture(InitGraph::True);
+	VideoConfig config;
+	ProbeState  state;
+
+	config.name             = device.name;
+	config.path             = device.path;
+	config.useDefaultConfig = false;
+	config.cx               = mode.cx;
+	config.cy               = mode.cy;
+	config.frameInterval    = mode.frameInterval;
+	config.internalFormat   = mode.format;
+	config.format           = mode.format;
+	config.controlRefreshMs = 0;
+	config.sampleCallback   = ProbeCallback;
+	config.sampleParam      = &state;
+
+	QueryPerformanceFrequency(&state.frequency);
+	state.arrivals.reserve((size_t)durationMs * MAX_PROBE_FPS / 1000 + 1);
+
+	if (!capture.SetVideoConfig(&config))
+		return false;
+
+	/* the closest mode the device had may not be the one asked for */
+	if (config.cx != mode.cx || abs(config.cy) != abs(mode.cy) ||
+	    config.frameInterval != mode.frameInterval ||
+	    config.internalFormat != mode.format) {
+		Warning(L"ProbeVideoModes: Mode %dx%d (%lld) not available",
+				mode.cx, mode.cy, mode.frameInterval);
+		return false;
+	}
+
+	if (!capture.ConnectFilters())
+		return false;
+
+	long long startTime = GetProbeTime(state.frequency);
+	if (capture.Start() != Result::Success)
+		return false;
+
+	Sleep(durationMs);
+	capture.Stop();
+
+	mode.started = true;
+	MeasureProbe(mode, state, startTime);
+
+	Info(L"ProbeVideoModes: %dx%d (%lld): %u frames, interval %lld, "
+	     L"jitter %lld, latency %lld", mode.cx, mode.cy,
+	     mode.frameInterval, mode.frames, mode.interval, mode.jitter,
+	     mode.latency);
+	return true;
+}
+
+static bool GetAdvertisedModes(const DeviceId &device,
+		vector<VideoModeProbe> &modes)
+{
+	vector<VideoDevice> devices;
+
+	if (!Device::EnumVideoDevices(devices))
+		return false;
+
+	for (const VideoDevice &info : devices) {
+		if (device.path.empty() ? info.name != device.name :
+		                          info.path != device.path)
+			continue;
+
+		for (const VideoInfo &caps : info.caps) {
+			VideoModeProbe mode;
+			mode.cx            = caps.maxCX;
+			mode.cy            = caps.maxCY;
+			mode.frameInterval = caps.minInterval;
+			mode.format        = caps.format;
+			modes.push_back(mode);
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+static void StoreModeProbes(const DeviceId &device,
+		const vector<VideoModeProbe> &modes)
+{
+	lock_guard<mutex> lock(probeMutex);
+	vector<VideoModeProbe> &probes = probeCache[GetProbeKey(device)];
+
+	for (const VideoModeProbe &mode : modes) {
+		bool replaced = false;
+
+		for (VideoModeProbe &probe : probes) {
+			if (probe.format == mode.format &&
+			    probe.cx == mode.cx && probe.cy == mode.cy &&
+			    probe.frameInterval == mode.frameInterval) {
+				probe    = mode;
+				replaced = true;
+				break;
+			}
+		}
+
+		if (!replaced)
+			probes.push_back(mode);
+	}
+}
+
+bool RunModeProbes(const DeviceId &device, vector<VideoModeProbe> &modes,
+		unsigned int durationMs)
+{
+	if (modes.empty() && !GetAdvertisedModes(device, modes)) {
+		Error(L"ProbeVideoModes: Video device '%s': %s not found",
+				device.name.c_str(), device.path.c_str());
+		return false;
+	}
+
+	for (VideoModeProbe &mode : modes) {
+		mode.started   = false;
+		mode.frames    = 0;
+		mode.interval  = 0;
+		mode.jitter    = 0;
+		mode.latency   = 0;
+		mode.sustained = false;
+	}
+
+	/* forget earlier results first, so GetClosestVideoMediaType doesn't
+	 * steer the probe away from a mode that failed before */
+	StoreModeProbes(device, modes);
+
+	for (VideoModeProbe &mode : modes)
+		if (mode.cx > 0 && mode.cy != 0 && mode.frameInterval > 0)
+			ProbeMode(device, mode, durationMs);
+
+	StoreModeProbes(device, modes);
+	return true;
+}
+
+bool GetModeProbes(const DeviceId &device, vector<VideoModeProbe> &probes)
+{
+	lock_guard<mutex> lock(probeMutex);
+
+	auto it = probeCache.find(GetProbeKey(device));
+	if (it == probeCache.end())
+		return false;
+
+	probes = it->second;
+	return true;
+}
+
+const VideoModeProbe *FindModeProbe(const vector<VideoModeProbe> &probes,
+		VideoFormat format, int cx, int cy, long long frameInterval)
+{
+	for (const VideoModeProbe &probe : probes)
+		if (probe.format == format &&
+		    probe.cx == cx && abs(probe.cy) == abs(cy) &&
+		    probe.frameInterval == frameInterval)
+			return &probe;
+
+	return nullptr;
+}
+
+}; /* namespace DShow */
@@ -0,0 +1,43 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+
+#pragma once
+
+#include "../dshowcapture.hpp"
+
+#include <vector>
+
+namespace DShow {
+
+/**
+ * Runs Device::ProbeVideoModes and stores the results in the probe cache.
+ * The cache lives for the whole process and is keyed by device path (or
+ * name, for devices without one).
+ */
+bool RunModeProbes(const DeviceId &device,
+		std::vector<VideoModeProbe> &modes, unsigned int durationMs);
+
+bool GetModeProbes(const DeviceId &device,
+		std::vector<VideoModeProbe> &probes);
+
+const VideoModeProbe *FindModeProbe(const std::vector<VideoModeProbe> &probes,
+		VideoFormat format, int cx, int cy, long long frameInterval);
+
+}; /* namespace DShow */
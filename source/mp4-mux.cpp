@@ -0,0 +1,718 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+
+#include "mp4-mux.hpp"
+#include "h264-nal.hpp"
+
+#include <string.h>
+
+#include <algorithm>
+
+using namespace std;
+
+namespace DShow {
+
+#define VIDEO_TIMESCALE       90000
+#define AAC_FRAME_SAMPLES     1024
+
+/* fragments are normally cut at keyframes; these bound them when keyframes
+ * are rare or there is no video at all */
+#define MAX_FRAGMENT_SECONDS  10
+#define AUDIO_FRAGMENT_SECONDS 1
+
+#define SAMPLE_FLAGS_SYNC     0x02000000
+#define SAMPLE_FLAGS_NON_SYNC 0x01010000
+
+static const int aacSampleRates[] = {
+	96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050,
+	16000, 12000, 11025, 8000, 7350
+};
+
+static inline void PutU8(vector<uint8_t> &b, uint8_t val)
+{
+	b.push_back(val);
+}
+
+static inline void PutU16(vector<uint8_t> &b, uint16_t val)
+{
+	b.push_back((uint8_t)(val >> 8));
+	b.push_back((uint8_t)val);
+}
+
+static inline void PutU32(vector<uint8_t> &b, uint32_t val)
+{
+	b.push_back((uint8_t)(val >> 24));
+	b.push_back((uint8_t)(val >> 16));
+	b.push_back((uint8_t)(val >> 8));
+	b.push_back((uint8_t)val);
+}
+
+static inline void PutU64(vector<uint8_t> &b, uint64_t val)
+{
+	PutU32(b, (uint32_t)(val >> 32));
+	PutU32(b, (uint32_t)val);
+}
+
+static inline void PutData(vector<uint8_t> &b, const void *data, size_t size)
+{
+	const uint8_t *p = (const uint8_t*)data;
+	b.insert(b.end(), p, p + size);
+}
+
+static inline void PutZeros(vector<uint8_t> &b, size_t count)
+{
+	b.insert(b.end(), count, 0);
+}
+
+static inline void PatchU32(vector<uint8_t> &b, size_t pos, uint32_t val)
+{
+	b[pos]     = (uint8_t)(val >> 24);
+	b[pos + 1] = (uint8_t)(val >> 16);
+	b[pos + 2] = (uint8_t)(val >> 8);
+	b[pos + 3] = (uint8_t)val;
+}
+
+static inline size_t BeginBox(vector<uint8_t> &b, const char *type)
+{
+	size_t pos = b.size();
+	PutU32(b, 0);
+	PutData(b, type, 4);
+	return pos;
+}
+
+static inline size_t BeginFullBox(vector<uint8_t> &b, const char *type,
+		uint8_t version, uint32_t flags)
+{
+	size_t pos = BeginBox(b, type);
+	PutU32(b, ((uint32_t)version << 24) | (flags & 0xFFFFFF));
+	return pos;
+}
+
+static inline void EndBox(vector<uint8_t> &b, size_t pos)
+{
+	PatchU32(b, pos, (uint32_t)(b.size() - pos));
+}
+
+static void PutMatrix(vector<uint8_t> &b)
+{
+	static const uint32_t matrix[9] = {
+		0x00010000, 0, 0,
+		0, 0x00010000, 0,
+		0, 0, 0x40000000
+	};
+
+	for (uint32_t val : matrix)
+		PutU32(b, val);
+}
+
+static inline bool IsADTS(const uint8_t *data, size_t size)
+{
+	return size >= 7 && data[0] == 0xFF && (data[1] & 0xF6) == 0xF0;
+}
+
+static void MakeAudioSpecificConfig(vector<uint8_t> &asc, int objectType,
+		int sampleRate, int channels)
+{
+	int index = 15;
+	for (size_t i = 0; i < sizeof(aacSampleRates) / sizeof(int); i++) {
+		if (aacSampleRates[i] == sampleRate) {
+			index = (int)i;
+			break;
+		}
+	}
+
+	int config = channels == 8 ? 7 : channels;
+
+	asc.clear();
+
+	if (index != 15) {
+		PutU16(asc, (uint16_t)((objectType << 11) | (index << 7) |
+					(config << 3)));
+	} else {
+		/* explicit 24-bit sample rate */
+		uint64_t bits = ((uint64_t)objectType << 35) |
+			((uint64_t)15 << 31) |
+			((uint64_t)(sampleRate & 0xFFFFFF) << 7) |
+			((uint64_t)config << 3);
+		for (int shift = 32; shift >= 0; shift -= 8)
+			PutU8(asc, (uint8_t)(bits >> shift));
+	}
+}
+
+void MP4Mux::SetVideo(int cx, int cy, int64_t frameInterval_)
+{
+	video.enabled = true;
+	width         = cx;
+	height        = cy;
+	frameInterval = frameInterval_ > 0 ? frameInterval_ : 333333;
+}
+
+void MP4Mux::SetAudio(int sampleRate_, int channels_)
+{
+	audio.enabled = true;
+	sampleRate    = sampleRate_;
+	channels      = channels_;
+}
+
+int64_t MP4Mux::VideoTime(int64_t time) const
+{
+	return time * VIDEO_TIMESCALE / 10000000;
+}
+
+int64_t MP4Mux::AudioTime(int64_t time) const
+{
+	return time * sampleRate / 10000000;
+}
+
+void MP4Mux::WriteTrack(vector<uint8_t> &out, const Track &track)
+{
+	bool isVideo = &track == &video;
+	size_t trak, box, mdia, minf, dinf, stbl, stsd, entry, esds;
+
+	trak = BeginBox(out, "trak");
+
+	/* enabled | in movie | in preview */
+	box = BeginFullBox(out, "tkhd", 0, 7);
+	PutU32(out, 0);
+	PutU32(out, 0);
+	PutU32(out, track.id);
+	PutU32(out, 0);
+	PutU32(out, 0);
+	PutZeros(out, 8);
+	PutU16(out, 0);
+	PutU16(out, 0);
+	PutU16(out, isVideo ? 0 : 0x0100);
+	PutU16(out, 0);
+	PutMatrix(out);
+	PutU32(out, isVideo ? (uint32_t)width << 16 : 0);
+	PutU32(out, isVideo ? (uint32_t)height << 16 : 0);
+	EndBox(out, box);
+
+	mdia = BeginBox(out, "mdia");
+
+	box = BeginFullBox(out, "mdhd", 0, 0);
+	PutU32(out, 0);
+	PutU32(out, 0);
+	PutU32(out, track.timescale);
+	PutU32(out, 0);
+	PutU16(out, 0x55C4); /* "und" */
+	PutU16(out, 0);
+	EndBox(out, box);
+
+	box = BeginFullBox(out, "hdlr", 0, 0);
+	PutU32(out, 0);
+	PutData(out, isVideo ? "vide" : "soun", 4);
+	PutZeros(out, 12);
+	if (isVideo)
+		PutData(out, "VideoHandler", 13);
+	else
+		PutData(out, "SoundHandler", 13);
+	EndBox(out, box);
+
+	minf = BeginBox(out, "minf");
+
+	if (isVideo) {
+		box = BeginFullBox(out, "vmhd", 0, 1);
+		PutZeros(out, 8);
+	} else {
+		box = BeginFullBox(out, "smhd", 0, 0);
+		PutZeros(out, 4);
+	}
+	EndBox(out, box);
+
+	dinf = BeginBox(out, "dinf");
+	box = BeginFullBox(out, "dref", 0, 0);
+	PutU32(out, 1);
+	EndBox(out, BeginFullBox(out, "url ", 0, 1));
+	EndBox(out, box);
+	EndBox(out, dinf);
+
+	stbl = BeginBox(out, "stbl");
+	stsd = BeginFullBox(out, "stsd", 0, 0);
+	PutU32(out, 1);
+
+	if (isVideo) {
+		entry = BeginBox(out, "avc1");
+		PutZeros(out, 6);
+		PutU16(out, 1);
+		PutZeros(out, 16);
+		PutU16(out, (uint16_t)width);
+		PutU16(out, (uint16_t)height);
+		PutU32(out, 0x00480000);
+		PutU32(out, 0x00480000);
+		PutU32(out, 0);
+		PutU16(out, 1);
+		PutZeros(out, 32);
+		PutU16(out, 0x0018);
+		PutU16(out, 0xFFFF);
+
+		box = BeginBox(out, "avcC");
+		PutU8(out, 1);
+		PutU8(out, sps[1]);
+		PutU8(out, sps[2]);
+		PutU8(out, sps[3]);
+		PutU8(out, 0xFF); /* 4-byte NAL lengths */
+		PutU8(out, 0xE1);
+		PutU16(out, (uint16_t)sps.size());
+		PutData(out, sps.data(), sps.size());
+		PutU8(out, 1);
+		PutU16(out, (uint16_t)pps.size());
+		PutData(out, pps.data(), pps.size());
+		EndBox(out, box);
+
+		EndBox(out, entry);
+	} else {
+		entry = BeginBox(out, "mp4a");
+		PutZeros(out, 6);
+		PutU16(out, 1);
+		PutZeros(out, 8);
+		PutU16(out, (uint16_t)channels);
+		PutU16(out, 16);
+		PutU16(out, 0);
+		PutU16(out, 0);
+		PutU32(out, (uint32_t)sampleRate << 16);
+
+		uint8_t ascSize = (uint8_t)asc.size();
+
+		esds = BeginFullBox(out, "esds", 0, 0);
+		PutU8(out, 0x03); /* ES_Descriptor */
+		PutU8(out, 3 + 2 + 13 + 2 + ascSize + 3);
+		PutU16(out, 0);
+		PutU8(out, 0);
+		PutU8(out, 0x04); /* DecoderConfigDescriptor */
+		PutU8(out, 13 + 2 + ascSize);
+		PutU8(out, 0x40); /* MPEG-4 audio */
+		PutU8(out, 0x15); /* audio stream */
+		PutZeros(out, 3);
+		PutU32(out, 0);
+		PutU32(out, 0);
+		PutU8(out, 0x05); /* DecoderSpecificInfo */
+		PutU8(out, ascSize);
+		PutData(out, asc.data(), asc.size());
+		PutU8(out, 0x06); /* SLConfigDescriptor */
+		PutU8(out, 1);
+		PutU8(out, 2);
+		EndBox(out, esds);
+
+		EndBox(out, entry);
+	}
+
+	EndBox(out, stsd);
+
+	/* all samples live in fragments, so the sample tables are empty */
+	box = BeginFullBox(out, "stts", 0, 0);
+	PutU32(out, 0);
+	EndBox(out, box);
+	box = BeginFullBox(out, "stsc", 0, 0);
+	PutU32(out, 0);
+	EndBox(out, box);
+	box = BeginFullBox(out, "stsz", 0, 0);
+	PutU32(out, 0);
+	PutU32(out, 0);
+	EndBox(out, box);
+	box = BeginFullBox(out, "stco", 0, 0);
+	PutU32(out, 0);
+	EndBox(out, box);
+
+	EndBox(out, stbl);
+	EndBox(out, minf);
+	EndBox(out, mdia);
+	EndBox(out, trak);
+}
+
+void MP4Mux::WriteHeader(vector<uint8_t> &out)
+{
+	size_t box, moov, mvex;
+
+	uint32_t nextId = 1;
+	if (video.enabled) {
+		video.id        = nextId++;
+		video.timescale = VIDEO_TIMESCALE;
+	}
+	if (audio.enabled) {
+		audio.id        = nextId++;
+		audio.timescale = (uint32_t)sampleRate;
+
+		if (asc.empty())
+			MakeAudioSpecificConfig(asc, 2, sampleRate, channels);
+	}
+
+	box = BeginBox(out, "ftyp");
+	PutData(out, "iso5", 4);
+	PutU32(out, 512);
+	PutData(out, "iso5iso6mp41", 12);
+	if (video.enabled)
+		PutData(out, "avc1", 4);
+	EndBox(out, box);
+
+	moov = BeginBox(out, "moov");
+
+	box = BeginFullBox(out, "mvhd", 0, 0);
+	PutU32(out, 0);
+	PutU32(out, 0);
+	PutU32(out, 1000);
+	PutU32(out, 0);
+	PutU32(out, 0x00010000);
+	PutU16(out, 0x0100);
+	PutZeros(out, 10);
+	PutMatrix(out);
+	PutZeros(out, 24);
+	PutU32(out, nextId);
+	EndBox(out, box);
+
+	if (video.enabled)
+		WriteTrack(out, video);
+	if (audio.enabled)
+		WriteTrack(out, audio);
+
+	mvex = BeginBox(out, "mvex");
+	for (Track *track : {&video, &audio}) {
+		if (!track->enabled)
+			continue;
+
+		box = BeginFullBox(out, "trex", 0, 0);
+		PutU32(out, track->id);
+		PutU32(out, 1);
+		PutU32(out, 0);
+		PutU32(out, 0);
+		PutU32(out, 0);
+		EndBox(out, box);
+	}
+	EndBox(out, mvex);
+
+	EndBox(out, moov);
+
+	headerWritten = true;
+}
+
+void MP4Mux::WriteRun(vector<uint8_t> &out, Track &track, int64_t videoEnd,
+		size_t &dataOffsetPos)
+{
+	bool isVideo = &track == &video;
+	vector<Sample> &samples = track.samples;
+	size_t count = samples.size();
+	size_t traf, box;
+
+	/* only presentation times are known.  The decode times of a GOP are
+	 * its presentation times in ascending order, and every presentation
+	 * time is pushed back by the reorder depth of the first GOP (on both
+	 * tracks, to keep them in sync) so composition offsets stay
+	 * positive. */
+	decodeTimes.resize(count);
+	for (size_t i = 0; i < count; i++)
+		decodeTimes[i] = samples[i].pts;
+
+	if (isVideo) {
+		sort(decodeTimes.begin(), decodeTimes.end());
+
+		if (reorderDelay < 0) {
+			reorderDelay = 0;
+			for (size_t i = 0; i < count; i++)
+				reorderDelay = max(reorderDelay,
+						decodeTimes[i] - samples[i].pts);
+		}
+
+		for (size_t i = 0; i < count; i++) {
+			if (decodeTimes[i] <= lastVideoDts)
+				decodeTimes[i] = lastVideoDts + 1;
+			lastVideoDts = decodeTimes[i];
+		}
+	} else {
+		int64_t delay = max(reorderDelay, (int64_t)0) *
+			track.timescale / VIDEO_TIMESCALE;
+
+		for (size_t i = 0; i < count; i++)
+			decodeTimes[i] += delay;
+	}
+
+	traf = BeginBox(out, "traf");
+
+	/* default-base-is-moof */
+	box = BeginFullBox(out, "tfhd", 0, 0x020000);
+	PutU32(out, track.id);
+	EndBox(out, box);
+
+	box = BeginFullBox(out, "tfdt", 1, 0);
+	PutU64(out, (uint64_t)decodeTimes[0]);
+	EndBox(out, box);
+
+	/* data offset, duration, size (+ flags, composition offset for
+	 * video, which uses signed offsets) */
+	box = BeginFullBox(out, "trun", isVideo ? 1 : 0,
+			isVideo ? 0x000F01 : 0x000301);
+	PutU32(out, (uint32_t)count);
+	dataOffsetPos = out.size();
+	PutU32(out, 0);
+
+	int64_t lastDuration = isVideo ?
+		VideoTime(frameInterval) : AAC_FRAME_SAMPLES;
+
+	for (size_t i = 0; i < count; i++) {
+		const Sample &sample = samples[i];
+		int64_t dts = decodeTimes[i];
+		int64_t duration;
+
+		if (i + 1 < count)
+			duration = decodeTimes[i + 1] - dts;
+		else if (isVideo && videoEnd > dts)
+			duration = videoEnd - dts;
+		else
+			duration = lastDuration;
+
+		PutU32(out, (uint32_t)max(duration, (int64_t)1));
+		PutU32(out, sample.size);
+
+		if (isVideo) {
+			PutU32(out, sample.keyframe ?
+					SAMPLE_FLAGS_SYNC :
+					SAMPLE_FLAGS_NON_SYNC);
+			PutU32(out, (uint32_t)(sample.pts + reorderDelay - dts));
+		}
+	}
+
+	EndBox(out, box);
+	EndBox(out, traf);
+}
+
+void MP4Mux::WriteFragment(vector<uint8_t> &out, int64_t videoEnd)
+{
+	if (video.samples.empty() && audio.samples.empty())
+		return;
+
+	if (!headerWritten)
+		WriteHeader(out);
+
+	RecordIndexEntry point = {};
+	point.offset = out.size();
+
+	if (!video.samples.empty()) {
+		point.time = video.samples[0].pts * 10000000 / VIDEO_TIMESCALE;
+		if (video.samples[0].keyframe)
+			point.flags |= DSHOW_RECORD_INDEX_KEYFRAME;
+	} else {
+		point.time = audio.samples[0].pts * 10000000 / sampleRate;
+	}
+
+	if (!audio.samples.empty())
+		point.flags |= DSHOW_RECORD_INDEX_AUDIO;
+
+	syncPoints.push_back(point);
+
+	size_t moof = BeginBox(out, "moof");
+	size_t dataOffsetPos[2] = {0, 0};
+	size_t box;
+
+	box = BeginFullBox(out, "mfhd", 0, 0);
+	PutU32(out, ++sequence);
+	EndBox(out, box);
+
+	/* the first GOP determines the reorder delay, so without any video
+	 * yet there is nothing to delay by */
+	if (video.samples.empty() && !video.enabled)
+		reorderDelay = 0;
+
+	if (!video.samples.empty())
+		WriteRun(out, video, videoEnd, dataOffsetPos[0]);
+	if (!audio.samples.empty())
+		WriteRun(out, audio, 0, dataOffsetPos[1]);
+
+	EndBox(out, moof);
+
+	/* sample data offsets are relative to the start of the moof */
+	uint32_t offset = (uint32_t)(out.size() - moof) + 8;
+
+	if (!video.samples.empty()) {
+		PatchU32(out, dataOffsetPos[0], offset);
+		offset += (uint32_t)video.data.size();
+	}
+	if (!audio.samples.empty())
+		PatchU32(out, dataOffsetPos[1], offset);
+
+	PutU32(out, 8 + (uint32_t)(video.data.size() + audio.data.size()));
+	PutData(out, "mdat", 4);
+	PutData(out, video.data.data(), video.data.size());
+	PutData(out, audio.data.data(), audio.data.size());
+
+	video.samples.clear();
+	video.data.clear();
+	audio.samples.clear();
+	audio.data.clear();
+}
+
+void MP4Mux::AddVideo(const uint8_t *data, size_t size, int64_t timestamp,
+		vector<uint8_t> &out)
+{
+	if (!video.enabled)
+		return;
+
+	const uint8_t *end = data + size;
+	const uint8_t *nal = FindStartCode(data, end);
+	bool keyframe = false;
+
+	pending.clear();
+
+	/* convert Annex B start codes to 4-byte lengths */
+	while (nal < end) {
+		nal += 3;
+
+		const uint8_t *next = FindStartCode(nal, end);
+		const uint8_t *nalEnd = next;
+
+		while (nalEnd > nal && nalEnd[-1] == 0)
+			nalEnd--;
+
+		size_t nalSize = nalEnd - nal;
+		int type = nalSize ? nal[0] & 0x1F : 0;
+
+		if (type == 7 && nalSize >= 4 && !headerWritten)
+			sps.assign(nal, nalEnd);
+		else if (type == 8 && !headerWritten)
+			pps.assign(nal, nalEnd);
+		else if (type == 5)
+			keyframe = true;
+
+		/* access unit delimiters are meaningless in MP4 */
+		if (nalSize && type != 9) {
+			PutU32(pending, (uint32_t)nalSize);
+			PutData(pending, nal, nalSize);
+		}
+
+		nal = next;
+	}
+
+	if (pending.empty())
+		return;
+
+	if (!timelineStarted) {
+		if (!keyframe || sps.empty() || pps.empty())
+			return;
+
+		baseTime        = timestamp;
+		timelineStarted = true;
+	}
+
+	int64_t pts = VideoTime(timestamp - baseTime);
+
+	if (!video.samples.empty()) {
+		bool cut = keyframe || pts - video.samples[0].pts >=
+			(int64_t)VIDEO_TIMESCALE * MAX_FRAGMENT_SECONDS;
+
+		if (cut)
+			WriteFragment(out, pts);
+	}
+
+	Sample sample;
+	sample.size     = (uint32_t)pending.size();
+	sample.pts      = pts;
+	sample.keyframe = keyframe;
+
+	video.samples.push_back(sample);
+	PutData(video.data, pending.data(), pending.size());
+}
+
+void MP4Mux::AddAudioFrame(const uint8_t *data, size_t size, int64_t pts)
+{
+	Sample sample;
+	sample.size     = (uint32_t)size;
+	sample.pts      = pts;
+	sample.keyframe = true;
+
+	audio.samples.push_back(sample);
+	PutData(audio.data, data, size);
+
+	audio.started  = true;
+	audio.lastTime = pts;
+}
+
+void MP4Mux::AddAudio(const uint8_t *data, size_t size, int64_t timestamp,
+		vector<uint8_t> &out)
+{
+	if (!audio.enabled || !size)
+		return;
+
+	bool adts = IsADTS(data, size);
+
+	/* the stream's own headers are more trustworthy than the device's
+	 * reported settings */
+	if (adts && asc.empty()) {
+		int objectType = (data[2] >> 6) + 1;
+		int index = (data[2] >> 2) & 0xF;
+		int config = ((data[2] & 1) << 2) | (data[3] >> 6);
+
+		if (index < 13) {
+			sampleRate = aacSampleRates[index];
+			channels   = config == 7 ? 8 : config;
+			MakeAudioSpecificConfig(asc, objectType, sampleRate,
+					config);
+		}
+	}
+
+	if (!timelineStarted) {
+		if (video.enabled)
+			return;
+
+		baseTime        = timestamp;
+		timelineStarted = true;
+	}
+
+	if (timestamp < baseTime)
+		return;
+
+	int64_t pts = AudioTime(timestamp - baseTime);
+
+	/* keep audio contiguous unless there's an actual gap */
+	if (audio.started) {
+		int64_t expected = audio.lastTime + AAC_FRAME_SAMPLES;
+		if (pts - expected < AAC_FRAME_SAMPLES * 2)
+			pts = expected;
+	}
+
+	if (!video.enabled && !audio.samples.empty() &&
+	    pts - audio.samples[0].pts >=
+	    (int64_t)sampleRate * AUDIO_FRAGMENT_SECONDS)
+		WriteFragment(out, 0);
+
+	if (!adts) {
+		AddAudioFrame(data, size, pts);
+		return;
+	}
+
+	const uint8_t *end = data + size;
+
+	while (IsADTS(data, end - data)) {
+		size_t frameSize = ((data[3] & 3) << 11) | (data[4] << 3) |
+			(data[5] >> 5);
+		size_t headerSize = (data[1] & 1) ? 7 : 9;
+
+		if (frameSize <= headerSize || frameSize > (size_t)(end - data))
+			break;
+
+		AddAudioFrame(data + headerSize, frameSize - headerSize, pts);
+		pts  += AAC_FRAME_SAMPLES;
+		data += frameSize;
+	}
+}
+
+void MP4Mux::Flush(vector<uint8_t> &out)
+{
+	WriteFragment(out, 0);
+}
+
+}; /* namespace DShow */
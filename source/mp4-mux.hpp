@@ -0,0 +1,126 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+
+#pragma once
+
+#include "../dshowcapture.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace DShow {
+
+/**
+ * Streaming fragmented MP4 muxer for H.264 (Annex B) and AAC (ADTS or raw
+ * frames).  It only produces bytes; the caller decides where they go.
+ *
+ * The stream starts at the first keyframe.  The header (ftyp/moov) is
+ * written along with the first fragment, built from the SPS/PPS of the
+ * stream and the AudioSpecificConfig of the first ADTS header (or the
+ * configured sample rate/channels for raw AAC).  A moof/mdat pair is
+ * emitted for every GOP, so a file that is cut short is only missing the
+ * fragment that was being written.  Every fragment is also a sync point,
+ * recorded in SyncPoints() with its offset into the output of the call
+ * that wrote it.
+ *
+ * Timestamps are in 100-nanosecond units.
+ */
+class MP4Mux {
+	struct Sample {
+		uint32_t               size;
+		int64_t                pts;
+		bool                   keyframe;
+	};
+
+	struct Track {
+		uint32_t               id = 0;
+		uint32_t               timescale = 0;
+		bool                   enabled = false;
+		bool                   started = false;
+		int64_t                lastTime = 0;
+		std::vector<Sample>    samples;
+		std::vector<uint8_t>   data;
+	};
+
+	Track                      video;
+	Track                      audio;
+
+	int                        width = 0;
+	int                        height = 0;
+	int64_t                    frameInterval = 0;
+	int                        sampleRate = 0;
+	int                        channels = 0;
+
+	std::vector<uint8_t>       sps;
+	std::vector<uint8_t>       pps;
+	std::vector<uint8_t>       asc;
+
+	int64_t                    baseTime = 0;
+	int64_t                    reorderDelay = -1;
+	int64_t                    lastVideoDts = -1;
+	bool                       timelineStarted = false;
+	bool                       headerWritten = false;
+	uint32_t                   sequence = 0;
+
+	std::vector<int64_t>       decodeTimes;
+	std::vector<uint8_t>       pending;
+
+	std::vector<RecordIndexEntry> syncPoints;
+
+	int64_t VideoTime(int64_t time) const;
+	int64_t AudioTime(int64_t time) const;
+
+	void WriteHeader(std::vector<uint8_t> &out);
+	void WriteTrack(std::vector<uint8_t> &out, const Track &track);
+	void WriteFragment(std::vector<uint8_t> &out, int64_t videoEnd);
+
+	void WriteRun(std::vector<uint8_t> &out, Track &track,
+			int64_t videoEnd, size_t &dataOffsetPos);
+
+	void AddAudioFrame(const uint8_t *data, size_t size, int64_t pts);
+
+public:
+	void SetVideo(int cx, int cy, int64_t frameInterval);
+	void SetAudio(int sampleRate, int channels);
+
+	/**
+	 * Adds an access unit / AAC packet.  Any complete output (header,
+	 * finished fragments) is appended to 'out'.
+	 */
+	void AddVideo(const uint8_t *data, size_t size, int64_t timestamp,
+			std::vector<uint8_t> &out);
+	void AddAudio(const uint8_t *data, size_t size, int64_t timestamp,
+			std::vector<uint8_t> &out);
+
+	/** Writes out the fragment in progress */
+	void Flush(std::vector<uint8_t> &out);
+
+	inline bool HeaderWritten() const {return headerWritten;}
+
+	inline const std::vector<RecordIndexEntry> &SyncPoints() const
+	{
+		return syncPoints;
+	}
+
+	inline void ClearSyncPoints() {syncPoints.clear();}
+};
+
+}; /* namespace DShow */
@@ -18,6 +18,7 @@
  */
 
 #include "output-filter.hpp"
+#include "fast-copy.hpp"
 #include "log.hpp"
 
 namespace DShow {
@@ -358,7 +359,7 @@ void OutputPin::Send(unsigned char *data[DSHOW_MAX_PLANES],
 		if (!linesize[i])
 			break;
 
-		memcpy(ptr + total, data[i], linesize[i]);
+		FastCopy(ptr + total, data[i], linesize[i]);
 		total += linesize[i];
 	}
 
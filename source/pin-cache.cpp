@@ -0,0 +1,184 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+#include "pin-cache.hpp"
+#include "dshow-media-type.hpp"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace DShow {
+
+static void AddMajorType(vector<GUID> &types, const GUID &type)
+{
+	if (find(types.begin(), types.end(), type) == types.end())
+		types.push_back(type);
+}
+
+void PinCache::ReadPin(IPin *pin, PinDesc &desc)
+{
+	desc.pin = pin;
+
+	if (FAILED(pin->QueryDirection(&desc.dir)))
+		desc.dir = (PIN_DIRECTION)-1;
+
+	ComQIPtr<IKsPropertySet> propertySet(pin);
+	DWORD                    size;
+
+	desc.category = GUID_NULL;
+	desc.categoryResult = propertySet == NULL ? E_NOINTERFACE :
+		propertySet->Get(AMPROPSETID_Pin, AMPROPERTY_PIN_CATEGORY,
+				NULL, 0, &desc.category, sizeof(GUID), &size);
+
+	/* same types GetFilterPin checks: every config cap, and the first
+	 * media type the pin enumerates */
+	ComQIPtr<IAMStreamConfig> config(pin);
+	int count, capsSize;
+
+	if (config != NULL &&
+	    SUCCEEDED(config->GetNumberOfCapabilities(&count, &capsSize))) {
+		vector<BYTE> caps(capsSize);
+
+		for (int i = 0; i < count; i++) {
+			MediaTypePtr mt;
+			if (SUCCEEDED(config->GetStreamCaps(i, &mt,
+							caps.data())))
+				AddMajorType(desc.majorTypes, mt->majortype);
+		}
+	}
+
+	ComPtr<IEnumMediaTypes> mediaEnum;
+	if (SUCCEEDED(pin->EnumMediaTypes(&mediaEnum))) {
+		MediaTypePtr mt;
+		ULONG        num;
+
+		if (mediaEnum->Next(1, &mt, &num) == S_OK)
+			AddMajorType(desc.majorTypes, mt->majortype);
+	}
+
+	PIN_INFO pinInfo;
+	if (SUCCEEDED(pin->QueryPinInfo(&pinInfo))) {
+		if (pinInfo.pFilter)
+			pinInfo.pFilter->Release();
+
+		desc.name = pinInfo.achName;
+	}
+}
+
+void PinCache::ReadPins(FilterPins &entry)
+{
+	ComPtr<IEnumPins> pinsEnum;
+	ComPtr<IPin>      pin;
+	ULONG             num;
+
+	entry.pins.clear();
+
+	if (FAILED(entry.filter->EnumPins(&pinsEnum)))
+		return;
+
+	while (pinsEnum->Next(1, &pin, &num) == S_OK) {
+		entry.pins.emplace_back();
+		ReadPin(pin, entry.pins.back());
+	}
+}
+
+PinCache::FilterPins *PinCache::GetFilter(IBaseFilter *filter)
+{
+	for (FilterPins &entry : filters) {
+		if (entry.filter == filter)
+			return &entry;
+	}
+
+	filters.emplace_back();
+
+	FilterPins &entry = filters.back();
+	entry.filter = filter;
+	ReadPins(entry);
+	return &entry;
+}
+
+template<typename Matches>
+bool PinCache::FindPin(IBaseFilter *filter, Matches matches, IPin **pin)
+{
+	if (!filter)
+		return false;
+
+	FilterPins *entry = GetFilter(filter);
+
+	for (int pass = 0; pass < 2; pass++) {
+		for (const PinDesc &desc : entry->pins) {
+			if (matches(desc)) {
+				*pin = desc.pin;
+				(*pin)->AddRef();
+				return true;
+			}
+		}
+
+		if (pass == 0)
+			ReadPins(*entry);
+	}
+
+	return false;
+}
+
+bool PinCache::GetFilterPin(IBaseFilter *filter, const GUID &type,
+		const GUID &category, PIN_DIRECTION dir, IPin **pin)
+{
+	auto matches = [&] (const PinDesc &desc)
+	{
+		if (desc.dir != dir)
+			return false;
+		if (find(desc.majorTypes.begin(), desc.majorTypes.end(),
+					type) == desc.majorTypes.end())
+			return false;
+
+		/* if the pin has no category interface, chances are we
+		 * created it */
+		if (FAILED(desc.categoryResult))
+			return desc.categoryResult == E_NOINTERFACE;
+
+		return desc.category == category;
+	};
+
+	return FindPin(filter, matches, pin);
+}
+
+bool PinCache::GetPinByName(IBaseFilter *filter, PIN_DIRECTION dir,
+		const wchar_t *name, IPin **pin)
+{
+	auto matches = [&] (const PinDesc &desc)
+	{
+		return desc.dir == dir && (!name || desc.name == name);
+	};
+
+	return FindPin(filter, matches, pin);
+}
+
+void PinCache::Remove(IBaseFilter *filter)
+{
+	for (auto it = filters.begin(); it != filters.end(); ++it) {
+		if (it->filter == filter) {
+			filters.erase(it);
+			return;
+		}
+	}
+}
+
+}; /* namespace DShow */
@@ -0,0 +1,73 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+#pragma once
+
+#include "dshow-base.hpp"
+
+#include <vector>
+
+namespace DShow {
+
+/**
+ * Pin descriptors (direction, category, major types, name) of the filters
+ * a graph is built from, so the repeated pin lookups made while setting up
+ * and connecting a device don't query every pin again each time.
+ *
+ * A filter's pins are read on its first lookup.  A lookup that finds
+ * nothing reads them again, as some filters (e.g. the demuxer) create pins
+ * after they are set up.  Filters must be removed when they leave the
+ * graph, as the cache holds a reference to them.
+ */
+class PinCache {
+	struct PinDesc {
+		ComPtr<IPin>           pin;
+		PIN_DIRECTION          dir;
+		HRESULT                categoryResult;
+		GUID                   category;
+		std::vector<GUID>      majorTypes;
+		std::wstring           name;
+	};
+
+	struct FilterPins {
+		ComPtr<IBaseFilter>    filter;
+		std::vector<PinDesc>   pins;
+	};
+
+	std::vector<FilterPins>    filters;
+
+	static void ReadPin(IPin *pin, PinDesc &desc);
+	static void ReadPins(FilterPins &entry);
+
+	FilterPins *GetFilter(IBaseFilter *filter);
+
+	template<typename Matches>
+	bool FindPin(IBaseFilter *filter, Matches matches, IPin **pin);
+
+public:
+	bool GetFilterPin(IBaseFilter *filter, const GUID &type,
+			const GUID &category, PIN_DIRECTION dir, IPin **pin);
+	bool GetPinByName(IBaseFilter *filter, PIN_DIRECTION dir,
+			const wchar_t *name, IPin **pin);
+
+	void Remove(IBaseFilter *filter);
+	inline void Clear() {filters.clear();}
+};
+
+}; /* namespace DShow */
@@ -0,0 +1,239 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+
+#include "quality-governor.hpp"
+#include "log.hpp"
+
+using namespace std;
+
+namespace DShow {
+
+#define QUALITY_WINDOW_MS    500
+#define MAX_UPGRADE_BACKOFF  8
+
+QualityGovernor::~QualityGovernor()
+{
+	Stop();
+}
+
+void QualityGovernor::Start(const DowngradePolicy &policy_,
+		const vector<QualityStep> &steps_,
+		ApplyProc apply_, void *param)
+{
+	Stop();
+
+	if (steps_.size() < 2 || steps_[0].frameInterval <= 0)
+		return;
+
+	policy        = policy_;
+	steps         = steps_;
+	level         = 0;
+	apply         = apply_;
+	applyParam    = param;
+	frames        = 0;
+	dropped       = 0;
+	busyTicks     = 0;
+	lastStartTime = -1;
+	frameInterval = steps[0].frameInterval;
+	stopping      = false;
+	halted        = false;
+
+	QueryPerformanceFrequency(&frequency);
+
+	active = true;
+	thread = std::thread(&QualityGovernor::GovernorThread, this);
+}
+
+void QualityGovernor::Stop()
+{
+	if (thread.joinable()) {
+		{
+			lock_guard<mutex> lock(governorMutex);
+			stopping = true;
+		}
+
+		governorCond.notify_one();
+		thread.join();
+	}
+
+	active = false;
+}
+
+void QualityGovernor::FrameDelivered(long long startTime,
+		long long callbackStart)
+{
+	long long interval = frameInterval;
+
+	InterlockedExchangeAdd64(&busyTicks, Now() - callbackStart);
+	InterlockedIncrement64(&frames);
+
+	/* a gap of more than one and a half intervals means frames were
+	 * dropped somewhere upstream */
+	if (lastStartTime >= 0 && interval > 0) {
+		long long gap = startTime - lastStartTime;
+
+		if (gap > interval * 3 / 2)
+			InterlockedExchangeAdd64(&dropped,
+					(gap + interval / 2) / interval - 1);
+	}
+
+	lastStartTime = startTime;
+}
+
+void QualityGovernor::ModeChanged(long long interval)
+{
+	frameInterval = interval;
+	lastStartTime = -1;
+	frames        = 0;
+	dropped       = 0;
+	busyTicks     = 0;
+}
+
+void QualityGovernor::Halt()
+{
+	lock_guard<mutex> lock(governorMutex);
+	stopping = true;
+	halted   = true;
+	active   = false;
+}
+
+void QualityGovernor::Switch(size_t newLevel, float busy, float drops)
+{
+	QualityChange change;
+	change.from        = steps[level];
+	change.to          = steps[newLevel];
+	change.downgrade   = newLevel > level;
+	change.busyPercent = busy;
+	change.dropPercent = drops;
+
+	change.success = apply(applyParam, change.to);
+
+	{
+		lock_guard<mutex> lock(governorMutex);
+		change.stopped = halted;
+	}
+
+	if (change.success) {
+		level = newLevel;
+	} else if (newLevel > 0) {
+		/* the step didn't work with this device, don't retry it */
+		steps.erase(steps.begin() + newLevel);
+		if (level > newLevel)
+			level--;
+	}
+
+	Info(L"Quality %s %dx%d (%lld) -> %dx%d (%lld)%s, busy %.1f%%, "
+	     L"dropped %.1f%%",
+	     change.downgrade ? L"downgrade" : L"upgrade",
+	     change.from.cx, change.from.cy, change.from.frameInterval,
+	     change.to.cx, change.to.cy, change.to.frameInterval,
+	     change.success ? L"" : L" failed", busy, drops);
+
+	if (change.stopped)
+		Error(L"Quality switching stopped, the device could not be "
+		      L"restarted");
+
+	if (policy.callback)
+		policy.callback(change);
+}
+
+void QualityGovernor::GovernorThread()
+{
+	HRESULT hrCom = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+
+	ULONGLONG overloadSince = 0;
+	ULONGLONG headroomSince = 0;
+	ULONGLONG lastUpgrade   = 0;
+	unsigned int backoff    = 1;
+
+	unique_lock<mutex> lock(governorMutex);
+
+	for (;;) {
+		governorCond.wait_for(lock,
+				chrono::milliseconds(QUALITY_WINDOW_MS),
+				[this] () {return stopping;});
+		if (stopping)
+			break;
+
+		lock.unlock();
+
+		LONG64 frameCount = InterlockedExchange64(&frames, 0);
+		LONG64 dropCount  = InterlockedExchange64(&dropped, 0);
+		LONG64 ticks      = InterlockedExchange64(&busyTicks, 0);
+		ULONGLONG now     = GetTickCount64();
+
+		if (frameCount) {
+			double busyTime = (double)ticks * 10000000.0 /
+				(double)frequency.QuadPart;
+			float busy = (float)(busyTime * 100.0 /
+				((double)frameCount * frameInterval));
+			float drops = (float)((double)dropCount * 100.0 /
+				(double)(frameCount + dropCount));
+
+			bool overloaded = busy >= policy.busyPercent ||
+				drops >= policy.dropPercent;
+			bool headroom = busy <= policy.headroomPercent &&
+				!dropCount;
+
+			if (!overloaded)
+				overloadSince = 0;
+			else if (!overloadSince)
+				overloadSince = now;
+
+			if (!headroom)
+				headroomSince = 0;
+			else if (!headroomSince)
+				headroomSince = now;
+
+			ULONGLONG upgradeMs =
+				(ULONGLONG)policy.upgradeMs * backoff;
+
+			if (overloadSince && level + 1 < steps.size() &&
+			    now - overloadSince >= policy.downgradeMs) {
+				/* a step up that didn't hold */
+				bool flapped = lastUpgrade &&
+					now - lastUpgrade < upgradeMs;
+				if (flapped && backoff < MAX_UPGRADE_BACKOFF)
+					backoff *= 2;
+
+				Switch(level + 1, busy, drops);
+				overloadSince = 0;
+				headroomSince = 0;
+				lastUpgrade   = 0;
+
+			} else if (headroomSince && level > 0 &&
+			           now - headroomSince >= upgradeMs) {
+				Switch(level - 1, busy, drops);
+				overloadSince = 0;
+				headroomSince = 0;
+				lastUpgrade   = now;
+			}
+		}
+
+		lock.lock();
+	}
+
+	lock.unlock();
+
+	if (SUCCEEDED(hrCom))
+		CoUninitialize();
+}
+
+}; /* namespace DShow */
@@ -0,0 +1,98 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+
+#pragma once
+
+#include "../dshowcapture.hpp"
+#include "dshow-base.hpp"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace DShow {
+
+/**
+ * Runs a DowngradePolicy.  The capture thread only adds to a few
+ * interlocked counters per frame; the governor thread reads them every
+ * window, decides, and switches modes through the apply callback, which
+ * is expected to restart the graph in the new mode.
+ */
+class QualityGovernor {
+public:
+	typedef bool (*ApplyProc)(void *param, const QualityStep &step);
+
+private:
+	DowngradePolicy            policy;
+	std::vector<QualityStep>   steps;
+	size_t                     level = 0;
+	ApplyProc                  apply = nullptr;
+	void                       *applyParam = nullptr;
+	LARGE_INTEGER              frequency;
+
+	/* written by the capture thread */
+	volatile LONG64            frames = 0;
+	volatile LONG64            dropped = 0;
+	volatile LONG64            busyTicks = 0;
+	long long                  lastStartTime = -1;
+
+	volatile long long         frameInterval = 0;
+	volatile bool              active = false;
+
+	std::thread                thread;
+	std::mutex                 governorMutex;
+	std::condition_variable    governorCond;
+	bool                       stopping = false;
+	bool                       halted = false;
+
+	void GovernorThread();
+	void Switch(size_t newLevel, float busy, float drops);
+
+public:
+	~QualityGovernor();
+
+	/* steps[0] is the mode the device is running in */
+	void Start(const DowngradePolicy &policy,
+			const std::vector<QualityStep> &steps,
+			ApplyProc apply, void *param);
+	void Stop();
+
+	inline bool Active() const {return active;}
+
+	inline long long Now() const
+	{
+		LARGE_INTEGER counter;
+		QueryPerformanceCounter(&counter);
+		return counter.QuadPart;
+	}
+
+	/* called by the apply callback while the graph is stopped */
+	void ModeChanged(long long frameInterval);
+
+	/* called by the apply callback when the graph could not be
+	 * restarted; ends the governor thread after the current switch */
+	void Halt();
+
+	/* called on the capture thread after the video callback returns */
+	void FrameDelivered(long long startTime, long long callbackStart);
+};
+
+}; /* namespace DShow */
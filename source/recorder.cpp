@@ -0,0 +1,518 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+
+#include "recorder.hpp"
+#include "h264-nal.hpp"
+#include "alloc-tracker.hpp"
+#include "log.hpp"
+
+#include <math.h>
+#include <stdio.h>
+
+using namespace std;
+
+namespace DShow {
+
+/* the writer should never be this far behind; if it is, the disk can't
+ * keep up */
+#define BACKLOG_WARNING_BYTES (64 * 1024 * 1024)
+
+/* segment data is written in batches of at least this size */
+#define SEGMENT_WRITE_BYTES   (1024 * 1024)
+#define OUTPUT_RESERVE        (SEGMENT_WRITE_BYTES * 2)
+
+static bool WriteData(HANDLE file, const wstring &path, const void *data,
+		size_t size)
+{
+	const uint8_t *pos = (const uint8_t*)data;
+
+	while (size) {
+		DWORD chunk = size > 0x40000000 ? 0x40000000 : (DWORD)size;
+		DWORD written = 0;
+
+		if (!WriteFile(file, pos, chunk, &written, nullptr) ||
+		    !written) {
+			Error(L"Recorder: Failed to write to '%s' (%lu)",
+					path.c_str(), GetLastError());
+			return false;
+		}
+
+		pos  += written;
+		size -= written;
+	}
+
+	return true;
+}
+
+static string ToUTF8(const wstring &str)
+{
+	int size = WideCharToMultiByte(CP_UTF8, 0, str.c_str(),
+			(int)str.size(), nullptr, 0, nullptr, nullptr);
+	string utf8(size, 0);
+
+	if (size)
+		WideCharToMultiByte(CP_UTF8, 0, str.c_str(), (int)str.size(),
+				&utf8[0], size, nullptr, nullptr);
+	return utf8;
+}
+
+Recorder::Recorder(const void *owner_)
+	: owner (owner_)
+{
+}
+
+Recorder::~Recorder()
+{
+	Close();
+}
+
+bool Recorder::Open(const RecordConfig &config_, const VideoConfig *video,
+		const AudioConfig *audio)
+{
+	config = config_;
+
+	if (config.format == RecordFormat::HLS) {
+		if (config.segmentSeconds <= 0 || config.playlistSegments < 0) {
+			Error(L"Recorder: Invalid HLS segment settings");
+			return false;
+		}
+
+		if (video)
+			tsMux.SetVideo(video->frameInterval);
+		if (audio)
+			tsMux.SetAudio(audio->sampleRate, audio->channels);
+		tsMux.SetSegmentDuration(
+				(int64_t)config.segmentSeconds * 10000000);
+
+		size_t slash = config.path.find_last_of(L"\\/");
+		size_t start = slash == wstring::npos ? 0 : slash + 1;
+		size_t dot = config.path.find_last_of(L'.');
+		if (dot == wstring::npos || dot < start)
+			dot = config.path.size();
+
+		segmentDir  = config.path.substr(0, start);
+		segmentBase = config.path.substr(start, dot - start);
+	} else {
+		if (video)
+			mux.SetVideo(video->cx, abs(video->cy),
+					video->frameInterval);
+		if (audio)
+			mux.SetAudio(audio->sampleRate, audio->channels);
+
+		filePath = config.path;
+		file = CreateFileW(filePath.c_str(), GENERIC_WRITE,
+				FILE_SHARE_READ, nullptr, CREATE_ALWAYS,
+				FILE_ATTRIBUTE_NORMAL |
+				FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE) {
+			Error(L"Recorder: Could not open '%s' (%lu)",
+					filePath.c_str(), GetLastError());
+			return false;
+		}
+	}
+
+	if (config.index) {
+		RecordIndexHeader header = {};
+		header.magic     = DSHOW_RECORD_INDEX_MAGIC;
+		header.version   = DSHOW_RECORD_INDEX_VERSION;
+		header.entrySize = sizeof(RecordIndexEntry);
+
+		indexPath = config.path + L".idx";
+		indexFile = CreateFileW(indexPath.c_str(), GENERIC_WRITE,
+				FILE_SHARE_READ, nullptr, CREATE_ALWAYS,
+				FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (indexFile == INVALID_HANDLE_VALUE) {
+			Error(L"Recorder: Could not open '%s' (%lu)",
+					indexPath.c_str(), GetLastError());
+			return false;
+		}
+
+		if (!WriteData(indexFile, indexPath, &header, sizeof(header)))
+			return false;
+	}
+
+	output.reserve(OUTPUT_RESERVE);
+
+	writer = thread(&Recorder::WriterThread, this);
+	return true;
+}
+
+void Recorder::Close()
+{
+	if (writer.joinable()) {
+		{
+			lock_guard<mutex> lock(queueMutex);
+			stopping = true;
+		}
+
+		queueCond.notify_one();
+		writer.join();
+	}
+
+	if (file != INVALID_HANDLE_VALUE) {
+		CloseHandle(file);
+		file = INVALID_HANDLE_VALUE;
+	}
+
+	if (indexFile != INVALID_HANDLE_VALUE) {
+		CloseHandle(indexFile);
+		indexFile = INVALID_HANDLE_VALUE;
+	}
+}
+
+void Recorder::Push(bool video, const unsigned char *data, size_t size,
+		long long timestamp)
+{
+	if (!size)
+		return;
+
+	ALLOC_SUBSCOPE("record");
+
+	lock_guard<mutex> lock(queueMutex);
+
+	if (failed || stopping)
+		return;
+
+	if (PoolOverBudget(owner, size))
+		ShedPackets(size);
+	else
+		warnedBudget = false;
+
+	if (video && waitKeyframe) {
+		if (!IsKeyframe(data, size))
+			return;
+		waitKeyframe = false;
+	}
+
+	Packet packet;
+	if (!freePackets.empty()) {
+		packet = move(freePackets.back());
+		freePackets.pop_back();
+	} else {
+		packet.data.SetOwner(owner, MemorySubsystem::Recording);
+	}
+
+	packet.video     = video;
+	packet.timestamp = timestamp;
+	packet.data.Clear();
+	packet.data.Append(data, size);
+
+	queuedBytes += size;
+	queue.push_back(move(packet));
+
+	if (queuedBytes > BACKLOG_WARNING_BYTES && !warnedBacklog) {
+		Warning(L"Recorder: %llu bytes waiting to be written to "
+		        L"'%s'", (unsigned long long)queuedBytes,
+		        config.path.c_str());
+		warnedBacklog = true;
+	}
+
+	queueCond.notify_one();
+}
+
+void Recorder::ShedPackets(size_t size)
+{
+	freePackets.clear();
+
+	if (queue.empty() || !PoolOverBudget(owner, size))
+		return;
+
+	if (!warnedBudget)
+		Warning(L"Recorder: device over its memory budget, dropping "
+		        L"%llu bytes waiting to be written to '%s'",
+		        (unsigned long long)queuedBytes,
+		        config.path.c_str());
+
+	AddPoolDegradation(owner);
+	queue.clear();
+	queuedBytes  = 0;
+	waitKeyframe = true;
+	warnedBudget = true;
+}
+
+bool Recorder::Write(const uint8_t *data, size_t size)
+{
+	if (!WriteData(file, filePath, data, size))
+		return false;
+
+	fileOffset += size;
+	return true;
+}
+
+bool Recorder::WriteIndex(size_t end)
+{
+	uint32_t segment = config.format == RecordFormat::HLS ?
+		segmentIndex : 0;
+	size_t count = 0;
+
+	/* the file has been written up to 'end' in the output */
+	while (count < pendingIndex.size() &&
+	       pendingIndex[count].offset < end) {
+		RecordIndexEntry &entry = pendingIndex[count++];
+		entry.offset  = fileOffset - (end - entry.offset);
+		entry.segment = segment;
+	}
+
+	bool success = true;
+
+	if (count && indexFile != INVALID_HANDLE_VALUE)
+		success = WriteData(indexFile, indexPath, pendingIndex.data(),
+				count * sizeof(RecordIndexEntry));
+
+	pendingIndex.erase(pendingIndex.begin(), pendingIndex.begin() + count);
+	return success;
+}
+
+bool Recorder::WriteOutput()
+{
+	const vector<RecordIndexEntry> &points = mux.SyncPoints();
+	pendingIndex.insert(pendingIndex.end(), points.begin(), points.end());
+	mux.ClearSyncPoints();
+
+	bool success = Write(output.data(), output.size()) &&
+		WriteIndex(output.size());
+	output.clear();
+	return success;
+}
+
+bool Recorder::OpenSegment()
+{
+	filePath = segmentDir + segmentBase + L"-" +
+		to_wstring(segmentIndex) + L".ts";
+
+	file = CreateFileW(filePath.c_str(), GENERIC_WRITE, FILE_SHARE_READ,
+			nullptr, CREATE_ALWAYS,
+			FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+			nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		Error(L"Recorder: Could not open '%s' (%lu)",
+				filePath.c_str(), GetLastError());
+		return false;
+	}
+
+	fileOffset = 0;
+	return true;
+}
+
+void Recorder::FinishSegment(double duration)
+{
+	CloseHandle(file);
+	file = INVALID_HANDLE_VALUE;
+
+	Segment segment;
+	segment.name     = segmentBase + L"-" + to_wstring(segmentIndex++) +
+		L".ts";
+	segment.duration = duration;
+	segments.push_back(segment);
+
+	maxDuration = max(maxDuration, duration);
+
+	if (!config.playlistSegments)
+		return;
+
+	if (segments.size() > (size_t)config.playlistSegments) {
+		expiredSegments.push_back(segments.front().name);
+		segments.pop_front();
+	}
+
+	/* players may still be reading segments that just left the
+	 * playlist, so those are kept for another playlist's worth */
+	while (expiredSegments.size() > (size_t)config.playlistSegments) {
+		DeleteFileW((segmentDir + expiredSegments.front()).c_str());
+		expiredSegments.pop_front();
+	}
+}
+
+bool Recorder::WritePlaylist(bool ended)
+{
+	int target = max(config.segmentSeconds, (int)ceil(maxDuration));
+	char line[64];
+
+	playlist.clear();
+	playlist += "#EXTM3U\n#EXT-X-VERSION:3\n";
+	playlist += "#EXT-X-TARGETDURATION:" + to_string(target) + "\n";
+	playlist += "#EXT-X-MEDIA-SEQUENCE:" +
+		to_string(segmentIndex - segments.size()) + "\n";
+	if (!config.playlistSegments)
+		playlist += "#EXT-X-PLAYLIST-TYPE:EVENT\n";
+
+	for (const Segment &segment : segments) {
+		snprintf(line, sizeof(line), "#EXTINF:%.3f,\n",
+				segment.duration);
+		playlist += line;
+		playlist += ToUTF8(segment.name);
+		playlist += "\n";
+	}
+
+	if (ended)
+		playlist += "#EXT-X-ENDLIST\n";
+
+	/* replace the playlist in one step so that readers never see a
+	 * partially written one */
+	wstring tempPath = config.path + L".tmp";
+	DWORD written = 0;
+	DWORD error = 0;
+
+	HANDLE temp = CreateFileW(tempPath.c_str(), GENERIC_WRITE, 0,
+			nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (temp == INVALID_HANDLE_VALUE) {
+		Error(L"Recorder: Could not open '%s' (%lu)",
+				tempPath.c_str(), GetLastError());
+		return false;
+	}
+
+	if (!WriteFile(temp, playlist.data(), (DWORD)playlist.size(),
+				&written, nullptr) ||
+	    written != playlist.size())
+		error = GetLastError();
+
+	CloseHandle(temp);
+
+	if (!error && !MoveFileExW(tempPath.c_str(), config.path.c_str(),
+				MOVEFILE_REPLACE_EXISTING |
+				MOVEFILE_WRITE_THROUGH))
+		error = GetLastError();
+
+	if (error) {
+		Error(L"Recorder: Failed to update playlist '%s' (%lu)",
+				config.path.c_str(), error);
+		DeleteFileW(tempPath.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+bool Recorder::WriteSegments(bool flush)
+{
+	const vector<RecordIndexEntry> &points = tsMux.SyncPoints();
+	pendingIndex.insert(pendingIndex.end(), points.begin(), points.end());
+	tsMux.ClearSyncPoints();
+
+	size_t pos = 0;
+
+	for (const TSMux::SegmentEnd &end : tsMux.SegmentEnds()) {
+		if (end.offset > pos) {
+			if (file == INVALID_HANDLE_VALUE && !OpenSegment())
+				return false;
+			if (!Write(output.data() + pos, end.offset - pos))
+				return false;
+			if (!WriteIndex(end.offset))
+				return false;
+		}
+
+		if (file != INVALID_HANDLE_VALUE) {
+			FinishSegment(end.duration);
+			if (!WritePlaylist(false))
+				return false;
+		}
+
+		pos = end.offset;
+	}
+
+	tsMux.ClearSegmentEnds();
+
+	size_t remaining = output.size() - pos;
+
+	if (remaining && (flush || remaining >= SEGMENT_WRITE_BYTES)) {
+		if (file == INVALID_HANDLE_VALUE && !OpenSegment())
+			return false;
+		if (!Write(output.data() + pos, remaining))
+			return false;
+		if (!WriteIndex(output.size()))
+			return false;
+
+		pos = output.size();
+	}
+
+	output.erase(output.begin(), output.begin() + pos);
+
+	for (RecordIndexEntry &entry : pendingIndex)
+		entry.offset -= pos;
+	return true;
+}
+
+void Recorder::WriterThread()
+{
+	unique_lock<mutex> lock(queueMutex);
+
+	for (;;) {
+		queueCond.wait(lock, [this] ()
+		{
+			return stopping || !queue.empty();
+		});
+
+		if (queue.empty() && stopping)
+			break;
+
+		Packet packet = move(queue.front());
+		queue.pop_front();
+		queuedBytes -= packet.data.Size();
+		lock.unlock();
+
+		const uint8_t *data = packet.data.Data();
+		size_t size = packet.data.Size();
+		bool success;
+
+		if (config.format == RecordFormat::HLS) {
+			if (packet.video)
+				tsMux.AddVideo(data, size, packet.timestamp,
+						output);
+			else
+				tsMux.AddAudio(data, size, packet.timestamp,
+						output);
+
+			success = WriteSegments(false);
+		} else {
+			if (packet.video)
+				mux.AddVideo(data, size, packet.timestamp,
+						output);
+			else
+				mux.AddAudio(data, size, packet.timestamp,
+						output);
+
+			success = WriteOutput();
+		}
+
+		lock.lock();
+		freePackets.push_back(move(packet));
+
+		/* stop taking packets rather than writing a broken file */
+		if (!success) {
+			failed = true;
+			queue.clear();
+			queuedBytes = 0;
+			return;
+		}
+	}
+
+	lock.unlock();
+
+	if (config.format == RecordFormat::HLS) {
+		tsMux.Flush(output);
+		if (WriteSegments(true) && !segments.empty())
+			WritePlaylist(true);
+	} else {
+		mux.Flush(output);
+		WriteOutput();
+	}
+}
+
+}; /* namespace DShow */
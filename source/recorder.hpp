@@ -0,0 +1,122 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+
+#pragma once
+
+#include "../dshowcapture.hpp"
+#include "buffer-pool.hpp"
+#include "mp4-mux.hpp"
+#include "ts-mux.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+namespace DShow {
+
+/**
+ * Muxes and writes encoded packets on its own thread.  The capture threads
+ * only copy packets into the queue.
+ *
+ * For HLS, 'file' is the segment being written.  Segments are named after
+ * the playlist ("live.m3u8" -> "live-0.ts", ...) and the playlist is
+ * rewritten through a temporary file each time a segment is finished.
+ *
+ * Sync points reported by the muxers are held until the data they point
+ * to has been written, then appended to the index file.
+ *
+ * If the device goes over its memory budget, packets that have not been
+ * written yet are dropped and video resumes at the next keyframe.
+ */
+class Recorder {
+	struct Packet {
+		bool                   video;
+		long long              timestamp;
+		PoolBuffer             data;
+	};
+
+	struct Segment {
+		std::wstring           name;
+		double                 duration;
+	};
+
+	const void                 *owner;
+	RecordConfig               config;
+	HANDLE                     file = INVALID_HANDLE_VALUE;
+	std::wstring               filePath;
+	MP4Mux                     mux;
+	TSMux                      tsMux;
+	std::vector<uint8_t>       output;
+	uint64_t                   fileOffset = 0;
+
+	HANDLE                     indexFile = INVALID_HANDLE_VALUE;
+	std::wstring               indexPath;
+	std::vector<RecordIndexEntry> pendingIndex;
+
+	std::wstring               segmentBase;
+	std::wstring               segmentDir;
+	unsigned                   segmentIndex = 0;
+	double                     maxDuration = 0.0;
+	std::deque<Segment>        segments;
+	std::deque<std::wstring>   expiredSegments;
+	std::string                playlist;
+
+	std::thread                writer;
+	std::mutex                 queueMutex;
+	std::condition_variable    queueCond;
+	std::deque<Packet>         queue;
+	std::vector<Packet>        freePackets;
+	size_t                     queuedBytes = 0;
+	bool                       stopping = false;
+	bool                       warnedBacklog = false;
+	bool                       warnedBudget = false;
+	bool                       waitKeyframe = false;
+	bool                       failed = false;
+
+	void WriterThread();
+	void ShedPackets(size_t size);
+	bool Write(const uint8_t *data, size_t size);
+	bool WriteOutput();
+	bool WriteIndex(size_t end);
+
+	bool OpenSegment();
+	void FinishSegment(double duration);
+	bool WriteSegments(bool flush);
+	bool WritePlaylist(bool ended);
+
+public:
+	Recorder(const void *owner);
+	~Recorder();
+
+	bool Open(const RecordConfig &config, const VideoConfig *video,
+			const AudioConfig *audio);
+	void Close();
+
+	void Push(bool video, const unsigned char *data, size_t size,
+			long long timestamp);
+};
+
+}; /* namespace DShow */
@@ -0,0 +1,63 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+#pragma once
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+namespace DShow {
+
+/*
+ * Sequence lock for small plain values that one thread updates while
+ * others read.  The writer never waits; readers retry if the value changed
+ * while they were copying it.  T must be trivially copyable.
+ */
+template<typename T> class SeqLock {
+	volatile LONG sequence = 0;
+	T             value = {};
+
+public:
+	/* only one thread may write at a time */
+	inline void Write(const T &newValue)
+	{
+		InterlockedIncrement(&sequence);
+		value = newValue;
+		InterlockedIncrement(&sequence);
+	}
+
+	inline T Read() const
+	{
+		T    copy;
+		LONG start;
+
+		do {
+			while ((start = sequence) & 1)
+				YieldProcessor();
+
+			MemoryBarrier();
+			copy = value;
+			MemoryBarrier();
+		} while (sequence != start);
+
+		return copy;
+	}
+};
+
+}; /* namespace DShow */
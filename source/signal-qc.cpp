@@ -0,0 +1,218 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+
+#include "signal-qc.hpp"
+#include "fast-copy.hpp"
+#include "alloc-tracker.hpp"
+
+#include <math.h>
+#include <stdlib.h>
+
+#ifdef DSHOW_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace DShow {
+
+static uint8_t RowMax(const uint8_t *row, int count)
+{
+	uint8_t result = 0;
+	int x = 0;
+
+#ifdef DSHOW_SSE2
+	__m128i max = _mm_setzero_si128();
+
+	for (; x + 16 <= count; x += 16)
+		max = _mm_max_epu8(max, _mm_loadu_si128(
+					(const __m128i*)(row + x)));
+
+	max = _mm_max_epu8(max, _mm_srli_si128(max, 8));
+	max = _mm_max_epu8(max, _mm_srli_si128(max, 4));
+	max = _mm_max_epu8(max, _mm_srli_si128(max, 2));
+	max = _mm_max_epu8(max, _mm_srli_si128(max, 1));
+	result = (uint8_t)_mm_cvtsi128_si32(max);
+#endif
+
+	for (; x < count; x++)
+		if (row[x] > result)
+			result = row[x];
+
+	return result;
+}
+
+static uint64_t SumAbsDiff(const uint8_t *a, const uint8_t *b, size_t count)
+{
+	uint64_t sum = 0;
+	size_t i = 0;
+
+#ifdef DSHOW_SSE2
+	__m128i sums = _mm_setzero_si128();
+
+	for (; i + 16 <= count; i += 16) {
+		__m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+		__m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+		sums = _mm_add_epi64(sums, _mm_sad_epu8(va, vb));
+	}
+
+	uint64_t lanes[2];
+	_mm_storeu_si128((__m128i*)lanes, sums);
+	sum = lanes[0] + lanes[1];
+#endif
+
+	for (; i < count; i++)
+		sum += (uint64_t)abs((int)a[i] - (int)b[i]);
+
+	return sum;
+}
+
+int SignalQC::Detector::Update(bool condition, long long time,
+		long long duration, long long clearDuration)
+{
+	if (condition) {
+		offSince = -1;
+		if (onSince == -1 || time < onSince)
+			onSince = time;
+
+		if (!active && time - onSince >= duration) {
+			active = true;
+			return 1;
+		}
+
+	} else {
+		onSince = -1;
+		if (!active)
+			return 0;
+
+		if (offSince == -1 || time < offSince)
+			offSince = time;
+
+		if (time - offSince >= clearDuration) {
+			active = false;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+void SignalQC::Configure(const VideoConfig &videoConfig)
+{
+	config     = videoConfig.qc;
+	callback   = videoConfig.qcCallback;
+	black      = Detector();
+	frozen     = Detector();
+	letterbox  = Detector();
+	previousCX = 0;
+	previousCY = 0;
+
+	status.Write(SignalStatus());
+}
+
+void SignalQC::Restart()
+{
+	black.Restart();
+	frozen.Restart();
+	letterbox.Restart();
+	previousCX = 0;
+	previousCY = 0;
+}
+
+void SignalQC::Notify(const VideoConfig &videoConfig, int change,
+		SignalEvent start, SignalEvent end,
+		const SignalStatus &current)
+{
+	if (change && callback) {
+		ALLOC_PAUSE();
+		callback(videoConfig, change > 0 ? start : end, current);
+	}
+}
+
+void SignalQC::Process(const VideoConfig &videoConfig, const LumaStats &stats,
+		const LumaStatsBuilder &luma, long long time)
+{
+	const uint8_t *thumb = luma.Thumbnail();
+	int cx = luma.ThumbnailCX();
+	int cy = luma.ThumbnailCY();
+	size_t count = (size_t)cx * cy;
+	SignalStatus current;
+
+	current.time = time;
+	current.mean = stats.mean;
+
+	bool isBlack = stats.mean <= config.blackMaxMean &&
+		stats.lowClipPercent >= config.blackMinPercent;
+
+	/* frozen */
+	bool isFrozen = false;
+
+	if (count && cx == previousCX && cy == previousCY) {
+		current.difference = (float)(
+			(double)SumAbsDiff(thumb, previous.data(), count) /
+			(double)count);
+		isFrozen = !isBlack &&
+			current.difference <= config.freezeMaxDifference;
+	}
+
+	previous.assign(thumb, thumb + count);
+	previousCX = cx;
+	previousCY = cy;
+
+	/* letterboxed */
+	int top = 0, bottom = 0;
+	int maxLuma = config.letterboxMaxLuma;
+
+	while (top < cy && RowMax(thumb + (size_t)cx * top, cx) <= maxLuma)
+		top++;
+	while (bottom < cy - top &&
+	       RowMax(thumb + (size_t)cx * (cy - 1 - bottom), cx) <= maxLuma)
+		bottom++;
+
+	int minRows = (int)ceil(cy * config.letterboxMinPercent / 100.0f);
+	if (minRows < 1)
+		minRows = 1;
+
+	bool isLetterbox = !isBlack && top < cy &&
+		top >= minRows && bottom >= minRows;
+
+	current.barTop    = top * luma.Subsample();
+	current.barBottom = bottom * luma.Subsample();
+
+	int blackChange = black.Update(isBlack, time,
+			config.blackDuration, config.clearDuration);
+	int frozenChange = frozen.Update(isFrozen, time,
+			config.freezeDuration, config.clearDuration);
+	int letterboxChange = letterbox.Update(isLetterbox, time,
+			config.letterboxDuration, config.clearDuration);
+
+	current.black       = black.active;
+	current.frozen      = frozen.active;
+	current.letterboxed = letterbox.active;
+
+	status.Write(current);
+
+	Notify(videoConfig, blackChange, SignalEvent::BlackStart,
+			SignalEvent::BlackEnd, current);
+	Notify(videoConfig, frozenChange, SignalEvent::FrozenStart,
+			SignalEvent::FrozenEnd, current);
+	Notify(videoConfig, letterboxChange, SignalEvent::LetterboxStart,
+			SignalEvent::LetterboxEnd, current);
+}
+
+}; /* namespace DShow */
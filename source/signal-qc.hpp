@@ -0,0 +1,81 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+
+#pragma once
+
+#include "../dshowcapture.hpp"
+#include "luma-stats.hpp"
+#include "seqlock.hpp"
+
+#include <stdint.h>
+#include <vector>
+
+namespace DShow {
+
+/**
+ * Black, frozen and letterboxed frame detection (VideoConfig::qc).  Works
+ * on the downscaled luma the LumaStatsBuilder samples during conversion,
+ * so a frame is never scanned again for it.  Events are raised on the
+ * capture thread once a condition has held (or been gone) for its
+ * configured duration.
+ */
+class SignalQC {
+	struct Detector {
+		bool      active = false;
+		long long onSince = -1;
+		long long offSince = -1;
+
+		/* returns 1 when the condition starts, -1 when it ends */
+		int Update(bool condition, long long time, long long duration,
+				long long clearDuration);
+
+		inline void Restart() {onSince = -1; offSince = -1;}
+	};
+
+	SignalQCConfig        config;
+	SignalEventProc       callback;
+	Detector              black;
+	Detector              frozen;
+	Detector              letterbox;
+	std::vector<uint8_t>  previous;
+	int                   previousCX = 0;
+	int                   previousCY = 0;
+	SeqLock<SignalStatus> status;
+
+	void Notify(const VideoConfig &videoConfig, int change,
+			SignalEvent start, SignalEvent end,
+			const SignalStatus &current);
+
+public:
+	void Configure(const VideoConfig &videoConfig);
+
+	/* sample times start over whenever the graph is run, so the timing
+	 * of the detectors has to as well.  Call while the graph is stopped */
+	void Restart();
+
+	inline bool Active() const {return config.enabled;}
+
+	void Process(const VideoConfig &videoConfig, const LumaStats &stats,
+			const LumaStatsBuilder &luma, long long time);
+
+	inline SignalStatus GetStatus() const {return status.Read();}
+};
+
+}; /* namespace DShow */
@@ -0,0 +1,491 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+
+#include "simulcast.hpp"
+#include "video-convert.hpp"
+#include "worker-pool.hpp"
+#include "alloc-tracker.hpp"
+#include "log.hpp"
+
+#include <math.h>
+
+#include <algorithm>
+
+using namespace std;
+
+namespace DShow {
+
+#define FILTER_BITS           14
+#define FILTER_ONE            (1 << FILTER_BITS)
+
+/* the vertical pass keeps this many extra bits for the horizontal one */
+#define INTERMEDIATE_SHIFT    6
+#define OUTPUT_SHIFT          (FILTER_BITS * 2 - INTERMEDIATE_SHIFT)
+
+#define MIN_BAND_ROWS         16
+
+struct Simulcast::ScaleJob {
+	const Plane                  *src;
+	const Plane                  *dst;
+	const ScaleFilter            *filterX[3];
+	const ScaleFilter            *filterY[3];
+	uint32_t                     *scratch;
+	size_t                       scratchStride;
+	int                          bands;
+	int                          bandRows[3];
+};
+
+struct Simulcast::UnpackJob {
+	const uint8_t                *src;
+	size_t                       srcStride;
+	const Plane                  *dst;
+	bool                         packed;
+	bool                         yFirst;
+	bool                         uFirst;
+	int                          bandRows;
+};
+
+static inline bool IsPacked422(VideoFormat format)
+{
+	return format == VideoFormat::YVYU ||
+	       format == VideoFormat::YUY2 ||
+	       format == VideoFormat::UYVY ||
+	       format == VideoFormat::HDYC;
+}
+
+static int GetBandCount(int rows)
+{
+	int bands = (int)GetWorkerPool().ThreadCount() + 1;
+	int maxBands = max(rows / MIN_BAND_ROWS, 1);
+	return min(bands, maxBands);
+}
+
+Simulcast::Simulcast(const void *owner_)
+	: owner (owner_)
+{
+	base.SetOwner(owner, MemorySubsystem::Simulcast);
+	scratch.SetOwner(owner, MemorySubsystem::Simulcast);
+}
+
+void Simulcast::BuildFilter(ScaleFilter &filter, int in, int out)
+{
+	double scale = (double)in / (double)out;
+	int taps = min((int)ceil(scale) + 1, in);
+	vector<int> weights(taps);
+
+	filter.taps = taps;
+	filter.start.resize(out);
+	filter.weights.resize(size_t(out) * taps);
+
+	/* each output sample averages the input it covers */
+	for (int i = 0; i < out; i++) {
+		double begin = i * scale;
+		double end = begin + scale;
+		int first = (int)floor(begin);
+		int start = min(first, in - taps);
+		int sum = 0;
+		int largest = 0;
+
+		fill(weights.begin(), weights.end(), 0);
+
+		for (int px = first; px < end && px < first + taps; px++) {
+			double overlap = min(end, px + 1.0) -
+				max(begin, (double)px);
+			int index = min(px, in - 1) - start;
+
+			if (overlap <= 0.0)
+				continue;
+
+			weights[index] += (int)(overlap / scale * FILTER_ONE +
+					0.5);
+		}
+
+		for (int t = 0; t < taps; t++) {
+			sum += weights[t];
+			if (weights[t] > weights[largest])
+				largest = t;
+		}
+
+		weights[largest] += FILTER_ONE - sum;
+
+		filter.start[i] = start;
+		for (int t = 0; t < taps; t++)
+			filter.weights[size_t(i) * taps + t] =
+				(int16_t)weights[t];
+	}
+}
+
+void Simulcast::ScaleBand(void *param, size_t index)
+{
+	ScaleJob &job = *reinterpret_cast<ScaleJob*>(param);
+	int plane = (int)index / job.bands;
+	int band = (int)index % job.bands;
+
+	const Plane &src = job.src[plane];
+	const Plane &dst = job.dst[plane];
+	const ScaleFilter &fx = *job.filterX[plane];
+	const ScaleFilter &fy = *job.filterY[plane];
+	uint32_t *row = job.scratch + job.scratchStride * index;
+
+	int y = band * job.bandRows[plane];
+	int yEnd = min(y + job.bandRows[plane], dst.cy);
+
+	for (; y < yEnd; y++) {
+		const int16_t *wy = &fy.weights[size_t(y) * fy.taps];
+		const uint8_t *in = src.data + src.stride * fy.start[y];
+
+		for (int x = 0; x < src.cx; x++)
+			row[x] = 0;
+
+		for (int t = 0; t < fy.taps; t++) {
+			uint32_t w = (uint32_t)wy[t];
+			for (int x = 0; x < src.cx; x++)
+				row[x] += in[x] * w;
+			in += src.stride;
+		}
+
+		for (int x = 0; x < src.cx; x++)
+			row[x] >>= INTERMEDIATE_SHIFT;
+
+		uint8_t *out = dst.data + dst.stride * y;
+
+		for (int x = 0; x < dst.cx; x++) {
+			const int16_t *wx = &fx.weights[size_t(x) * fx.taps];
+			const uint32_t *p = row + fx.start[x];
+			uint32_t sum = 0;
+
+			for (int t = 0; t < fx.taps; t++)
+				sum += p[t] * (uint32_t)wx[t];
+
+			out[x] = (uint8_t)((sum + (1 << (OUTPUT_SHIFT - 1))) >>
+					OUTPUT_SHIFT);
+		}
+	}
+}
+
+void Simulcast::UnpackBand(void *param, size_t index)
+{
+	UnpackJob &job = *reinterpret_cast<UnpackJob*>(param);
+	const Plane *dst = job.dst;
+
+	int y = (int)index * job.bandRows;
+	int yEnd = min(y + job.bandRows, dst[1].cy);
+
+	for (; y < yEnd; y++) {
+		const uint8_t *src = job.src + job.srcStride * y;
+		uint8_t *u = dst[1].data + dst[1].stride * y;
+		uint8_t *v = dst[2].data + dst[2].stride * y;
+
+		if (job.packed) {
+			UnpackPacked422Row(src, dst[0].data +
+					dst[0].stride * y, u, v, dst[0].cx,
+					job.yFirst, job.uFirst,
+					ChromaLayout::Planar422);
+			continue;
+		}
+
+		for (int x = 0; x < dst[1].cx; x++) {
+			u[x] = src[x * 2];
+			v[x] = src[x * 2 + 1];
+		}
+	}
+}
+
+void Simulcast::Configure(const VideoConfig &config)
+{
+	renditions.clear();
+	frameCount = 0;
+
+	if (config.renditions.empty())
+		return;
+
+	format = config.format;
+	cx     = config.cx;
+	cy     = abs(config.cy);
+
+	bool supported = format == VideoFormat::I420 ||
+	                 format == VideoFormat::YV12 ||
+	                 format == VideoFormat::NV12 ||
+	                 IsPacked422(format);
+	if (!supported || cx <= 0 || cy <= 0) {
+		Warning(L"Simulcast: Renditions can't be made from video "
+		        L"format %d", (int)format);
+		return;
+	}
+
+	vector<SimulcastRendition> infos;
+
+	for (const SimulcastRendition &info : config.renditions) {
+		bool valid = info.cx > 0 && info.cy > 0 &&
+			info.frameDivisor > 0 &&
+			(info.callback || info.sampleCallback) &&
+			(info.format == VideoFormat::I420 ||
+			 info.format == VideoFormat::YV12);
+
+		if (!valid) {
+			Warning(L"Simulcast: Ignoring invalid rendition "
+			        L"%dx%d", info.cx, info.cy);
+			continue;
+		}
+
+		infos.push_back(info);
+	}
+
+	/* largest first, so every rendition comes after its source */
+	stable_sort(infos.begin(), infos.end(),
+			[] (const SimulcastRendition &a,
+			    const SimulcastRendition &b)
+	{
+		return (long long)a.cx * a.cy > (long long)b.cx * b.cy;
+	});
+
+	bool packed = IsPacked422(format);
+	int baseChromaCX = (cx + 1) / 2;
+	int baseChromaCY = packed ? cy : (cy + 1) / 2;
+
+	renditions.resize(infos.size());
+
+	for (size_t i = 0; i < infos.size(); i++) {
+		Rendition &r = renditions[i];
+		r.info   = infos[i];
+		r.source = -1;
+		r.needed = false;
+		r.frame.SetOwner(owner, MemorySubsystem::Simulcast);
+
+		for (size_t j = i; j > 0; j--) {
+			const SimulcastRendition &larger = infos[j - 1];
+			if (larger.cx >= r.info.cx && larger.cy >= r.info.cy) {
+				r.source = (int)(j - 1);
+				break;
+			}
+		}
+
+		int srcCX = cx, srcCY = cy;
+		int srcChromaCX = baseChromaCX, srcChromaCY = baseChromaCY;
+
+		if (r.source >= 0) {
+			srcCX       = infos[r.source].cx;
+			srcCY       = infos[r.source].cy;
+			srcChromaCX = (srcCX + 1) / 2;
+			srcChromaCY = (srcCY + 1) / 2;
+		}
+
+		BuildFilter(r.filterX[0], srcCX, r.info.cx);
+		BuildFilter(r.filterY[0], srcCY, r.info.cy);
+		BuildFilter(r.filterX[1], srcChromaCX, (r.info.cx + 1) / 2);
+		BuildFilter(r.filterY[1], srcChromaCY, (r.info.cy + 1) / 2);
+
+		r.config                = config;
+		r.config.callback       = nullptr;
+		r.config.sampleCallback = nullptr;
+		r.config.renditions.clear();
+		r.config.cx             = r.info.cx;
+		r.config.cy             = r.info.cy;
+		r.config.format         = r.info.format;
+		r.config.frameInterval *= r.info.frameDivisor;
+
+		Info(L"Simulcast: %dx%d every %d frame(s), from %dx%d",
+				r.info.cx, r.info.cy, r.info.frameDivisor,
+				srcCX, srcCY);
+	}
+}
+
+void Simulcast::Free()
+{
+	renditions.clear();
+	base.Free();
+	scratch.Free();
+}
+
+bool Simulcast::PrepareBase(const unsigned char *data, size_t size)
+{
+	int chromaCX = (cx + 1) / 2;
+	int chromaCY = (cy + 1) / 2;
+	size_t lumaSize = size_t(cx) * cy;
+	size_t chromaSize = size_t(chromaCX) * chromaCY;
+	uint8_t *src = (uint8_t*)data;
+
+	if (format == VideoFormat::I420 || format == VideoFormat::YV12) {
+		if (size < lumaSize + chromaSize * 2)
+			return false;
+
+		bool yv12 = format == VideoFormat::YV12;
+		uint8_t *u = src + lumaSize + (yv12 ? chromaSize : 0);
+		uint8_t *v = src + lumaSize + (yv12 ? 0 : chromaSize);
+
+		basePlanes[0] = {src, size_t(cx), cx, cy};
+		basePlanes[1] = {u, size_t(chromaCX), chromaCX, chromaCY};
+		basePlanes[2] = {v, size_t(chromaCX), chromaCX, chromaCY};
+		return true;
+	}
+
+	UnpackJob job = {};
+	int rows;
+
+	if (format == VideoFormat::NV12) {
+		if (size < lumaSize + chromaSize * 2)
+			return false;
+		if (!base.Resize(chromaSize * 2))
+			return false;
+
+		basePlanes[0] = {src, size_t(cx), cx, cy};
+		basePlanes[1] = {base.Data(), size_t(chromaCX),
+			chromaCX, chromaCY};
+		basePlanes[2] = {base.Data() + chromaSize, size_t(chromaCX),
+			chromaCX, chromaCY};
+
+		job.src       = src + lumaSize;
+		job.srcStride = size_t(chromaCX) * 2;
+		rows          = chromaCY;
+	} else {
+		size_t stride = size_t(chromaCX) * 4;
+		size_t chroma422 = size_t(chromaCX) * cy;
+
+		if (size < stride * cy)
+			return false;
+		if (!base.Resize(lumaSize + chroma422 * 2))
+			return false;
+
+		uint8_t *y = base.Data();
+
+		basePlanes[0] = {y, size_t(cx), cx, cy};
+		basePlanes[1] = {y + lumaSize, size_t(chromaCX),
+			chromaCX, cy};
+		basePlanes[2] = {y + lumaSize + chroma422, size_t(chromaCX),
+			chromaCX, cy};
+
+		job.src       = src;
+		job.srcStride = stride;
+		job.packed    = true;
+		job.yFirst    = format == VideoFormat::YUY2 ||
+		                format == VideoFormat::YVYU;
+		job.uFirst    = format != VideoFormat::YVYU;
+		rows          = cy;
+	}
+
+	int bands = GetBandCount(rows);
+
+	job.dst      = basePlanes;
+	job.bandRows = (rows + bands - 1) / bands;
+
+	GetWorkerPool().Run(UnpackBand, &job, bands);
+	return true;
+}
+
+bool Simulcast::Scale(Rendition &r)
+{
+	int chromaCX = (r.info.cx + 1) / 2;
+	int chromaCY = (r.info.cy + 1) / 2;
+	size_t lumaSize = size_t(r.info.cx) * r.info.cy;
+	size_t chromaSize = size_t(chromaCX) * chromaCY;
+
+	if (!r.frame.Resize(lumaSize + chromaSize * 2))
+		return false;
+
+	/* YV12 stores V ahead of U */
+	bool yv12 = r.info.format == VideoFormat::YV12;
+	uint8_t *y = r.frame.Data();
+	uint8_t *u = y + lumaSize + (yv12 ? chromaSize : 0);
+	uint8_t *v = y + lumaSize + (yv12 ? 0 : chromaSize);
+
+	r.planes[0] = {y, size_t(r.info.cx), r.info.cx, r.info.cy};
+	r.planes[1] = {u, size_t(chromaCX), chromaCX, chromaCY};
+	r.planes[2] = {v, size_t(chromaCX), chromaCX, chromaCY};
+
+	const Plane *src = r.source >= 0 ?
+		renditions[r.source].planes : basePlanes;
+
+	ScaleJob job = {};
+	job.src   = src;
+	job.dst   = r.planes;
+	job.bands = GetBandCount(r.info.cy);
+
+	for (int i = 0; i < 3; i++) {
+		int index = i ? 1 : 0;
+		job.filterX[i]  = &r.filterX[index];
+		job.filterY[i]  = &r.filterY[index];
+		job.bandRows[i] = (r.planes[i].cy + job.bands - 1) / job.bands;
+	}
+
+	/* one intermediate row per task */
+	job.scratchStride = (size_t(src[0].cx) + 15) & ~size_t(15);
+
+	size_t tasks = size_t(job.bands) * 3;
+	if (!scratch.Resize(tasks * job.scratchStride * sizeof(uint32_t)))
+		return false;
+
+	job.scratch = (uint32_t*)scratch.Data();
+
+	GetWorkerPool().Run(ScaleBand, &job, tasks);
+	return true;
+}
+
+void Simulcast::Process(const unsigned char *data, size_t size,
+		long long startTime, long long stopTime)
+{
+	ALLOC_SUBSCOPE("simulcast");
+
+	unsigned long long frame = frameCount++;
+	bool any = false;
+
+	for (Rendition &r : renditions)
+		r.needed = false;
+
+	for (size_t i = renditions.size(); i > 0; i--) {
+		Rendition &r = renditions[i - 1];
+
+		if (frame % r.info.frameDivisor == 0)
+			r.needed = true;
+		if (!r.needed)
+			continue;
+
+		if (r.source >= 0)
+			renditions[r.source].needed = true;
+		any = true;
+	}
+
+	if (!any || !PrepareBase(data, size))
+		return;
+
+	for (Rendition &r : renditions) {
+		bool sourceReady = r.source < 0 ||
+			renditions[r.source].needed;
+
+		if (!r.needed || !sourceReady || !Scale(r)) {
+			r.needed = false;
+			continue;
+		}
+
+		if (frame % r.info.frameDivisor != 0)
+			continue;
+
+		ALLOC_PAUSE();
+
+		if (r.info.sampleCallback)
+			r.info.sampleCallback(r.info.sampleParam, r.config,
+					r.frame.Data(), r.frame.Size(),
+					startTime, stopTime);
+		else
+			r.info.callback(r.config, r.frame.Data(),
+					r.frame.Size(), startTime, stopTime);
+	}
+}
+
+}; /* namespace DShow */
@@ -0,0 +1,100 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+
+#pragma once
+
+#include "../dshowcapture.hpp"
+#include "buffer-pool.hpp"
+
+#include <stdint.h>
+#include <vector>
+
+namespace DShow {
+
+/**
+ * Produces the VideoConfig::renditions of a video stream.
+ *
+ * Each captured frame is brought into planar form once (packed 4:2:2 is
+ * unpacked, NV12 chroma is split; I420/YV12 are used in place).  Every
+ * rendition is then scaled from the smallest larger rendition, or from
+ * that planar frame, with the rows split across the worker pool.  A
+ * rendition that is skipped by its frame divisor is still produced when
+ * a smaller one needs it as a source.
+ */
+class Simulcast {
+	struct Plane {
+		uint8_t                *data;
+		size_t                 stride;
+		int                    cx, cy;
+	};
+
+	/* per output pixel/row: first input index and 'taps' weights */
+	struct ScaleFilter {
+		int                    taps = 0;
+		std::vector<int>       start;
+		std::vector<int16_t>   weights;
+	};
+
+	struct Rendition {
+		SimulcastRendition     info;
+		VideoConfig            config;
+		PoolBuffer             frame;
+		Plane                  planes[3];
+		ScaleFilter            filterX[2];
+		ScaleFilter            filterY[2];
+		int                    source;
+		bool                   needed;
+	};
+
+	struct ScaleJob;
+	struct UnpackJob;
+
+	const void                 *owner;
+	VideoFormat                format = VideoFormat::Unknown;
+	int                        cx = 0, cy = 0;
+	Plane                      basePlanes[3];
+	PoolBuffer                 base;
+	PoolBuffer                 scratch;
+	std::vector<Rendition>     renditions;
+	unsigned long long         frameCount = 0;
+
+	static void BuildFilter(ScaleFilter &filter, int in, int out);
+	static void ScaleBand(void *param, size_t index);
+	static void UnpackBand(void *param, size_t index);
+
+	bool PrepareBase(const unsigned char *data, size_t size);
+	bool Scale(Rendition &rendition);
+
+public:
+	Simulcast(const void *owner);
+
+	/** Sets up the renditions of 'config'; clears them if it has none */
+	void Configure(const VideoConfig &config);
+
+	/** Drops the renditions and returns all buffers to the pool */
+	void Free();
+
+	inline bool Active() const {return !renditions.empty();}
+
+	void Process(const unsigned char *data, size_t size,
+			long long startTime, long long stopTime);
+};
+
+}; /* namespace DShow */
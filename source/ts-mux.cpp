@@ -0,0 +1,599 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+
+#include "ts-mux.hpp"
+#include "h264-nal.hpp"
+
+#include <string.h>
+
+#include <algorithm>
+
+using namespace std;
+
+namespace DShow {
+
+#define TS_PACKET_SIZE        188
+#define TS_PAYLOAD_SIZE       184
+#define TS_CLOCK              90000
+#define AAC_FRAME_SAMPLES     1024
+
+#define PID_PAT               0x0000
+#define PID_PMT               0x1000
+#define PID_VIDEO             0x0100
+#define PID_AUDIO             0x0101
+
+#define STREAM_TYPE_H264      0x1B
+#define STREAM_TYPE_AAC       0x0F
+
+/* timestamps start a second in, and the PCR runs a little ahead of the
+ * decode times, so neither can go negative */
+#define TIME_OFFSET           TS_CLOCK
+#define PCR_LEAD              (TS_CLOCK / 10)
+
+/* bounds a GOP when keyframes are rare */
+#define MAX_GOP_SECONDS       10
+
+static const int aacSampleRates[] = {
+	96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050,
+	16000, 12000, 11025, 8000, 7350
+};
+
+static const uint8_t accessUnitDelimiter[] = {0, 0, 0, 1, 9, 0xF0};
+static const uint8_t startCode[] = {0, 0, 0, 1};
+
+static uint32_t CRC32(const uint8_t *data, size_t size)
+{
+	uint32_t crc = 0xFFFFFFFF;
+
+	for (size_t i = 0; i < size; i++) {
+		crc ^= (uint32_t)data[i] << 24;
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc & 0x80000000) ?
+				(crc << 1) ^ 0x04C11DB7 : crc << 1;
+	}
+
+	return crc;
+}
+
+static inline void PutData(vector<uint8_t> &b, const void *data, size_t size)
+{
+	const uint8_t *p = (const uint8_t*)data;
+	b.insert(b.end(), p, p + size);
+}
+
+static void PutTimestamp(vector<uint8_t> &b, uint8_t prefix, int64_t time)
+{
+	uint64_t ts = (uint64_t)time & 0x1FFFFFFFFULL;
+
+	b.push_back((uint8_t)((prefix << 4) | ((ts >> 29) & 0x0E) | 1));
+	b.push_back((uint8_t)(ts >> 22));
+	b.push_back((uint8_t)(((ts >> 14) & 0xFE) | 1));
+	b.push_back((uint8_t)(ts >> 7));
+	b.push_back((uint8_t)(((ts << 1) & 0xFE) | 1));
+}
+
+static inline bool IsADTS(const uint8_t *data, size_t size)
+{
+	return size >= 7 && data[0] == 0xFF && (data[1] & 0xF6) == 0xF0;
+}
+
+static inline int64_t ToClock(int64_t time)
+{
+	return time * TS_CLOCK / 10000000;
+}
+
+TSMux::TSMux()
+{
+	pat.pid   = PID_PAT;
+	pmt.pid   = PID_PMT;
+	video.pid = PID_VIDEO;
+	audio.pid = PID_AUDIO;
+}
+
+void TSMux::SetVideo(int64_t frameInterval_)
+{
+	videoEnabled  = true;
+	frameInterval = frameInterval_ > 0 ? frameInterval_ : 333333;
+}
+
+void TSMux::SetAudio(int sampleRate_, int channels_)
+{
+	audioEnabled = true;
+	sampleRate   = sampleRate_;
+	channels     = channels_;
+}
+
+void TSMux::SetSegmentDuration(int64_t duration)
+{
+	segmentDuration = ToClock(duration);
+}
+
+void TSMux::WritePackets(vector<uint8_t> &out, Stream &stream,
+		const uint8_t *data, size_t size, bool keyframe, int64_t pcr)
+{
+	bool first = true;
+
+	do {
+		/* the first packet of a PES may carry the random access flag
+		 * and PCR; the last one is padded out with adaptation field
+		 * stuffing */
+		bool flags = first && (keyframe || pcr >= 0);
+		size_t minField = flags ? (pcr >= 0 ? 8 : 2) : 0;
+		size_t chunk = min(size, (size_t)TS_PAYLOAD_SIZE - minField);
+		size_t field = TS_PAYLOAD_SIZE - chunk;
+
+		size_t start = out.size();
+		out.resize(start + TS_PACKET_SIZE);
+		uint8_t *p = &out[start];
+
+		p[0] = 0x47;
+		p[1] = (uint8_t)((first ? 0x40 : 0) | (stream.pid >> 8));
+		p[2] = (uint8_t)stream.pid;
+		p[3] = (uint8_t)((field ? 0x30 : 0x10) |
+				(stream.continuity++ & 0xF));
+
+		if (field) {
+			p[4] = (uint8_t)(field - 1);
+
+			if (field > 1) {
+				size_t pos = 6;
+
+				p[5] = 0;
+				if (flags && keyframe)
+					p[5] |= 0x40;
+
+				if (flags && pcr >= 0) {
+					uint64_t base = (uint64_t)pcr &
+						0x1FFFFFFFFULL;
+
+					p[5] |= 0x10;
+					p[6]  = (uint8_t)(base >> 25);
+					p[7]  = (uint8_t)(base >> 17);
+					p[8]  = (uint8_t)(base >> 9);
+					p[9]  = (uint8_t)(base >> 1);
+					p[10] = (uint8_t)(((base & 1) << 7) | 0x7E);
+					p[11] = 0;
+					pos   = 12;
+				}
+
+				memset(p + pos, 0xFF, 4 + field - pos);
+			}
+		}
+
+		memcpy(p + 4 + field, data, chunk);
+
+		data += chunk;
+		size -= chunk;
+		first = false;
+	} while (size);
+}
+
+void TSMux::WriteSection(vector<uint8_t> &out, Stream &stream,
+		const vector<uint8_t> &section)
+{
+	size_t start = out.size();
+	out.resize(start + TS_PACKET_SIZE, 0xFF);
+	uint8_t *p = &out[start];
+
+	p[0] = 0x47;
+	p[1] = (uint8_t)(0x40 | (stream.pid >> 8));
+	p[2] = (uint8_t)stream.pid;
+	p[3] = (uint8_t)(0x10 | (stream.continuity++ & 0xF));
+	p[4] = 0; /* pointer field */
+
+	uint32_t crc = CRC32(section.data(), section.size());
+
+	memcpy(p + 5, section.data(), section.size());
+	p += 5 + section.size();
+	p[0] = (uint8_t)(crc >> 24);
+	p[1] = (uint8_t)(crc >> 16);
+	p[2] = (uint8_t)(crc >> 8);
+	p[3] = (uint8_t)crc;
+}
+
+void TSMux::WriteTables(vector<uint8_t> &out)
+{
+	uint16_t pcrPid = videoEnabled ? PID_VIDEO : PID_AUDIO;
+	vector<uint8_t> section;
+
+	/* section lengths count everything after the length field,
+	 * including the CRC */
+	section = {
+		0x00, 0xB0, 13,
+		0x00, 0x01, 0xC1, 0x00, 0x00,
+		0x00, 0x01, (uint8_t)(0xE0 | (PID_PMT >> 8)),
+		(uint8_t)PID_PMT
+	};
+	WriteSection(out, pat, section);
+
+	section = {
+		0x02, 0xB0, 0,
+		0x00, 0x01, 0xC1, 0x00, 0x00,
+		(uint8_t)(0xE0 | (pcrPid >> 8)), (uint8_t)pcrPid,
+		0xF0, 0x00
+	};
+
+	if (videoEnabled) {
+		uint8_t entry[] = {STREAM_TYPE_H264,
+			0xE0 | (PID_VIDEO >> 8), (uint8_t)PID_VIDEO, 0xF0, 0};
+		PutData(section, entry, sizeof(entry));
+	}
+	if (audioEnabled) {
+		uint8_t entry[] = {STREAM_TYPE_AAC,
+			0xE0 | (PID_AUDIO >> 8), (uint8_t)PID_AUDIO, 0xF0, 0};
+		PutData(section, entry, sizeof(entry));
+	}
+
+	section[2] = (uint8_t)(section.size() - 3 + 4);
+	WriteSection(out, pmt, section);
+}
+
+void TSMux::WritePES(vector<uint8_t> &out, Stream &stream,
+		const uint8_t *data, size_t size, int64_t pts, int64_t dts,
+		bool keyframe)
+{
+	bool isVideo = &stream == &video;
+	bool hasDts = dts != pts;
+	size_t headerSize = hasDts ? 10 : 5;
+	size_t length = 3 + headerSize + size;
+
+	pts += TIME_OFFSET;
+	dts += TIME_OFFSET;
+
+	/* video may leave the length open; audio has to fill it in */
+	if (length > 0xFFFF || isVideo)
+		length = 0;
+
+	pesHeader.clear();
+	pesHeader.push_back(0);
+	pesHeader.push_back(0);
+	pesHeader.push_back(1);
+	pesHeader.push_back(isVideo ? 0xE0 : 0xC0);
+	pesHeader.push_back((uint8_t)(length >> 8));
+	pesHeader.push_back((uint8_t)length);
+	pesHeader.push_back(0x80);
+	pesHeader.push_back(hasDts ? 0xC0 : 0x80);
+	pesHeader.push_back((uint8_t)headerSize);
+	PutTimestamp(pesHeader, hasDts ? 3 : 2, pts);
+	if (hasDts)
+		PutTimestamp(pesHeader, 1, dts);
+
+	PutData(pesHeader, data, size);
+
+	/* the PCR goes out with every PES of the PCR stream, which keeps it
+	 * well inside the 100ms spacing the spec asks for */
+	bool carriesPcr = isVideo || !videoEnabled;
+
+	WritePackets(out, stream, pesHeader.data(), pesHeader.size(),
+			keyframe, carriesPcr ? dts - PCR_LEAD : -1);
+}
+
+bool TSMux::StartSegment(vector<uint8_t> &out, int64_t pts)
+{
+	if (segmentStarted) {
+		if (pts - segmentStart < segmentDuration)
+			return false;
+
+		SegmentEnd end;
+		end.offset   = out.size();
+		end.duration = (double)(pts - segmentStart) / TS_CLOCK;
+		segmentEnds.push_back(end);
+	}
+
+	WriteTables(out);
+	segmentStart   = pts;
+	segmentStarted = true;
+	return true;
+}
+
+void TSMux::AddSyncPoint(size_t offset, int64_t pts, uint32_t flags)
+{
+	RecordIndexEntry point = {};
+	point.time   = pts * 10000000 / TS_CLOCK;
+	point.offset = offset;
+	point.flags  = flags;
+	syncPoints.push_back(point);
+
+	lastSyncPoint = pts;
+}
+
+void TSMux::WriteAudio(vector<uint8_t> &out, size_t count)
+{
+	int64_t delay = max(reorderDelay, (int64_t)0);
+
+	for (size_t i = 0; i < count; i++) {
+		const Frame &frame = audioFrames[i];
+		int64_t pts = frame.pts + delay;
+
+		WritePES(out, audio, audioData.data() + frame.offset,
+				frame.size, pts, pts, false);
+	}
+
+	if (count == audioFrames.size()) {
+		audioFrames.clear();
+		audioData.clear();
+		return;
+	}
+
+	size_t consumed = audioFrames[count].offset;
+
+	audioFrames.erase(audioFrames.begin(), audioFrames.begin() + count);
+	audioData.erase(audioData.begin(), audioData.begin() + consumed);
+
+	for (Frame &frame : audioFrames)
+		frame.offset -= consumed;
+}
+
+void TSMux::WriteGOP(vector<uint8_t> &out, int64_t nextPts)
+{
+	size_t count = gop.size();
+
+	/* only presentation times are known; decode times are the same
+	 * times in ascending order, with everything pushed back by the
+	 * reorder depth of the first GOP (see MP4Mux::WriteRun) */
+	decodeTimes.resize(count);
+	for (size_t i = 0; i < count; i++)
+		decodeTimes[i] = gop[i].pts;
+
+	sort(decodeTimes.begin(), decodeTimes.end());
+
+	if (reorderDelay < 0) {
+		reorderDelay = 0;
+		for (size_t i = 0; i < count; i++)
+			reorderDelay = max(reorderDelay,
+					decodeTimes[i] - gop[i].pts);
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		if (decodeTimes[i] <= lastVideoDts)
+			decodeTimes[i] = lastVideoDts + 1;
+		lastVideoDts = decodeTimes[i];
+	}
+
+	if (gop[0].keyframe) {
+		uint32_t flags = DSHOW_RECORD_INDEX_KEYFRAME;
+		if (audioEnabled)
+			flags |= DSHOW_RECORD_INDEX_AUDIO;
+
+		/* taken before StartSegment, so that at a segment start
+		 * the entry points at the PAT rather than the PES */
+		AddSyncPoint(out.size(), gop[0].pts, flags);
+		StartSegment(out, gop[0].pts + reorderDelay);
+	}
+
+	size_t audioCount = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		const Frame &frame = gop[i];
+
+		while (audioCount < audioFrames.size() &&
+		       audioFrames[audioCount].pts + reorderDelay <=
+		       decodeTimes[i])
+			audioCount++;
+
+		WriteAudio(out, audioCount);
+		audioCount = 0;
+
+		WritePES(out, video, gopData.data() + frame.offset,
+				frame.size, frame.pts + reorderDelay,
+				decodeTimes[i], frame.keyframe);
+	}
+
+	streamEnd = nextPts + reorderDelay;
+
+	gop.clear();
+	gopData.clear();
+}
+
+void TSMux::AddVideo(const uint8_t *data, size_t size, int64_t timestamp,
+		vector<uint8_t> &out)
+{
+	if (!videoEnabled)
+		return;
+
+	const uint8_t *end = data + size;
+	const uint8_t *nal = FindStartCode(data, end);
+	bool keyframe = false;
+	bool hasSps = false;
+	bool hasPps = false;
+	bool hasDelimiter = false;
+
+	/* where the stream's delimiter and SPS end, so that missing
+	 * parameter sets can be put in the right place */
+	const uint8_t *delimiterEnd = data;
+	const uint8_t *spsEnd = data;
+
+	while (nal < end) {
+		nal += 3;
+
+		const uint8_t *next = FindStartCode(nal, end);
+		const uint8_t *nalEnd = next;
+
+		while (nalEnd > nal && nalEnd[-1] == 0)
+			nalEnd--;
+
+		int type = nalEnd > nal ? nal[0] & 0x1F : 0;
+
+		if (type == 7) {
+			sps.assign(nal, nalEnd);
+			hasSps = true;
+			spsEnd = nalEnd;
+		} else if (type == 8) {
+			pps.assign(nal, nalEnd);
+			hasPps = true;
+		} else if (type == 5) {
+			keyframe = true;
+		} else if (type == 9 && !hasDelimiter) {
+			hasDelimiter = true;
+			delimiterEnd = nalEnd;
+		}
+
+		nal = next;
+	}
+
+	if (!timelineStarted) {
+		if (!keyframe || sps.empty() || pps.empty())
+			return;
+
+		baseTime        = timestamp;
+		timelineStarted = true;
+	}
+
+	int64_t pts = ToClock(timestamp - baseTime);
+
+	if (!gop.empty()) {
+		bool cut = keyframe || pts - gop[0].pts >=
+			(int64_t)TS_CLOCK * MAX_GOP_SECONDS;
+
+		if (cut)
+			WriteGOP(out, pts);
+	}
+
+	Frame frame;
+	frame.pts      = pts;
+	frame.offset   = gopData.size();
+	frame.keyframe = keyframe;
+
+	/* segments have to stand alone, so every access unit gets a
+	 * delimiter and every keyframe its parameter sets */
+	if (!hasDelimiter)
+		PutData(gopData, accessUnitDelimiter,
+				sizeof(accessUnitDelimiter));
+
+	/* the delimiter has to stay the first NAL of the access unit, and
+	 * the PPS has to follow the SPS it refers to */
+	const uint8_t *paramsAt = hasSps ? spsEnd : delimiterEnd;
+
+	PutData(gopData, data, paramsAt - data);
+
+	if (keyframe && !hasSps) {
+		PutData(gopData, startCode, sizeof(startCode));
+		PutData(gopData, sps.data(), sps.size());
+	}
+	if (keyframe && !hasPps) {
+		PutData(gopData, startCode, sizeof(startCode));
+		PutData(gopData, pps.data(), pps.size());
+	}
+
+	PutData(gopData, paramsAt, end - paramsAt);
+	frame.size = gopData.size() - frame.offset;
+
+	gop.push_back(frame);
+}
+
+void TSMux::AddAudio(const uint8_t *data, size_t size, int64_t timestamp,
+		vector<uint8_t> &out)
+{
+	if (!audioEnabled || !size)
+		return;
+
+	if (!timelineStarted) {
+		if (videoEnabled)
+			return;
+
+		baseTime        = timestamp;
+		timelineStarted = true;
+		reorderDelay    = 0;
+	}
+
+	if (timestamp < baseTime)
+		return;
+
+	Frame frame;
+	frame.pts      = ToClock(timestamp - baseTime);
+	frame.offset   = audioData.size();
+	frame.keyframe = true;
+
+	/* TS carries AAC with ADTS headers, so raw frames get one */
+	if (!IsADTS(data, size)) {
+		size_t frameSize = size + 7;
+		int index = 3;
+		int config = channels == 8 ? 7 : channels;
+
+		for (size_t i = 0; i < sizeof(aacSampleRates) / sizeof(int);
+				i++) {
+			if (aacSampleRates[i] == sampleRate) {
+				index = (int)i;
+				break;
+			}
+		}
+
+		uint8_t header[7] = {
+			0xFF, 0xF1,
+			(uint8_t)(0x40 | (index << 2) | (config >> 2)),
+			(uint8_t)(((config & 3) << 6) | (frameSize >> 11)),
+			(uint8_t)(frameSize >> 3),
+			(uint8_t)(((frameSize & 7) << 5) | 0x1F),
+			0xFC
+		};
+
+		PutData(audioData, header, sizeof(header));
+	} else {
+		int index = (data[2] >> 2) & 0xF;
+		if (index < 13)
+			sampleRate = aacSampleRates[index];
+	}
+
+	PutData(audioData, data, size);
+	frame.size = audioData.size() - frame.offset;
+	audioFrames.push_back(frame);
+
+	if (!videoEnabled) {
+		size_t offset = out.size();
+		bool due = frame.pts - lastSyncPoint >= TS_CLOCK;
+
+		if (StartSegment(out, frame.pts) || due)
+			AddSyncPoint(offset, frame.pts,
+					DSHOW_RECORD_INDEX_AUDIO);
+
+		WriteAudio(out, audioFrames.size());
+
+		streamEnd = frame.pts + (sampleRate ?
+			(int64_t)AAC_FRAME_SAMPLES * TS_CLOCK / sampleRate : 0);
+	}
+}
+
+void TSMux::Flush(vector<uint8_t> &out)
+{
+	if (!gop.empty()) {
+		int64_t lastPts = gop[0].pts;
+		for (const Frame &frame : gop)
+			lastPts = max(lastPts, frame.pts);
+
+		WriteGOP(out, lastPts + ToClock(frameInterval));
+	}
+
+	if (!audioFrames.empty()) {
+		if (!segmentStarted)
+			StartSegment(out, audioFrames[0].pts);
+		WriteAudio(out, audioFrames.size());
+	}
+
+	if (segmentStarted) {
+		SegmentEnd end;
+		end.offset   = out.size();
+		end.duration = (double)(streamEnd - segmentStart) / TS_CLOCK;
+		segmentEnds.push_back(end);
+
+		segmentStarted = false;
+	}
+}
+
+}; /* namespace DShow */
@@ -0,0 +1,150 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+
+#pragma once
+
+#include "../dshowcapture.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace DShow {
+
+/**
+ * Streaming MPEG-TS muxer for H.264 (Annex B) and AAC (ADTS or raw frames)
+ * that also decides where HLS segments are cut.  Like MP4Mux it only
+ * produces bytes.
+ *
+ * Output starts at the first keyframe.  Video is held back one GOP so that
+ * decode times can be derived from presentation times, and audio is
+ * interleaved with it by decode time.  Segments start on a keyframe once
+ * the current one has reached the segment duration; each new segment
+ * begins with a PAT/PMT so it can be decoded on its own.  The end of every
+ * finished segment is recorded in SegmentEnds() as an offset into the
+ * output of the call that finished it.  Keyframes (or, without video, a
+ * point every second) are likewise recorded in SyncPoints().
+ *
+ * Timestamps are in 100-nanosecond units.
+ */
+class TSMux {
+public:
+	struct SegmentEnd {
+		size_t                 offset;
+		double                 duration;
+	};
+
+private:
+	struct Frame {
+		int64_t                pts;
+		size_t                 offset;
+		size_t                 size;
+		bool                   keyframe;
+	};
+
+	struct Stream {
+		uint16_t               pid;
+		uint8_t                continuity = 0;
+	};
+
+	bool                       videoEnabled = false;
+	bool                       audioEnabled = false;
+	int64_t                    frameInterval = 0;
+	int                        sampleRate = 0;
+	int                        channels = 0;
+	int64_t                    segmentDuration = 0;
+
+	Stream                     pat;
+	Stream                     pmt;
+	Stream                     video;
+	Stream                     audio;
+
+	std::vector<uint8_t>       sps;
+	std::vector<uint8_t>       pps;
+
+	std::vector<Frame>         gop;
+	std::vector<uint8_t>       gopData;
+	std::vector<Frame>         audioFrames;
+	std::vector<uint8_t>       audioData;
+
+	int64_t                    baseTime = 0;
+	int64_t                    reorderDelay = -1;
+	int64_t                    lastVideoDts = -1;
+	int64_t                    streamEnd = 0;
+	int64_t                    segmentStart = 0;
+	int64_t                    lastSyncPoint = 0;
+	bool                       timelineStarted = false;
+	bool                       segmentStarted = false;
+
+	std::vector<int64_t>       decodeTimes;
+	std::vector<uint8_t>       pesHeader;
+	std::vector<SegmentEnd>    segmentEnds;
+	std::vector<RecordIndexEntry> syncPoints;
+
+	void WriteTables(std::vector<uint8_t> &out);
+	void WriteSection(std::vector<uint8_t> &out, Stream &stream,
+			const std::vector<uint8_t> &section);
+	void WritePackets(std::vector<uint8_t> &out, Stream &stream,
+			const uint8_t *data, size_t size, bool keyframe,
+			int64_t pcr);
+	void WritePES(std::vector<uint8_t> &out, Stream &stream,
+			const uint8_t *data, size_t size, int64_t pts,
+			int64_t dts, bool keyframe);
+
+	bool StartSegment(std::vector<uint8_t> &out, int64_t pts);
+	void AddSyncPoint(size_t offset, int64_t pts, uint32_t flags);
+	void WriteAudio(std::vector<uint8_t> &out, size_t count);
+	void WriteGOP(std::vector<uint8_t> &out, int64_t nextPts);
+
+public:
+	TSMux();
+
+	void SetVideo(int64_t frameInterval);
+	void SetAudio(int sampleRate, int channels);
+	void SetSegmentDuration(int64_t duration);
+
+	/**
+	 * Adds an access unit / AAC packet.  Any complete output is appended
+	 * to 'out'.
+	 */
+	void AddVideo(const uint8_t *data, size_t size, int64_t timestamp,
+			std::vector<uint8_t> &out);
+	void AddAudio(const uint8_t *data, size_t size, int64_t timestamp,
+			std::vector<uint8_t> &out);
+
+	/** Writes out everything still buffered and ends the last segment */
+	void Flush(std::vector<uint8_t> &out);
+
+	inline const std::vector<SegmentEnd> &SegmentEnds() const
+	{
+		return segmentEnds;
+	}
+
+	inline void ClearSegmentEnds() {segmentEnds.clear();}
+
+	inline const std::vector<RecordIndexEntry> &SyncPoints() const
+	{
+		return syncPoints;
+	}
+
+	inline void ClearSyncPoints() {syncPoints.clear();}
+};
+
+}; /* namespace DShow */
@@ -0,0 +1,558 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+
+#include "video-convert.hpp"
+#include "fast-copy.hpp"
+#include "luma-stats.hpp"
+#include "alloc-tracker.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef DSHOW_SSE2
+#include <emmintrin.h>
+#include <tmmintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_SSSE3
+#else
+#include <cpuid.h>
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#endif
+#endif
+
+namespace DShow {
+
+/* 4x4 ordered dither thresholds, scaled to the 8 bits dropped when going
+ * from 16-bit containers to 8-bit */
+static const uint16_t ditherMatrix[4][4] = {
+	{  8, 136,  40, 168},
+	{200,  72, 232, 104},
+	{ 56, 184,  24, 152},
+	{248, 120, 216,  88}
+};
+
+#ifdef DSHOW_SSE2
+static bool HasSSSE3()
+{
+	static int ssse3 = -1;
+
+	if (ssse3 == -1) {
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 1);
+		ssse3 = (info[2] & (1 << 9)) != 0;
+#else
+		unsigned int eax, ebx, ecx = 0, edx;
+		ssse3 = __get_cpuid(1, &eax, &ebx, &ecx, &edx) &&
+			(ecx & (1 << 9)) != 0;
+#endif
+	}
+
+	return !!ssse3;
+}
+#endif
+
+static inline uint32_t ReadLE32(const unsigned char *p)
+{
+	return (uint32_t)p[0]       | ((uint32_t)p[1] << 8) |
+	      ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* v210 packs six 4:2:2 pixels into four little-endian words of three 10-bit
+ * components each: Cb0 Y0 Cr0 | Y1 Cb1 Y2 | Cr1 Y3 Cb2 | Y4 Cr2 Y5 */
+static void UnpackV210Block(const unsigned char *src, uint16_t *y,
+		uint16_t *uv, int pixels)
+{
+	uint16_t ys[6], uvs[6];
+	uint32_t w[4];
+
+	for (int i = 0; i < 4; i++)
+		w[i] = ReadLE32(src + i * 4);
+
+	ys[0]  = (uint16_t)((w[0] >> 10) & 0x3FF);
+	ys[1]  = (uint16_t)( w[1]        & 0x3FF);
+	ys[2]  = (uint16_t)((w[1] >> 20) & 0x3FF);
+	ys[3]  = (uint16_t)((w[2] >> 10) & 0x3FF);
+	ys[4]  = (uint16_t)( w[3]        & 0x3FF);
+	ys[5]  = (uint16_t)((w[3] >> 20) & 0x3FF);
+
+	uvs[0] = (uint16_t)( w[0]        & 0x3FF);
+	uvs[1] = (uint16_t)((w[0] >> 20) & 0x3FF);
+	uvs[2] = (uint16_t)((w[1] >> 10) & 0x3FF);
+	uvs[3] = (uint16_t)( w[2]        & 0x3FF);
+	uvs[4] = (uint16_t)((w[2] >> 20) & 0x3FF);
+	uvs[5] = (uint16_t)((w[3] >> 10) & 0x3FF);
+
+	for (int i = 0; i < pixels; i++)
+		y[i] = ys[i] << 6;
+
+	for (int i = 0; i < (pixels + 1) / 2 * 2; i++)
+		uv[i] = uvs[i] << 6;
+}
+
+#ifdef DSHOW_SSE2
+/* each block writes 16 bytes of which only 12 are valid, so this only
+ * handles blocks that are followed by at least two more pixels in the row;
+ * the next block overwrites the excess */
+TARGET_SSSE3
+static int UnpackV210RowSSSE3(const unsigned char *src, uint16_t *y,
+		uint16_t *uv, int cx)
+{
+	const __m128i mask = _mm_set1_epi32(0x3FF);
+	const __m128i yFromAB = _mm_setr_epi8(
+			8, 9, 2, 3, -1, -1, 12, 13,
+			6, 7, -1, -1, -1, -1, -1, -1);
+	const __m128i yFromC = _mm_setr_epi8(
+			-1, -1, -1, -1, 2, 3, -1, -1,
+			-1, -1, 6, 7, -1, -1, -1, -1);
+	const __m128i uvFromAB = _mm_setr_epi8(
+			0, 1, -1, -1, 10, 11, 4, 5,
+			-1, -1, 14, 15, -1, -1, -1, -1);
+	const __m128i uvFromC = _mm_setr_epi8(
+			-1, -1, 0, 1, -1, -1, -1, -1,
+			4, 5, -1, -1, -1, -1, -1, -1);
+
+	int x = 0;
+
+	for (; x + 8 <= cx; x += 6) {
+		__m128i w = _mm_loadu_si128((const __m128i*)src);
+		__m128i a = _mm_and_si128(w, mask);
+		__m128i b = _mm_and_si128(_mm_srli_epi32(w, 10), mask);
+		__m128i c = _mm_and_si128(_mm_srli_epi32(w, 20), mask);
+
+		__m128i ab = _mm_packs_epi32(a, b);
+		__m128i cc = _mm_packs_epi32(c, c);
+
+		__m128i yv = _mm_or_si128(_mm_shuffle_epi8(ab, yFromAB),
+				_mm_shuffle_epi8(cc, yFromC));
+		__m128i uvv = _mm_or_si128(_mm_shuffle_epi8(ab, uvFromAB),
+				_mm_shuffle_epi8(cc, uvFromC));
+
+		_mm_storeu_si128((__m128i*)(y + x),
+				_mm_slli_epi16(yv, 6));
+		_mm_storeu_si128((__m128i*)(uv + x),
+				_mm_slli_epi16(uvv, 6));
+
+		src += 16;
+	}
+
+	return x;
+}
+#endif
+
+void UnpackV210Row(const unsigned char *src, unsigned short *y,
+		unsigned short *uv, int cx)
+{
+	int x = 0;
+
+#ifdef DSHOW_SSE2
+	if (HasSSSE3()) {
+		x = UnpackV210RowSSSE3(src, y, uv, cx);
+		src += x / 6 * 16;
+	}
+#endif
+
+	for (; x < cx; x += 6) {
+		int pixels = cx - x < 6 ? cx - x : 6;
+		UnpackV210Block(src, y + x, uv + x, pixels);
+		src += 16;
+	}
+}
+
+void PackP010Row(const unsigned short *src, unsigned char *dst, int count,
+		int row, bool dither)
+{
+	const uint16_t *d = ditherMatrix[row & 3];
+	int x = 0;
+
+#ifdef DSHOW_SSE2
+	__m128i bias = dither ?
+		_mm_setr_epi16(d[0], d[1], d[2], d[3], d[0], d[1], d[2], d[3]) :
+		_mm_set1_epi16(128);
+
+	for (; x + 16 <= count; x += 16) {
+		__m128i lo = _mm_loadu_si128((const __m128i*)(src + x));
+		__m128i hi = _mm_loadu_si128((const __m128i*)(src + x + 8));
+
+		lo = _mm_srli_epi16(_mm_adds_epu16(lo, bias), 8);
+		hi = _mm_srli_epi16(_mm_adds_epu16(hi, bias), 8);
+
+		_mm_storeu_si128((__m128i*)(dst + x),
+				_mm_packus_epi16(lo, hi));
+	}
+#endif
+
+	for (; x < count; x++) {
+		unsigned int val = src[x] + (dither ? d[x & 3] : 128);
+		dst[x] = (unsigned char)(val > 0xFFFF ? 0xFF : val >> 8);
+	}
+}
+
+/* in SemiPlanar422 mode the interleaved chroma goes to 'u' and 'v' is
+ * unused */
+static void UnpackPacked422Pixels(const uint8_t *src, uint8_t *y,
+		uint8_t *u, uint8_t *v, int x, int cx,
+		bool yFirst, bool uFirst, ChromaLayout layout)
+{
+	int yOff = yFirst ? 0 : 1;
+	int cOff = yFirst ? 1 : 0;
+	int uOff = cOff + (uFirst ? 0 : 2);
+	int vOff = cOff + (uFirst ? 2 : 0);
+
+	for (; x < cx; x += 2) {
+		const uint8_t *p = src + x * 2;
+		int pair = x / 2;
+
+		y[x] = p[yOff];
+		if (x + 1 < cx)
+			y[x + 1] = p[yOff + 2];
+
+		switch (layout) {
+		case ChromaLayout::Planar422:
+			u[pair] = p[uOff];
+			v[pair] = p[vOff];
+			break;
+		case ChromaLayout::SemiPlanar422:
+			u[pair * 2]     = p[uOff];
+			u[pair * 2 + 1] = p[vOff];
+			break;
+		case ChromaLayout::Planar444:
+			u[x] = p[uOff];
+			v[x] = p[vOff];
+			if (x + 1 < cx) {
+				u[x + 1] = p[uOff];
+				v[x + 1] = p[vOff];
+			}
+			break;
+		}
+	}
+}
+
+void UnpackPacked422Row(const unsigned char *src, unsigned char *y,
+		unsigned char *u, unsigned char *v, int cx,
+		bool yFirst, bool uFirst, ChromaLayout layout)
+{
+	int x = 0;
+
+#ifdef DSHOW_SSE2
+	const __m128i mask = _mm_set1_epi16(0x00FF);
+	const __m128i zero = _mm_setzero_si128();
+
+	for (; x + 16 <= cx; x += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i*)(src + x * 2));
+		__m128i b = _mm_loadu_si128((const __m128i*)(src + x * 2 + 16));
+		__m128i yLo, yHi, cLo, cHi;
+
+		if (yFirst) {
+			yLo = _mm_and_si128(a, mask);
+			yHi = _mm_and_si128(b, mask);
+			cLo = _mm_srli_epi16(a, 8);
+			cHi = _mm_srli_epi16(b, 8);
+		} else {
+			yLo = _mm_srli_epi16(a, 8);
+			yHi = _mm_srli_epi16(b, 8);
+			cLo = _mm_and_si128(a, mask);
+			cHi = _mm_and_si128(b, mask);
+		}
+
+		_mm_storeu_si128((__m128i*)(y + x), _mm_packus_epi16(yLo, yHi));
+
+		/* eight chroma pairs, in source order */
+		__m128i c = _mm_packus_epi16(cLo, cHi);
+
+		if (layout == ChromaLayout::SemiPlanar422) {
+			if (!uFirst)
+				c = _mm_or_si128(_mm_slli_epi16(c, 8),
+						_mm_srli_epi16(c, 8));
+
+			_mm_storeu_si128((__m128i*)(u + x), c);
+			continue;
+		}
+
+		__m128i c0 = _mm_packus_epi16(_mm_and_si128(c, mask), zero);
+		__m128i c1 = _mm_packus_epi16(_mm_srli_epi16(c, 8), zero);
+		__m128i cu = uFirst ? c0 : c1;
+		__m128i cv = uFirst ? c1 : c0;
+
+		if (layout == ChromaLayout::Planar422) {
+			_mm_storel_epi64((__m128i*)(u + x / 2), cu);
+			_mm_storel_epi64((__m128i*)(v + x / 2), cv);
+		} else {
+			_mm_storeu_si128((__m128i*)(u + x),
+					_mm_unpacklo_epi8(cu, cu));
+			_mm_storeu_si128((__m128i*)(v + x),
+					_mm_unpacklo_epi8(cv, cv));
+		}
+	}
+#endif
+
+	UnpackPacked422Pixels(src, y, u, v, x, cx, yFirst, uFirst, layout);
+}
+
+static inline void AverageRows(uint16_t *dst, const uint16_t *src, int count)
+{
+	int x = 0;
+
+#ifdef DSHOW_SSE2
+	for (; x + 8 <= count; x += 8) {
+		__m128i a = _mm_loadu_si128((const __m128i*)(dst + x));
+		__m128i b = _mm_loadu_si128((const __m128i*)(src + x));
+		_mm_storeu_si128((__m128i*)(dst + x), _mm_avg_epu16(a, b));
+	}
+#endif
+
+	for (; x < count; x++)
+		dst[x] = (uint16_t)((dst[x] + src[x] + 1) >> 1);
+}
+
+static inline size_t GetSourceStride(size_t minStride, size_t srcSize,
+		size_t rows)
+{
+	/* drivers may pad rows; if the sample is bigger than expected,
+	 * assume the excess is row padding */
+	size_t stride = srcSize / rows;
+	return stride > minStride ? stride & ~(size_t)1 : minStride;
+}
+
+static bool V210ToP0x0(const VideoConfig &config, const unsigned char *src,
+		size_t srcSize, PoolBuffer &dst, bool is420,
+		LumaStatsBuilder *luma)
+{
+	int cx = config.cx;
+	int cy = abs(config.cy);
+	int uvWidth = (cx + 1) / 2 * 2;
+	int uvRows = is420 ? (cy + 1) / 2 : cy;
+
+	size_t srcStride = GetSourceStride((size_t(cx) + 47) / 48 * 128,
+			srcSize, cy);
+	if (srcStride * cy > srcSize)
+		return false;
+
+	size_t ySize = size_t(cx) * cy * 2;
+	size_t uvSize = size_t(uvWidth) * uvRows * 2;
+
+	/* a spare chroma row (plus room for the SIMD overrun) at the end of
+	 * the buffer is used as scratch space for 4:2:0 downsampling */
+	size_t scratch = (size_t(uvWidth) + 8) * 2;
+	if (!dst.Reserve(ySize + uvSize + scratch) ||
+	    !dst.Resize(ySize + uvSize))
+		return false;
+
+	uint16_t *y = (uint16_t*)dst.Data();
+	uint16_t *uv = (uint16_t*)(dst.Data() + ySize);
+	uint16_t *tmp = (uint16_t*)(dst.Data() + ySize + uvSize);
+
+	for (int row = 0; row < cy; row++) {
+		const unsigned char *line = src + srcStride * row;
+		uint16_t *yRow = y + size_t(cx) * row;
+
+		if (!is420) {
+			UnpackV210Row(line, yRow, uv + size_t(uvWidth) * row,
+					cx);
+
+		} else if ((row & 1) == 0) {
+			UnpackV210Row(line, yRow,
+					uv + size_t(uvWidth) * (row / 2), cx);
+		} else {
+			UnpackV210Row(line, yRow, tmp, cx);
+			AverageRows(uv + size_t(uvWidth) * (row / 2), tmp,
+					uvWidth);
+		}
+
+		/* the high bytes of the 16-bit samples */
+		if (luma && luma->WantsRow(row))
+			luma->AddRow((const uint8_t*)yRow + 1, cx, 2);
+	}
+
+	return true;
+}
+
+static bool P010ToNV12(const VideoConfig &config, const unsigned char *src,
+		size_t srcSize, PoolBuffer &dst, LumaStatsBuilder *luma)
+{
+	int cx = config.cx;
+	int cy = abs(config.cy);
+	int uvWidth = (cx + 1) / 2 * 2;
+	int uvRows = (cy + 1) / 2;
+
+	size_t srcStride = GetSourceStride(size_t(cx) * 2, srcSize,
+			size_t(cy) + uvRows);
+	if (srcStride * (size_t(cy) + uvRows) > srcSize)
+		return false;
+
+	size_t ySize = size_t(cx) * cy;
+	if (!dst.Resize(ySize + size_t(uvWidth) * uvRows))
+		return false;
+
+	const unsigned char *srcUV = src + srcStride * cy;
+	unsigned char *y = dst.Data();
+	unsigned char *uv = dst.Data() + ySize;
+
+	for (int row = 0; row < cy; row++) {
+		uint8_t *yRow = y + size_t(cx) * row;
+
+		PackP010Row((const uint16_t*)(src + srcStride * row), yRow,
+				cx, row, config.dither);
+
+		if (luma && luma->WantsRow(row))
+			luma->AddRow(yRow, cx, 1);
+	}
+
+	for (int row = 0; row < uvRows; row++)
+		PackP010Row((const uint16_t*)(srcUV + srcStride * row),
+				uv + size_t(uvWidth) * row, uvWidth, row,
+				config.dither);
+
+	return true;
+}
+
+static bool Packed422ToPlanar(const VideoConfig &config,
+		const unsigned char *src, size_t srcSize, PoolBuffer &dst,
+		LumaStatsBuilder *luma)
+{
+	int cx = config.cx;
+	int cy = abs(config.cy);
+	int uvWidth = (cx + 1) / 2;
+
+	/* YUY2/YVYU have luma first, UYVY/HDYC chroma first; YVYU is the
+	 * only one with Cr ahead of Cb */
+	bool yFirst = config.internalFormat == VideoFormat::YUY2 ||
+	              config.internalFormat == VideoFormat::YVYU;
+	bool uFirst = config.internalFormat != VideoFormat::YVYU;
+
+	ChromaLayout layout;
+	size_t planeSize;
+
+	switch (config.format) {
+	case VideoFormat::I422:
+		layout = ChromaLayout::Planar422;
+		planeSize = size_t(uvWidth) * cy;
+		break;
+	case VideoFormat::NV16:
+		layout = ChromaLayout::SemiPlanar422;
+		planeSize = size_t(uvWidth) * 2 * cy;
+		break;
+	case VideoFormat::I444:
+		layout = ChromaLayout::Planar444;
+		planeSize = size_t(cx) * cy;
+		break;
+	default:
+		return false;
+	}
+
+	size_t srcStride = GetSourceStride(size_t(uvWidth) * 4, srcSize, cy);
+	if (srcStride * cy > srcSize)
+		return false;
+
+	size_t ySize = size_t(cx) * cy;
+	size_t total = layout == ChromaLayout::SemiPlanar422 ?
+		ySize + planeSize : ySize + planeSize * 2;
+	if (!dst.Resize(total))
+		return false;
+
+	unsigned char *y = dst.Data();
+	unsigned char *u = y + ySize;
+	unsigned char *v = layout == ChromaLayout::SemiPlanar422 ?
+		u : u + planeSize;
+	size_t uvStride = planeSize / cy;
+
+	for (int row = 0; row < cy; row++) {
+		UnpackPacked422Row(src + srcStride * row,
+				y + size_t(cx) * row,
+				u + uvStride * row,
+				v + uvStride * row,
+				cx, yFirst, uFirst, layout);
+
+		if (luma && luma->WantsRow(row))
+			luma->AddRow(y + size_t(cx) * row, cx, 1);
+	}
+
+	return true;
+}
+
+static inline bool IsPacked422(VideoFormat format)
+{
+	return format == VideoFormat::YVYU ||
+	       format == VideoFormat::YUY2 ||
+	       format == VideoFormat::UYVY ||
+	       format == VideoFormat::HDYC;
+}
+
+static inline bool IsChromaPreserving(VideoFormat format)
+{
+	return format == VideoFormat::I422 ||
+	       format == VideoFormat::I444 ||
+	       format == VideoFormat::NV16;
+}
+
+bool CanConvertVideo(VideoFormat from, VideoFormat to)
+{
+	if (IsPacked422(from))
+		return IsChromaPreserving(to);
+
+	switch (from) {
+	case VideoFormat::V210:
+		return to == VideoFormat::P010 || to == VideoFormat::P210;
+	case VideoFormat::P010:
+		return to == VideoFormat::NV12;
+	default:
+		return false;
+	}
+}
+
+bool ConvertVideoFrame(const VideoConfig &config,
+		const unsigned char *src, size_t srcSize, PoolBuffer &dst,
+		LumaStatsBuilder *luma)
+{
+	ALLOC_SUBSCOPE("convert");
+
+	if (config.cx <= 0 || !config.cy)
+		return false;
+
+	if (IsPacked422(config.internalFormat))
+		return Packed422ToPlanar(config, src, srcSize, dst,
+				luma);
+
+	switch (config.internalFormat) {
+	case VideoFormat::V210:
+		if (config.format == VideoFormat::P010)
+			return V210ToP0x0(config, src, srcSize, dst, true,
+					luma);
+		else if (config.format == VideoFormat::P210)
+			return V210ToP0x0(config, src, srcSize, dst, false,
+					luma);
+		break;
+
+	case VideoFormat::P010:
+		if (config.format == VideoFormat::NV12)
+			return P010ToNV12(config, src, srcSize, dst, luma);
+		break;
+
+	default:
+		break;
+	}
+
+	return false;
+}
+
+}; /* namespace DShow */
@@ -0,0 +1,67 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+
+#pragma once
+
+#include "../dshowcapture.hpp"
+#include "buffer-pool.hpp"
+
+namespace DShow {
+
+class LumaStatsBuilder;
+
+/**
+ * Whether frames in the device format 'from' can be converted to the
+ * requested format 'to' by the library
+ */
+bool CanConvertVideo(VideoFormat from, VideoFormat to);
+
+/**
+ * Converts a frame from config.internalFormat to config.format.  The
+ * converted frame is tightly packed.
+ *
+ * @param  config   Video config describing the frame (size, formats, dither)
+ * @param  src      Source frame
+ * @param  srcSize  Size of the source frame in bytes
+ * @param  dst      Receives the converted frame
+ * @param  luma     If not null, receives the luma rows of the output as
+ *                  they are written
+ */
+bool ConvertVideoFrame(const VideoConfig &config,
+		const unsigned char *src, size_t srcSize, PoolBuffer &dst,
+		LumaStatsBuilder *luma = nullptr);
+
+/* row kernels; 16-bit outputs hold 10-bit samples in the high bits */
+void UnpackV210Row(const unsigned char *src, unsigned short *y,
+		unsigned short *uv, int cx);
+void PackP010Row(const unsigned short *src, unsigned char *dst, int count,
+		int row, bool dither);
+
+enum class ChromaLayout {
+	Planar422,
+	SemiPlanar422,
+	Planar444
+};
+
+void UnpackPacked422Row(const unsigned char *src, unsigned char *y,
+		unsigned char *u, unsigned char *v, int cx,
+		bool yFirst, bool uFirst, ChromaLayout layout);
+
+}; /* namespace DShow */
@@ -0,0 +1,126 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+
+#include "worker-pool.hpp"
+#include "alloc-tracker.hpp"
+
+using namespace std;
+
+namespace DShow {
+
+#define MAX_WORKER_THREADS 8
+
+struct WorkerJob {
+	WorkerTaskFunc func;
+	void           *param;
+	size_t         count;
+	size_t         next;
+	size_t         done;
+};
+
+WorkerPool::WorkerPool(size_t numThreads)
+{
+	for (size_t i = 0; i < numThreads; i++)
+		threads.emplace_back(&WorkerPool::WorkerThread, this);
+}
+
+/* claims and runs the next index of a job; job state is only ever touched
+ * with jobMutex held, so a finished job can be dropped from the queue by
+ * its caller without racing the workers */
+bool WorkerPool::RunNextTask(unique_lock<mutex> &lock, WorkerJob *job)
+{
+	if (job->next == job->count)
+		return false;
+
+	size_t index = job->next++;
+
+	lock.unlock();
+	{
+		ALLOC_SCOPE("worker");
+		job->func(job->param, index);
+	}
+	lock.lock();
+
+	if (++job->done == job->count)
+		doneCond.notify_all();
+
+	return true;
+}
+
+void WorkerPool::WorkerThread()
+{
+	unique_lock<mutex> lock(jobMutex);
+
+	for (;;) {
+		jobCond.wait(lock, [this] () {return !jobs.empty();});
+
+		WorkerJob *job = jobs.front();
+		if (!RunNextTask(lock, job) && !jobs.empty() &&
+		    jobs.front() == job)
+			jobs.pop_front();
+	}
+}
+
+void WorkerPool::Run(WorkerTaskFunc func, void *param, size_t count)
+{
+	if (threads.empty() || count < 2) {
+		for (size_t i = 0; i < count; i++)
+			func(param, i);
+		return;
+	}
+
+	WorkerJob job = {func, param, count, 0, 0};
+	unique_lock<mutex> lock(jobMutex);
+
+	jobs.push_back(&job);
+	jobCond.notify_all();
+
+	while (RunNextTask(lock, &job));
+
+	doneCond.wait(lock, [&job] () {return job.done == job.count;});
+
+	for (auto it = jobs.begin(); it != jobs.end(); ++it) {
+		if (*it == &job) {
+			jobs.erase(it);
+			break;
+		}
+	}
+}
+
+WorkerPool &GetWorkerPool()
+{
+	/* intentionally never destroyed: joining threads from a static
+	 * destructor would run under the loader lock when the DLL unloads */
+	static WorkerPool *pool = nullptr;
+	static once_flag  flag;
+
+	call_once(flag, [] () {
+		size_t cores = thread::hardware_concurrency();
+		size_t count = cores > 1 ? cores / 2 : 0;
+		if (count > MAX_WORKER_THREADS)
+			count = MAX_WORKER_THREADS;
+
+		pool = new WorkerPool(count);
+	});
+
+	return *pool;
+}
+
+}; /* namespace DShow */
@@ -0,0 +1,64 @@
+/*
+ *  Copyright (C) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace DShow {
+
+typedef void (*WorkerTaskFunc)(void *param, size_t index);
+
+struct WorkerJob;
+
+/**
+ * Process-wide pool of worker threads used to split large per-frame work
+ * (copies, conversion, scaling) into independent pieces.
+ */
+class WorkerPool {
+	std::mutex                     jobMutex;
+	std::condition_variable        jobCond;
+	std::condition_variable        doneCond;
+	std::deque<WorkerJob*>         jobs;
+	std::vector<std::thread>       threads;
+
+	bool RunNextTask(std::unique_lock<std::mutex> &lock, WorkerJob *job);
+	void WorkerThread();
+
+public:
+	WorkerPool(size_t numThreads);
+
+	/**
+	 * Calls func(param, i) for every i in [0, count) and returns once all
+	 * of them have finished.  The calling thread takes part in the work,
+	 * so this always makes progress even if every worker is busy.
+	 */
+	void Run(WorkerTaskFunc func, void *param, size_t count);
+
+	inline size_t ThreadCount() const {return threads.size();}
+};
+
+WorkerPool &GetWorkerPool();
+
+}; /* namespace DShow */